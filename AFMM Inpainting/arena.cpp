@@ -0,0 +1,102 @@
+#include "arena.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+
+
+static double seconds()					//wall-clock time, for the allocator statistics
+{
+#ifdef _WIN32
+   LARGE_INTEGER f,t;
+   QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t);
+   return double(t.QuadPart)/double(f.QuadPart);
+#else
+   timeval tv; gettimeofday(&tv,0);
+   return tv.tv_sec + tv.tv_usec*1.0e-6;
+#endif
+}
+
+
+ARENA::ARENA(size_t block_): blocks(),block_size(block_),in_use(0),max_use(0),job_max(0),last_max(0),held(0),nheap(0),theap(0)
+{  }
+
+ARENA::~ARENA()
+{  heap_free();  }
+
+
+char* ARENA::heap_alloc(size_t n)
+{
+   double t = seconds();
+   char* m = new char[n];
+   theap += seconds()-t; nheap++; held += n;
+   return m;
+}
+
+void ARENA::heap_free()
+{
+   for(size_t b=0;b<blocks.size();b++) delete[] blocks[b].mem;
+   blocks.clear(); held = 0;
+}
+
+
+void* ARENA::alloc(size_t n)
+{
+   n = (n+15) & ~size_t(15);				//keep every allocation 16-aligned
+
+   size_t b;
+   for(b=0;b<blocks.size();b++)				//first block with enough room left
+      if (blocks[b].size-blocks[b].used >= n) break;
+
+   if (b==blocks.size())				//none: get a new block from the heap
+   {
+      BLOCK nb; nb.size = (n>block_size)? n : block_size;
+      nb.mem = heap_alloc(nb.size+15); nb.used = 0;
+      blocks.push_back(nb);
+   }
+
+   BLOCK& bl = blocks[b];
+   char* base = (char*)((size_t(bl.mem)+15) & ~size_t(15));
+   void* p = base+bl.used;
+   bl.used += n; in_use += n;
+   if (in_use>max_use) max_use = in_use;
+   if (in_use>job_max) job_max = in_use;
+   return p;
+}
+
+
+void ARENA::reset()
+{
+   if (blocks.size()>1)					//merge the blocks, so that the next job of
+   {							//the same size fits in a single one
+      size_t n = (max_use>block_size)? max_use : block_size;
+      heap_free();
+      BLOCK nb; nb.size = n; nb.mem = heap_alloc(n+15); nb.used = 0;
+      blocks.push_back(nb);
+   }
+   for(size_t b=0;b<blocks.size();b++) blocks[b].used = 0;
+   in_use = 0; last_max = job_max; job_max = 0;
+}
+
+
+size_t peak_rss()
+{
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS pmc;
+   if (!GetProcessMemoryInfo(GetCurrentProcess(),&pmc,sizeof(pmc))) return 0;
+   return pmc.PeakWorkingSetSize;
+#else
+   rusage ru; getrusage(RUSAGE_SELF,&ru);
+#ifdef __APPLE__
+   return ru.ru_maxrss;					//bytes on OS X
+#else
+   return size_t(ru.ru_maxrss)*1024;			//kilobytes elsewhere
+#endif
+#endif
+}
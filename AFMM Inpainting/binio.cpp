@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binio.h"
+#include "byteswap.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+
+FILE_MAPPING::FILE_MAPPING(): mode(READ),length(0)
+#ifdef _WIN32
+   ,file(INVALID_HANDLE_VALUE),mapping(0)
+#else
+   ,fd(-1)
+#endif
+{  }
+
+FILE_MAPPING::~FILE_MAPPING()
+{  close();  }
+
+#ifdef _WIN32
+static void* mapFile(void* file,FILE_MAPPING::MODE mode,unsigned long long length)	//the mapping object, 0 if the
+{											//file is empty or it fails
+   if (!length) return 0;
+   DWORD protect = (mode==FILE_MAPPING::READ)? PAGE_READONLY : (mode==FILE_MAPPING::COPY)? PAGE_WRITECOPY : PAGE_READWRITE;
+   return CreateFileMappingA((HANDLE)file,0,protect,0,0,0);
+}
+#endif
+
+bool FILE_MAPPING::open(const char* fname,MODE m)
+{
+   close();
+   mode = m;
+#ifdef _WIN32
+   file = CreateFileA(fname,(m==WRITE)? GENERIC_READ|GENERIC_WRITE : GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,0,0);
+   if (file==INVALID_HANDLE_VALUE) return false;
+   LARGE_INTEGER sz;
+   if (!GetFileSizeEx((HANDLE)file,&sz)) { close(); return false; }
+   length  = (unsigned long long)sz.QuadPart;
+   mapping = mapFile(file,mode,length);				//if it fails, map() does
+#else
+   fd = ::open(fname,(m==WRITE)? O_RDWR : O_RDONLY);
+   if (fd<0) return false;
+   struct stat st;
+   if (fstat(fd,&st)) { close(); return false; }
+   length = (unsigned long long)st.st_size;
+#endif
+   return true;
+}
+
+bool FILE_MAPPING::create(const char* fname)
+{
+   close();
+   mode = WRITE;
+#ifdef _WIN32
+   file = CreateFileA(fname,GENERIC_READ|GENERIC_WRITE,FILE_SHARE_READ,0,CREATE_ALWAYS,0,0);
+   return file!=INVALID_HANDLE_VALUE;
+#else
+   fd = ::open(fname,O_RDWR|O_CREAT|O_TRUNC,0666);
+   return fd>=0;
+#endif
+}
+
+bool FILE_MAPPING::resize(unsigned long long size)
+{
+#ifdef _WIN32
+   if (mapping) { CloseHandle((HANDLE)mapping); mapping = 0; }
+   LARGE_INTEGER sz; sz.QuadPart = LONGLONG(size);
+   if (!SetFilePointerEx((HANDLE)file,sz,0,FILE_BEGIN) || !SetEndOfFile((HANDLE)file)) return false;
+   length  = size;
+   mapping = mapFile(file,mode,length);
+#else
+   if (ftruncate(fd,off_t(size))) return false;
+   length = size;
+#endif
+   return true;
+}
+
+void FILE_MAPPING::close()
+{
+#ifdef _WIN32
+   if (mapping) CloseHandle((HANDLE)mapping);
+   if (file!=INVALID_HANDLE_VALUE) CloseHandle((HANDLE)file);
+   file = INVALID_HANDLE_VALUE; mapping = 0;
+#else
+   if (fd>=0) ::close(fd);
+   fd = -1;
+#endif
+   length = 0;
+}
+
+char* FILE_MAPPING::map(unsigned long long offset,size_t n)
+{
+#ifdef _WIN32
+   if (!mapping) return 0;
+   DWORD access = (mode==READ)? FILE_MAP_READ : (mode==COPY)? FILE_MAP_COPY : FILE_MAP_WRITE;
+   return (char*)MapViewOfFile((HANDLE)mapping,access,DWORD(offset>>32),DWORD(offset&0xffffffff),n);
+#else
+   if (fd<0 || !n) return 0;
+   void* m = mmap(0,n,(mode==READ)? PROT_READ : PROT_READ|PROT_WRITE,(mode==COPY)? MAP_PRIVATE : MAP_SHARED,fd,off_t(offset));
+   return (m==MAP_FAILED)? 0 : (char*)m;
+#endif
+}
+
+bool FILE_MAPPING::flush(char* p,size_t n)
+{
+#ifdef _WIN32
+   return FlushViewOfFile(p,n)!=0;
+#else
+   return msync(p,n,MS_SYNC)==0;
+#endif
+}
+
+void FILE_MAPPING::unmap(char* p,size_t n)
+{
+#ifdef _WIN32
+   (void)n;
+   UnmapViewOfFile(p);
+#else
+   munmap(p,n);
+#endif
+}
+
+
+
+MAPPED_FILE::MAPPED_FILE(): f(),p(0),n(0)
+{  }
+
+MAPPED_FILE::~MAPPED_FILE()
+{  close();  }
+
+bool MAPPED_FILE::open(const char* fname)
+{
+   close();
+   if (!f.open(fname,FILE_MAPPING::COPY)) return false;		//copy on write: the values may be swapped in place
+   n = size_t(f.size());
+   if (n) p = f.map(0,n);
+   if (!p) { close(); return false; }
+   return true;
+}
+
+bool MAPPED_FILE::create(const char* fname,size_t size)
+{
+   close();
+   if (!f.create(fname) || !f.resize(size)) { close(); return false; }
+   n = size;
+   p = f.map(0,n);
+   if (!p) { close(); return false; }
+   return true;
+}
+
+void MAPPED_FILE::close()
+{
+   if (p) FILE_MAPPING::unmap(p,n);
+   f.close();
+   p = 0; n = 0;
+}
+
+
+
+static const char* token(const char* s,const char* end,char* buf,int size)	//next blank-separated token from s
+{										//into buf, skipping '#' comments
+   for(;;)
+   {
+      while (s<end && (*s==' ' || *s=='\t' || *s=='\r' || *s=='\n')) s++;
+      if (s<end && *s=='#')
+      {  while (s<end && *s!='\n') s++;  continue;  }
+      break;
+   }
+   int k = 0;
+   while (s<end && k<size-1 && !(*s==' ' || *s=='\t' || *s=='\r' || *s=='\n' || *s=='#')) buf[k++] = *s++;
+   buf[k] = 0;
+   return (k)? s : 0;
+}
+
+bool readNetpbmHeader(const MAPPED_FILE& f,NETPBM_HEADER& h)
+{
+   const char *s = f.data(),*end = s+f.size();
+   if (f.size()<2 || s[0]!='P') return false;
+   h.type = s[1];
+   if (h.type!='5' && h.type!='6' && h.type!='f' && h.type!='F') return false;
+   s += 2;
+
+   char buf[32];
+   if (!(s = token(s,end,buf,sizeof(buf)))) return false;
+   h.nx = atoi(buf);
+   if (!(s = token(s,end,buf,sizeof(buf)))) return false;
+   h.ny = atoi(buf);
+   if (!(s = token(s,end,buf,sizeof(buf)))) return false;
+   h.maxval = float(atof(buf));
+   if (s==end || h.nx<=0 || h.ny<=0 || h.maxval==0) return false;
+   s++;									//a single blank before the values
+
+   h.channels = (h.type=='5' || h.type=='f')? 1 : 3;
+   h.bytes    = (h.type=='f' || h.type=='F')? 4 : (h.maxval<256)? 1 : 2;
+   h.offset   = s-f.data();
+   return f.size()-h.offset >= size_t(h.nx)*h.ny*h.channels*h.bytes;
+}
+
+int writeNetpbmHeader(char* buf,char type,int nx,int ny)
+{
+#ifdef IS_BIG_ENDIAN
+   const char* scale = "1.0";
+#else
+   const char* scale = "-1.0";
+#endif
+   return sprintf(buf,"P%c\n%d %d\n%s\n",type,nx,ny,(type=='f' || type=='F')? scale : "255");
+}
+
+
+
+static unsigned int getLE(const unsigned char* p,int n)		//little-endian value of n bytes
+{
+   unsigned int v = 0;
+   for(int k=n-1;k>=0;k--) v = (v<<8) | p[k];
+   return v;
+}
+
+bool readBMPHeader(const MAPPED_FILE& f,BMP_HEADER& h)
+{
+   const unsigned char* p = (const unsigned char*)f.data();
+   if (f.size()<54 || p[0]!='B' || p[1]!='M') return false;
+   unsigned int offBits  = getLE(p+10,4);
+   int          numCols  = int(getLE(p+18,4));
+   int          numRows  = int(getLE(p+22,4));
+   unsigned int bitsPix  = getLE(p+28,2);				//8 or 24
+   unsigned int compr    = getLE(p+30,4);
+   if (compr || (bitsPix!=8 && bitsPix!=24) || numCols<=0 || numRows<=0) return false;
+
+   h.nx       = numCols;
+   h.ny       = numRows;
+   h.bpp      = bitsPix/8;
+   h.offset   = offBits;
+   h.rowBytes = ((size_t(h.bpp)*numCols+3)/4)*4;
+   return h.offset<=f.size() && f.size()-h.offset >= h.rowBytes*numRows;
+}
+
+
+
+bool readRawHeader(MAPPED_FILE& f,unsigned int valueSize,RAW_HEADER& h)
+{
+   if (f.size()<sizeof(RAW_HEADER)) return false;
+   memcpy(&h,f.data(),sizeof(RAW_HEADER));
+   if (memcmp(h.magic,RAW_MAGIC,sizeof(h.magic))) return false;
+
+   bool other = h.byteOrder!=RAW_BYTE_ORDER;				//written on a machine of the other byte order
+   if (other)
+   {
+      swap4Range((char*)&h.byteOrder,4);
+      if (h.byteOrder!=RAW_BYTE_ORDER) return false;
+   }
+   if (h.valueSize!=valueSize || h.nx<=0 || h.ny<=0) return false;
+   size_t n = size_t(h.nx)*h.ny;
+   if (f.size()-sizeof(RAW_HEADER) < n*valueSize) return false;
+   if (other)								//the values swapped in the (private) mapping
+   {
+      char* v = f.data()+sizeof(RAW_HEADER);
+      if (valueSize%4==0)      swap4Range(v,int(n*valueSize/4));
+      else if (valueSize%2==0) swap2Range(v,int(n*valueSize/2));
+   }
+   return true;
+}
+
+void writeRawHeader(char* buf,unsigned int valueSize,int nx,int ny)
+{
+   RAW_HEADER h;
+   memcpy(h.magic,RAW_MAGIC,sizeof(h.magic));
+   h.byteOrder = RAW_BYTE_ORDER;
+   h.valueSize = valueSize;
+   h.nx = nx; h.ny = ny;
+   memcpy(buf,&h,sizeof(h));
+}
+
+
@@ -1,53 +1,84 @@
 #include "byteswap.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BYTESWAP_SSE2
+#endif
 
-#ifdef IS_BIG_ENDIAN
-
-void swap2BERange(char*, int) { }
-void swap4BERange(char*, int) { }
 
-#else
 
-void swap2BERange(char* mem_ptr1, int num)
-{
+void swap2Range(char* mem_ptr1, int num)		//16 bytes at a time: the bytes of every
+{							//16-bit lane swapped by shifts
   char one_byte;
   char *pos;
-  int i;
-  
+  int i = 0;
+
   pos = mem_ptr1;
-  
-  for (i = 0; i < num; i++)
+
+#ifdef BYTESWAP_SSE2
+  for (; i + 8 <= num; i += 8)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)pos);
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i*)pos, v);
+    pos = pos + 16;
+  }
+#endif
+  for (; i < num; i++)
   {
     one_byte = pos[0];
     pos[0] = pos[1];
     pos[1] = one_byte;
     pos = pos + 2;
   }
-  
+
 }
 
-void swap4BERange(char* mem_ptr1, int num)
-{
-  char one_byte;
+void swap4Range(char* mem_ptr1, int num)		//16 bytes at a time: the bytes of every
+{							//16-bit lane swapped, then the lanes of
+  char one_byte;					//every 32-bit word
   char *pos;
-  int i;
-  
+  int i = 0;
+
   pos = mem_ptr1;
-  
-  for (i = 0; i < num; i++)
+
+#ifdef BYTESWAP_SSE2
+  for (; i + 4 <= num; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)pos);
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+    _mm_storeu_si128((__m128i*)pos, v);
+    pos = pos + 16;
+  }
+#endif
+  for (; i < num; i++)
   {
     one_byte = pos[0];
     pos[0] = pos[3];
     pos[3] = one_byte;
-    
+
     one_byte = pos[1];
     pos[1] = pos[2];
     pos[2] = one_byte;
     pos = pos + 4;
   }
-  
+
 }
 
+
+#ifdef IS_BIG_ENDIAN
+
+void swap2BERange(char*, int) { }
+void swap4BERange(char*, int) { }
+void swap4LERange(char* mem_ptr, int num) { swap4Range(mem_ptr, num); }
+
+#else
+
+void swap2BERange(char* mem_ptr, int num) { swap2Range(mem_ptr, num); }
+void swap4BERange(char* mem_ptr, int num) { swap4Range(mem_ptr, num); }
+void swap4LERange(char*, int) { }
+
 #endif
 
 
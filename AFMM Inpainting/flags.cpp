@@ -7,7 +7,7 @@
 
 
 
-FLAGS::FLAGS(FIELD<float>& f,float low): FIELD<int>(f.dimX(),f.dimY())
+FLAGS::FLAGS(FIELD<float>& f,float low,ARENA* a): FIELD<int>(f.dimX(),f.dimY(),a)
 //Construct this and adjust f by thresholding f with value low. f will be set to
 //0 outside the evolved region, 1 on its boundary, and INFINITY inside.
 {									
@@ -32,7 +32,7 @@ FLAGS::FLAGS(FIELD<float>& f,float low): FIELD<int>(f.dimX(),f.dimY())
 
 
 
-FLAGS::FLAGS(FIELD<float>& f,const FIELD<float>& t,float low): FIELD<int>(f.dimX(),f.dimY())
+FLAGS::FLAGS(FIELD<float>& f,const FIELD<float>& t,float low,ARENA* a): FIELD<int>(f.dimX(),f.dimY(),a)
 //Construct this and adjust f by thresholding f with value low. f will be set to
 //the signal t outside and on the boundary of the evolved region, and INFINITY inside.
 {
@@ -63,6 +63,10 @@ FLAGS::FLAGS(FIELD<float>& f,const FIELD<float>& t,float low): FIELD<int>(f.dimX
  	 else f.value(i,j) = INFINITY;
 }
 
+
+FLAGS::FLAGS(const FLAGS& fl,ARENA* a): FIELD<int>(fl,a)
+{  }
+
 /*
 FLAGS::FLAGS(FIELD<float>& f,const FIELD<float>& t,float low): FIELD<int>(f.dimX(),f.dimY())
 //Construct this and adjust f by thresholding f with value low. f will be set to
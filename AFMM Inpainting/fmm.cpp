@@ -4,14 +4,13 @@
 #include <iostream>
 #include <signal.h>
 
-struct 	NewValue {  int i; int j; float value;  };	//Used in the diffuse() routine
-
 
 
 
 
 FastMarchingMethod::FastMarchingMethod(FIELD<float>* f_,FLAGS* flags_,int N_)
-		   :f(f_),flags(flags_),ptrs(f_->dimX(),f_->dimY()),N(N_)
+		   :f(f_),flags(flags_),ptrs(f_->dimX(),f_->dimY()),N(N_),
+		    prog(0),prog_arg(0),prog_every(1),dirty(0),reports(true)
 {
    for(int j=0;j<flags->dimY();j++)
       for(int i=0;i<flags->dimX();i++)
@@ -36,9 +35,11 @@ int FastMarchingMethod::execute(int& negd_, int& nextr_, float maxf_)
    {
       if (!diffuse()) break;
 
+      if (prog && iteration%prog_every==prog_every-1 && prog(prog_arg))
+      {  iteration++; break;  }
       if (cc==1000)
       {
-	cout<<"Iteration "<<iteration<<" done"<<endl;
+	if (reports) cout<<"Iteration "<<iteration<<" done"<<endl;
         cc=0;
       }
    }
@@ -81,8 +82,6 @@ void FastMarchingMethod::solve(int fi_1j,int fij_1,float vi_1j,float vij_1,float
 
 int FastMarchingMethod::diffuse()
 {
-    static NewValue newp[20]; 
-
     //*** 1. FIND POINT IN NARROWBAND WITH LOWEST DISTANCE-VALUE
     int min_i,min_j;
     std::multimap<float,Coord>::iterator it=map.begin();
@@ -156,10 +155,12 @@ void FastMarchingMethod::tag_nbs(int min_i,int min_j,		//Gathers all neighbours
                                  int i,int j,Coord* nbs,	//are to be updated because updating (i,j).
 				 int& nn)
 {
+    if (dirty) dirty[j] = 1;				//(i,j) itself was just made alive
     if (min_i>=0 && min_i<flags->dimX() && min_j>=0 && min_j<flags->dimY() && 
         !flags->alive(min_i,min_j) && !flags->extremum(min_i,min_j))
     {
        nbs[nn].i = min_i; nbs[nn].j = min_j; nn++;
+       if (dirty) dirty[min_j] = 1;
        if (flags->value(min_i,min_j)!=FLAGS::NARROW_BAND)
           add_to_narrowband(min_i,min_j,i,j);			//Here we do our gathering stuff!
     }
@@ -176,3 +177,23 @@ void FastMarchingMethod::add_to_narrowband(int i,int j,int,int)	//Adds point i,j
 
 
 
+void FastMarchingMethod::narrowband(std::vector<NarrowbandPoint>& nb) const
+{
+   nb.clear(); nb.reserve(map.size());
+   for(std::multimap<float,Coord>::const_iterator it=map.begin();it!=map.end();it++)
+   {
+      NarrowbandPoint p = { (*it).first, (*it).second.i, (*it).second.j };
+      nb.push_back(p);
+   }
+}
+
+
+void FastMarchingMethod::narrowband(const NarrowbandPoint* nb,int n)
+{							//points of equal value stay in the given order, since
+   map.clear();						//a multimap inserts each after the equal ones it has
+   for(int k=0;k<n;k++)
+   {
+      std::multimap<float,Coord>::value_type v(nb[k].value,Coord(nb[k].i,nb[k].j));
+      ptrs.value(nb[k].i,nb[k].j) = map.insert(v);
+   }
+}
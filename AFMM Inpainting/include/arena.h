@@ -0,0 +1,54 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// ARENA:	Scratch memory for the fields of one inpainting job. Fields built on an
+//		arena (see FIELD(nx,ny,arena)) take their storage from it instead of the heap,
+//		and never free it themselves: reset() releases everything in one shot.
+//
+//		The memory is kept across reset() calls. If a job needed more than one block,
+//		reset() merges them into a single block as large as the peak usage, so running
+//		the same job again touches the heap no more.
+//
+//		Only for fields of plain types (float, int): the storage is not constructed.
+
+#include <stddef.h>
+#include <vector>
+
+
+class ARENA
+	{
+	public:
+			ARENA(size_t block=4<<20);		//Ctor. 'block' is the minimal size of a heap block
+		       ~ARENA();
+		void*	alloc(size_t);				//get n bytes, 16-aligned, valid until reset()
+		void	reset();				//release all allocations made so far
+
+		size_t	used() const		{ return in_use; }	//bytes handed out since the last reset()
+		size_t	peak() const		{ return max_use; }	//max of used() ever seen
+		size_t	job_peak() const	{ return last_max; }	//max of used() before the last reset()
+		size_t	reserved() const	{ return held; }	//bytes taken from the heap
+		int	heap_calls() const	{ return nheap; }	//number of heap allocations done
+		double	heap_time() const	{ return theap; }	//seconds spent in them
+
+	private:
+
+		struct BLOCK { char* mem; size_t size; size_t used; };
+
+		char*	heap_alloc(size_t);
+		void	heap_free();
+
+		std::vector<BLOCK> blocks;
+		size_t	block_size;
+		size_t	in_use,max_use,job_max,last_max,held;
+		int	nheap;
+		double	theap;
+
+			ARENA(const ARENA&);
+		ARENA&	operator=(const ARENA&);
+	};
+
+
+size_t	peak_rss();						//peak resident memory of the process, in bytes
+
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef BINIO_H
+#define BINIO_H
+
+// Binary field and image files, read and written through a memory mapping in one
+// go instead of value by value: PGM/PPM (P5/P6, 8 or 16 bit), PFM (Pf gray, PF
+// color, 32-bit floats), uncompressed 8/24-bit BMP and raw FIELD dumps. The values
+// are converted between byte orders in bulk (see byteswap.h).
+//
+// A raw dump is a RAW_HEADER and the values of the field as they are in memory,
+// row after row. A dump written on a machine of the other byte order is swapped
+// when read.
+
+#include <stddef.h>
+
+
+class FILE_MAPPING						//a file, mapped a range at a time: the one place the
+	{							//Win32 and POSIX mapping calls are made
+	public:
+		enum	MODE { READ, COPY, WRITE };		//read only; written to in memory only (copy on write);
+								//written to the file
+			FILE_MAPPING();
+		       ~FILE_MAPPING();
+		bool	open(const char*,MODE);			//an existing file
+		bool	create(const char*);			//a new file (truncated if it exists), empty, for WRITE
+		bool	resize(unsigned long long);		//the file made that long, new bytes being 0; before any map()
+		void	close();				//the views must be unmapped first
+	unsigned long long size() const		{ return length; }
+		char*	map(unsigned long long,size_t);		//a view of n bytes from offset (a multiple of 64 KB), 0 if it
+								//can't be mapped; may be called from several threads at once
+	static	bool	flush(char*,size_t);			//a view's written bytes to the file
+	static	void	unmap(char*,size_t);			//a view and its size
+
+	private:
+
+		MODE	mode;
+	unsigned long long length;
+#ifdef _WIN32
+		void*	file;
+		void*	mapping;				//0 while the file is empty
+#else
+		int	fd;
+#endif
+
+			FILE_MAPPING(const FILE_MAPPING&);
+	FILE_MAPPING&	operator=(const FILE_MAPPING&);
+	};
+
+
+class MAPPED_FILE						//a whole file, mapped
+	{
+	public:
+			MAPPED_FILE();
+		       ~MAPPED_FILE();
+		bool	open(const char*);			//map an existing file for reading
+		bool	create(const char*,size_t);		//create a file of n bytes, mapped for writing
+		void	close();				//unmap it, the written bytes going to the file
+		char*	data()			{ return p; }
+	const char*	data() const		{ return p; }
+		size_t	size() const		{ return n; }
+
+	private:
+
+		FILE_MAPPING f;
+		char*	p;
+		size_t	n;
+
+			MAPPED_FILE(const MAPPED_FILE&);
+	MAPPED_FILE&	operator=(const MAPPED_FILE&);
+	};
+
+
+struct NETPBM_HEADER
+	{
+	char		type;					//'5' PGM, '6' PPM, 'f' gray PFM, 'F' color PFM
+	int		nx,ny;
+	float		maxval;					//PGM/PPM: max value; PFM: scale, <0 if little-endian
+	int		channels;				//1 or 3
+	int		bytes;					//per channel value: 1 or 2 (big-endian), 4 for PFM
+	size_t		offset;					//where the values begin
+	};
+
+struct BMP_HEADER
+	{
+	int		nx,ny;
+	int		bpp;					//bytes per pixel: 1 (luminance) or 3 (BGR)
+	size_t		offset;					//where the rows begin, the bottom one first
+	size_t		rowBytes;				//with the padding
+	};
+
+struct RAW_HEADER
+	{
+	char		magic[8];				//RAW_MAGIC
+	unsigned int	byteOrder;				//RAW_BYTE_ORDER, as the writing machine has it
+	unsigned int	valueSize;				//sizeof() a value
+	int		nx,ny;
+	};
+
+const char		RAW_MAGIC[8] = { 'F','I','E','L','D','R','A','W' };
+const unsigned int	RAW_BYTE_ORDER = 0x01020304;
+
+
+bool	readNetpbmHeader(const MAPPED_FILE&,NETPBM_HEADER&);	//false if not a whole P5, P6, Pf or PF file
+int	writeNetpbmHeader(char*,char,int,int);			//"P5 nx ny 255" and such into buf (64 bytes), returns
+								//its length; a PFM is in this machine's byte order
+bool	readBMPHeader(const MAPPED_FILE&,BMP_HEADER&);		//false if not a whole 8/24-bit uncompressed BMP
+bool	readRawHeader(MAPPED_FILE&,unsigned int,RAW_HEADER&);	//false if not a whole dump of values of the given
+								//size; swaps the values if written the other way
+void	writeRawHeader(char*,unsigned int,int,int);
+
+
+#endif
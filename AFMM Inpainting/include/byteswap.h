@@ -2,9 +2,11 @@
 #define BYTE_SWAP_H
 
 
-void swap2BERange(char* mem_ptr, int num);
+void swap2Range(char* mem_ptr, int num);		//swap the bytes of num 2-byte values
+void swap4Range(char* mem_ptr, int num);		//swap the bytes of num 4-byte values
+void swap2BERange(char* mem_ptr, int num);		//big-endian <-> this machine's order
 void swap4BERange(char* mem_ptr, int num);
+void swap4LERange(char* mem_ptr, int num);		//little-endian <-> this machine's order
 
 
 #endif
-
@@ -8,6 +8,9 @@
 #include <fstream>
 #include <stdlib.h>
 #include <io.h>
+#include "arena.h"
+#include "binio.h"
+#include "byteswap.h"
 
 using namespace std;
 
@@ -18,12 +21,12 @@ template <class T> class FIELD
 	public:
 
                 enum FILE_TYPE {
-                        BMP, PGM, VTK, ASCII, UNKNOWN 
+                        BMP, PGM, PFM, RAW, VTK, ASCII, UNKNOWN 
                         };
                         
 
-			FIELD(int=0,int=0);
-			FIELD(const FIELD&);
+			FIELD(int=0,int=0,ARENA* =0);		//Ctor. With an arena, the values are taken from it
+			FIELD(const FIELD&,ARENA* =0);		//and never freed by this (see ARENA::reset())
 	       	       ~FIELD();
 	  T&            value(int,int);				//value at (i,j)
           const T&      value(int,int) const;			//const version of above
@@ -44,27 +47,31 @@ template <class T> class FIELD
 	  void		minmax(T&,T&,T&) const;			//min, max, avg for field
 	  void		normalize();				//normalize this between 0 and 1
 	  FIELD&	operator*=(T);				//multiply field by scalar
-	  void		write(char*);				//write field to VTK struct points data file
-	  void		writeGrid(char*);			//write field to VTK struct grid data file
+	  void		write(char*);				//write field to VTK struct points data file (binary)
+	  void		writeGrid(char*);			//write field to VTK struct grid data file (binary)
 	  void		writePPM(char*) const;			//write field to PPM RGB file
 	  void		writePGM(char*) const;			//write field to PGM grayscale file
+	  void		writePFM(char*) const;			//write field values as they are to gray PFM file
+	  void		writeRaw(char*) const;			//dump field values as they are in memory (see binio.h)
 	  
 	  static FIELD* read(char*);				//read field from data file in various formats
+	  static FIELD* readRaw(char*);				//read field from raw dump, of any T
           static FILE_TYPE                                      //get file type we could read from
                         fileType(char*);        
 	  void		size(const FIELD&);
 	  
 	private:
 
-	  static FIELD*	readVTK(char*);				//read field from VTK scalar data file	
-	  static FIELD* readPGM(char*);				//read field from PGM binary file
+	  static FIELD*	readVTK(char*);				//read field from VTK scalar data file, ASCII or binary
+	  static FIELD* readPGM(char*);				//read field from PGM or PPM binary file
+	  static FIELD* readPFM(char*);				//read field from PFM file
 	  static FIELD* readASCII(char*);			//read field from plain ASCII data file
           static FIELD* readBMP(char*);                         //read field from BMP image file
-          static unsigned long
-                        getLong(fstream&);
-          static unsigned short
-                        getShort(fstream&);
+	  T*		alloc(int n)	{ return (arena)? (T*)arena->alloc(n*sizeof(T)) : new T[n]; }
+	  void		release()	{ if (!arena) delete[] v; }
+
 	  int		nx,ny;					//nx = ncols, ny = nrows
+	  ARENA*	arena;					//where v comes from (0: the heap)
 	  T*		v;
 	};
 
@@ -85,7 +92,11 @@ template <class T> class VFIELD
 	int		dimX() const			{ return v0.dimX(); }
 	int		dimY() const			{ return v0.dimY(); }
 	
-	static VFIELD*	read(char*);
+	static VFIELD*	read(char*);				//read from VTK vector data file, ASCII or binary
+
+	private:
+
+	void		write(const char*,const FLAGS*) const;
 	};
 		
 		
@@ -102,10 +113,10 @@ template <class T> class VFIELD
 
 
 
-template <class T> inline FIELD<T>::FIELD(int nx_,int ny_): nx(nx_),ny(ny_),v((nx_*ny_)? new T[nx_*ny_] : 0)
+template <class T> inline FIELD<T>::FIELD(int nx_,int ny_,ARENA* a): nx(nx_),ny(ny_),arena(a),v((nx_*ny_)? alloc(nx_*ny_) : 0)
 {  }
 
-template <class T> inline FIELD<T>::FIELD(const FIELD<T>& f): nx(f.nx),ny(f.ny),v((f.nx*f.ny)? new T[f.nx*f.ny] : 0)
+template <class T> inline FIELD<T>::FIELD(const FIELD<T>& f,ARENA* a): nx(f.nx),ny(f.ny),arena(a),v((f.nx*f.ny)? alloc(f.nx*f.ny) : 0)
 {  if (nx*ny) memcpy(v,f.v,nx*ny*sizeof(T));  }
 
 template <class T> inline T& FIELD<T>::value(int i,int j)
@@ -150,13 +161,13 @@ template <class T> inline T FIELD<T>::gradnorm(int i,int j) const
 }
 
 template <class T> inline FIELD<T>::~FIELD()
-{  delete[] v;  }
+{  release();  }
 
 template <class T> inline void FIELD<T>::size(const FIELD& f)
 {
-   delete[] v;
+   release();
    nx = f.nx; ny = f.ny;
-   v = (nx*ny) ? new T[nx*ny] : 0;
+   v = (nx*ny) ? alloc(nx*ny) : 0;
 }
 
 template <class T> FIELD<T>& FIELD<T>::operator=(FIELD& f)
@@ -270,6 +281,8 @@ template <class T> FIELD<T>* FIELD<T>::read(char* fname)
       case BMP:   return readBMP(fname);
       case ASCII: return readASCII(fname);
       case PGM:   return readPGM(fname);
+      case PFM:   return readPFM(fname);
+      case RAW:   return readRaw(fname);
       default:    return 0;
    }
 }   
@@ -277,16 +290,19 @@ template <class T> FIELD<T>* FIELD<T>::read(char* fname)
    
 template <class T> typename FIELD<T>::FILE_TYPE FIELD<T>::fileType(char* fname)
 {
-   FILE* fp = fopen(fname,"r");
+   FILE* fp = fopen(fname,"rb");
    if (!fp) return UNKNOWN;
    
    char c1,c2;
-   if (fscanf(fp,"%c%c",&c1,&c2)!=2) return UNKNOWN;
+   int n = fscanf(fp,"%c%c",&c1,&c2);
    fclose(fp);
+   if (n!=2) return UNKNOWN;
    
    if (c1=='#') return VTK;
-   if (c1=='P' && c2=='5') return PGM;
+   if (c1=='P' && (c2=='5' || c2=='6')) return PGM;
+   if (c1=='P' && (c2=='f' || c2=='F')) return PFM;
    if (c1=='B' && c2=='M') return BMP;
+   if (c1==RAW_MAGIC[0] && c2==RAW_MAGIC[1]) return RAW;
    return ASCII;
 }   
    
@@ -294,69 +310,22 @@ template <class T> typename FIELD<T>::FILE_TYPE FIELD<T>::fileType(char* fname)
 
      
 
-template <class T> unsigned long FIELD<T>::getLong(fstream& inf)
-{
-   unsigned long ip; char ic;
-   unsigned char uc;
-   inf.get(ic); uc = ic; ip = uc;
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<8);
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<16);
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<24);
-   return ip;
-}
-
-template <class T> unsigned short FIELD<T>::getShort(fstream& inf)
-{
-   char ic; unsigned short ip;
-   inf.get(ic); ip = ic;
-   inf.get(ic); ip |= ((unsigned short)ic << 8);
-   return ip;
-}
-
-
 template <class T> FIELD<T>* FIELD<T>::readBMP(char* fname)
 {
-   fstream inf;
-   inf.open(fname, ios::in|ios::binary);
-   if (!inf) return 0;
-   char ch1,ch2;
-   inf.get(ch1); inf.get(ch2);                             //read BMP header
-   unsigned long  fileSize = getLong(inf);      
-   unsigned short res1     = getShort(inf);
-   unsigned short res2     = getShort(inf);
-   unsigned long  offBits  = getLong(inf);
-   unsigned long  hdrSize  = getLong(inf);
-   unsigned long  numCols  = getLong(inf);     
-   unsigned long  numRows  = getLong(inf);     
-   unsigned short planes   = getShort(inf);
-   unsigned short bytesPix = getShort(inf);                //8 or 24
-   unsigned long  compr    = getLong(inf); 
-   unsigned long  imgSize  = getLong(inf);
-   unsigned long  xPels    = getLong(inf);
-   unsigned long  yPels    = getLong(inf);
-   unsigned long  lut      = getLong(inf);
-   unsigned long  impCols  = getLong(inf);
-   int bpp = bytesPix/8;                                   //1 or 3                        
-   unsigned int nBytesInRow  = ((bpp*numCols+3)/4)*4;
-   unsigned int numPadBytes  = nBytesInRow - bpp*numCols; 
-   FIELD<float>* f = new FIELD<float>(numCols,numRows);
-   float* data = f->data();
-   char ch;
-   for(unsigned int row=0;row<numRows;row++)               //for every row     
+   MAPPED_FILE mf; BMP_HEADER h;
+   if (!mf.open(fname) || !readBMPHeader(mf,h)) return 0;
+   FIELD<T>* f = new FIELD<T>(h.nx,h.ny);
+   T* data = f->data();
+   for(int row=0;row<h.ny;row++)                           //for every row, as the file has them
    {
-      for(unsigned int col=0;col<numCols;col++)
-      {
-         if (bpp==3)                                       //read data as RGB 'luminance'
-         {  
-            char r,g,b; inf.get(b); inf.get(g); inf.get(r);
-            *data++ = (float(r)+float(g)+float(b))/3;
-         }
-         else                                              //read data as 8-bit luminance
-         {  inf.get(ch); *data++ = ch; }
-      }
-      for(unsigned int k=0;k<numPadBytes;k++) inf>>ch;     //skip pad bytes at end of row
+      const unsigned char* p = (const unsigned char*)mf.data()+h.offset+row*h.rowBytes;
+      if (h.bpp==3)                                        //read data as RGB 'luminance'
+         for(int col=0;col<h.nx;col++,p+=3)
+            *data++ = (float(p[2])+float(p[1])+float(p[0]))/3;
+      else                                                 //read data as 8-bit luminance
+         for(int col=0;col<h.nx;col++)
+            *data++ = p[col];
    }
-   inf.close();
    return f;
 }
 
@@ -364,15 +333,16 @@ template <class T> FIELD<T>* FIELD<T>::readBMP(char* fname)
 
 template <class T> FIELD<T>* FIELD<T>::readVTK(char* fname)	//read VTK scalar file into this
 {
-   FILE* fp = fopen(fname,"r");
+   FILE* fp = fopen(fname,"rb");
    if (!fp) return 0;
 
    char buf[100]; 
 
-   FIELD<T>* f = 0;
+   FIELD<T>* f = 0; bool binary = false;
 
    for(;fscanf(fp,"%s",buf)==1;)
    {
+      if (!strcmp(buf,"BINARY")) binary = true;
       if (!strcmp(buf,"DIMENSIONS"))
       {
 	int dimX,dimY;
@@ -386,8 +356,22 @@ template <class T> FIELD<T>* FIELD<T>::readVTK(char* fname)	//read VTK scalar fi
 	 break;
       }
    }
+   if (!f) { fclose(fp); return 0; }
 
-   for(T* d = f->data();fscanf(fp,"%f",d)==1;d++);
+   if (binary)							//big-endian floats from the next line on
+   {
+      int n = f->dimX()*f->dimY();
+      float* vals = new float[n];
+      fgetc(fp);
+      if (fread(vals,4,n,fp)==size_t(n))
+      {
+         swap4BERange((char*)vals,n);
+         for(int k=0;k<n;k++) f->v[k] = vals[k];
+      }
+      delete[] vals;
+   }
+   else
+      for(T* d = f->data();fscanf(fp,"%f",d)==1;d++);
 
    fclose(fp);  				
    return f;
@@ -395,44 +379,71 @@ template <class T> FIELD<T>* FIELD<T>::readVTK(char* fname)	//read VTK scalar fi
 
 
 
-template <class T> FIELD<T>* FIELD<T>::readPGM(char* fname)	//read VTK scalar file into this
+template <class T> FIELD<T>* FIELD<T>::readPGM(char* fname)	//read PGM or PPM (as luminance) binary file into this
 {
-   FILE* fp = fopen(fname,"r"); if (!fp) return 0;
+   MAPPED_FILE mf; NETPBM_HEADER h;
+   if (!mf.open(fname) || !readNetpbmHeader(mf,h) || h.bytes>2) return 0;
 
-   const int SIZE = 1024;
-   char buf[SIZE]; int dimX,dimY,range;
-   fscanf(fp,"%*s");				//skip "P5" header
+   int n = h.nx*h.ny;
+   char* vals = mf.data()+h.offset;
+   FIELD<T>* f = new FIELD<T>(h.nx,h.ny);
+   T* d = f->data();
 
-   for(;;)
+   if (h.bytes==1)						//be careful: the values are unsigned chars
    {
-     fscanf(fp,"%s",buf);			//get dimX or #comment
-     if (buf[0]=='#') fgets(buf,SIZE,fp); 
-        else { dimX = atoi(buf); break; }
+      const unsigned char* p = (const unsigned char*)vals;
+      if (h.channels==1)
+         for(int k=0;k<n;k++) d[k] = p[k];
+      else
+         for(int k=0;k<n;k++,p+=3) d[k] = (float(p[0])+float(p[1])+float(p[2]))/3;
    }
-   for(;;)
-   {
-     fscanf(fp,"%s",buf);			//get dimY or #comment
-     if (buf[0]=='#') fgets(buf,SIZE,fp); 
-        else { dimY = atoi(buf); break; }
+   else								//16-bit values are big-endian, swapped in the
+   {								//(private) mapping
+      swap2BERange(vals,n*h.channels);
+      for(int k=0;k<n;k++)
+      {
+         unsigned short c[3]; memcpy(c,vals+k*h.channels*2,h.channels*2);
+         d[k] = (h.channels==1)? float(c[0]) : (float(c[0])+float(c[1])+float(c[2]))/3;
+      }
    }
-   for(;;)
+   return f;
+}
+
+
+
+template <class T> FIELD<T>* FIELD<T>::readPFM(char* fname)	//read PFM file (color as luminance) into this
+{
+   MAPPED_FILE mf; NETPBM_HEADER h;
+   if (!mf.open(fname) || !readNetpbmHeader(mf,h) || h.bytes!=4) return 0;
+
+   int n = h.nx*h.ny;
+   char* vals = mf.data()+h.offset;
+   if (h.maxval<0) swap4LERange(vals,n*h.channels);		//a negative scale: little-endian floats
+   else            swap4BERange(vals,n*h.channels);
+   FIELD<T>* f = new FIELD<T>(h.nx,h.ny);
+
+   for(int j=0;j<h.ny;j++)					//the rows go bottom to top
    {
-     fscanf(fp,"%s",buf);			//get range or #comment
-     if (buf[0]=='#') fgets(buf,SIZE,fp); 
-        else { range = atoi(buf); break; }
+      const char* p = vals+size_t(h.ny-1-j)*h.nx*h.channels*4;
+      T* d = f->data()+j*h.nx;
+      for(int i=0;i<h.nx;i++)
+      {
+         float c[3]; memcpy(c,p+i*h.channels*4,h.channels*4);
+         d[i] = (h.channels==1)? c[0] : (c[0]+c[1]+c[2])/3;
+      }
    }
-   
+   return f;
+}
 
-   FIELD<T>* f = new FIELD<T>(dimX,dimY);
-   int bb = SIZE; fgets(buf,SIZE,fp);
-  
-   for(T *d = f->data(),*end=d+dimX*dimY;d<end;d++)		//read the binary data into the field
-   {								//be careful: buf is a char, we first need
-	if (bb==SIZE) { fread(buf,SIZE,1,fp); bb=0; }		//to convert the read bytes to unsigned char and then assign
-	*d = (unsigned char)buf[bb++];				//to the field!
-   }
 
-   fclose(fp);  				
+
+template <class T> FIELD<T>* FIELD<T>::readRaw(char* fname)	//read raw dump into this
+{
+   MAPPED_FILE mf; RAW_HEADER h;
+   if (!mf.open(fname) || !readRawHeader(mf,sizeof(T),h)) return 0;
+
+   FIELD<T>* f = new FIELD<T>(h.nx,h.ny);
+   memcpy(f->data(),mf.data()+sizeof(RAW_HEADER),size_t(h.nx)*h.ny*sizeof(T));
    return f;
 }
 
@@ -460,12 +471,10 @@ template <class T> FIELD<T>* FIELD<T>::readASCII(char* fname)	//read plain ASCII
 
 template <class T> void FIELD<T>::write(char* fname)
 {
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
-
-   fprintf(fp,"# vtk DataFile Version 2.0\n"
+   char hdr[512];
+   int hn = sprintf(hdr,"# vtk DataFile Version 2.0\n"
 	      "vtk output\n"
-	      "ASCII\n"
+	      "BINARY\n"
 	      "DATASET STRUCTURED_POINTS\n"
 	      "DIMENSIONS %d %d 1\n"
 	      "SPACING 1 1 1\n"
@@ -475,82 +484,83 @@ template <class T> void FIELD<T>::write(char* fname)
 	      "LOOKUP_TABLE default\n",
 	      nx,ny,nx*ny);
 
-   for(T* vend=v+nx*ny,*vptr=v;vptr<vend;vptr++)
-      fprintf(fp,"%f\n",float(*vptr));
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+size_t(nx)*ny*4+1)) return;
+   memcpy(mf.data(),hdr,hn);
 
-   fclose(fp);
+   char* p = mf.data()+hn;					//big-endian floats, swapped in bulk
+   for(int k=0;k<nx*ny;k++)
+   {  float x = float(v[k]); memcpy(p+k*4,&x,4);  }
+   swap4BERange(p,nx*ny);
+   p[size_t(nx)*ny*4] = '\n';
 }	
 
 
 template <class T> void FIELD<T>::writeGrid(char* fname)
 {
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
-
-   fprintf(fp,"# vtk DataFile Version 2.0\n"
+   char hdr[512],hdr2[512];
+   int hn = sprintf(hdr,"# vtk DataFile Version 2.0\n"
 	      "vtk output\n"
-	      "ASCII\n"
+	      "BINARY\n"
 	      "DATASET STRUCTURED_GRID\n"
 	      "DIMENSIONS %d %d 1\n"
 	      "POINTS %d int\n",
 	      nx,ny,nx*ny);
-
-   for(int j=0;j<ny;j++)
-      for(int i=0;i<nx;i++)
-         fprintf(fp,"%d %d 0\n",i,j);
-
-   fprintf(fp,"POINT_DATA %d\n"
+   int hn2 = sprintf(hdr2,"\nPOINT_DATA %d\n"
 	      "SCALARS scalars float\n"
 	      "LOOKUP_TABLE default\n",
 	      nx*ny);
 
-   for(T* vend=v+nx*ny,*vptr=v;vptr<vend;vptr++)
-      fprintf(fp,"%f\n",float(*vptr));
+   size_t n = size_t(nx)*ny;
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+n*12+hn2+n*4+1)) return;
+   memcpy(mf.data(),hdr,hn);
 
-   fclose(fp);
+   char* p = mf.data()+hn;					//the points, big-endian ints
+   for(int j=0;j<ny;j++)
+      for(int i=0;i<nx;i++,p+=12)
+      {  int pt[3] = { i,j,0 }; memcpy(p,pt,12);  }
+   swap4BERange(mf.data()+hn,int(n*3));
+
+   memcpy(p,hdr2,hn2); p += hn2;				//the values, big-endian floats
+   for(size_t k=0;k<n;k++)
+   {  float x = float(v[k]); memcpy(p+k*4,&x,4);  }
+   swap4BERange(p,int(n));
+   p[n*4] = '\n';
 }	
 
 
 template <class T> void FIELD<T>::writePGM(char* fname) const
 {
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
+   char hdr[64]; int hn = writeNetpbmHeader(hdr,'5',dimX(),dimY());
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+size_t(dimX())*dimY())) return;
+   memcpy(mf.data(),hdr,hn);
 
    float m,M; T m_,M_,avg_; minmax(m_,M_,avg_);
    m = m_; M = M_; 
 
-   const int SIZE = 3000;
-   unsigned char buf[SIZE];
-   int bb=0;
-
-   fprintf(fp,"P5 %d %d 255\n",dimX(),dimY());
+   unsigned char* buf = (unsigned char*)mf.data()+hn;
    for(const T* vend=data()+dimX()*dimY(),*vptr=data();vptr<vend;vptr++)
    {
       float v = ((*vptr)-m)/(M-m); v = MAX(v,0); 
       if (v>M) v=1; else v = MIN(v,1);
-      buf[bb++] = (unsigned char)(int)(v*255);
-      if (bb==SIZE)
-      {  fwrite(buf,1,SIZE,fp); bb = 0; }
+      *buf++ = (unsigned char)(int)(v*255);
    }
-   if (bb) fwrite(buf,1,bb,fp);
-
-   fclose(fp);
 }	
 
 
 template <class T> void FIELD<T>::writePPM(char* fname) const
 {
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
+   char hdr[64]; int hn = writeNetpbmHeader(hdr,'6',dimX(),dimY());
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+size_t(dimX())*dimY()*3)) return;
+   memcpy(mf.data(),hdr,hn);
 
    float m,M; T m_,M_,avg_; minmax(m_,M_,avg_);
    m = m_; M = M_; 
 
-   const int SIZE = 3000;
-   unsigned char buf[SIZE];
-   int bb=0;
-
-   fprintf(fp,"P6 %d %d 255\n",dimX(),dimY());
+   unsigned char* buf = (unsigned char*)mf.data()+hn;
    for(const T* vend=data()+dimX()*dimY(),*vptr=data();vptr<vend;vptr++)
    {
       float r,g,b,v = ((*vptr)-m)/(M-m); 
@@ -558,15 +568,37 @@ template <class T> void FIELD<T>::writePPM(char* fname) const
       if (v>M) { r=g=b=1; } else v = min(v,1);
       float2rgb(v,r,g,b);
       
-      buf[bb++] = (unsigned char)(int)(r*255);
-      buf[bb++] = (unsigned char)(int)(g*255);
-      buf[bb++] = (unsigned char)(int)(b*255);
-      if (bb==SIZE)
-      {  fwrite(buf,1,SIZE,fp); bb = 0; }
+      *buf++ = (unsigned char)(int)(r*255);
+      *buf++ = (unsigned char)(int)(g*255);
+      *buf++ = (unsigned char)(int)(b*255);
    }
-   if (bb) fwrite(buf,1,bb,fp);
+}	
 
-   fclose(fp);
+
+template <class T> void FIELD<T>::writePFM(char* fname) const
+{
+   char hdr[64]; int hn = writeNetpbmHeader(hdr,'f',nx,ny);
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+size_t(nx)*ny*4)) return;
+   memcpy(mf.data(),hdr,hn);
+
+   for(int j=0;j<ny;j++)					//the rows go bottom to top, the floats
+   {								//in this machine's byte order
+      char* p = mf.data()+hn+size_t(ny-1-j)*nx*4;
+      const T* d = v+j*nx;
+      for(int i=0;i<nx;i++)
+      {  float x = float(d[i]); memcpy(p+i*4,&x,4);  }
+   }
+}	
+
+
+template <class T> void FIELD<T>::writeRaw(char* fname) const
+{
+   size_t n = size_t(nx)*ny*sizeof(T);
+   MAPPED_FILE mf;
+   if (!mf.create(fname,sizeof(RAW_HEADER)+n)) return;
+   writeRawHeader(mf.data(),sizeof(T),nx,ny);
+   if (n) memcpy(mf.data()+sizeof(RAW_HEADER),v,n);
 }	
 
 //------------------  VFIELD  -----------------------------------
@@ -580,14 +612,15 @@ template <class T> inline void VFIELD<T>::setValue(int i,int j,T* val)
 
 template <class T> VFIELD<T>* VFIELD<T>::read(char* fname)
 {
-   FILE* fp = fopen(fname,"r");
+   FILE* fp = fopen(fname,"rb");
    if (!fp) return 0;
 
-   VFIELD<T>* f = 0;
+   VFIELD<T>* f = 0; bool binary = false;
 
    char buf[100]; 
    for(;fscanf(fp,"%s",buf)==1;)
    {
+      if (!strcmp(buf,"BINARY")) binary = true;
       if (!strcmp(buf,"DIMENSIONS"))
       {
 	int dimX,dimY;
@@ -601,48 +634,40 @@ template <class T> VFIELD<T>* VFIELD<T>::read(char* fname)
 	 break;
       }
    }
+   if (!f) { fclose(fp); return 0; }
 
-   for(T* d0=f->v0.data(),*d1=f->v1.data();fscanf(fp,"%f%f%*f",d0,d1)>1;d0++,d1++);
+   if (binary)							//big-endian float triples from the next line on
+   {
+      int n = f->dimX()*f->dimY();
+      float* vals = new float[3*n];
+      fgetc(fp);
+      if (fread(vals,12,n,fp)==size_t(n))
+      {
+         swap4BERange((char*)vals,3*n);
+         T *d0 = f->v0.data(),*d1 = f->v1.data();
+         for(int k=0;k<n;k++) { d0[k] = vals[3*k]; d1[k] = vals[3*k+1]; }
+      }
+      delete[] vals;
+   }
+   else
+      for(T* d0=f->v0.data(),*d1=f->v1.data();fscanf(fp,"%f%f%*f",d0,d1)>1;d0++,d1++);
 
    fclose(fp);  				
    return f;
 }
 
 template <class T> void VFIELD<T>::write(const char* fname,FLAGS& f) const
-{
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
-
-   fprintf(fp,"# vtk DataFile Version 2.0\n"
-	      "vtk output\n"
-	      "ASCII\n"
-	      "DATASET STRUCTURED_POINTS\n"
-	      "DIMENSIONS %d %d 1\n"
-	      "SPACING 1 1 1\n"
-	      "ORIGIN 0 0 0\n"
-	      "POINT_DATA %d\n"
-	      "VECTORS vectors float\n",
-	      dimX(),dimY(),dimX()*dimY());
-
-   for(int j=0;j<dimY();j++)
-      for(int i=0;i<dimX();i++)
-         if (f.alive(i,j))
-            fprintf(fp,"0 0 0\n");
-         else
-            fprintf(fp,"%f %f 0\n",v0.value(i,j),v1.value(i,j));  
-
-   fclose(fp);
-}	
-
+{  write(fname,&f);  }
 
 template <class T> void VFIELD<T>::write(const char* fname) const
-{
-   FILE* fp = fopen(fname,"w");
-   if (!fp) return;
+{  write(fname,(const FLAGS*)0);  }
 
-   fprintf(fp,"# vtk DataFile Version 2.0\n"
+template <class T> void VFIELD<T>::write(const char* fname,const FLAGS* f) const	//0 vectors at the alive points of f
+{
+   char hdr[512];
+   int hn = sprintf(hdr,"# vtk DataFile Version 2.0\n"
 	      "vtk output\n"
-	      "ASCII\n"
+	      "BINARY\n"
 	      "DATASET STRUCTURED_POINTS\n"
 	      "DIMENSIONS %d %d 1\n"
 	      "SPACING 1 1 1\n"
@@ -651,11 +676,21 @@ template <class T> void VFIELD<T>::write(const char* fname) const
 	      "VECTORS vectors float\n",
 	      dimX(),dimY(),dimX()*dimY());
 
-   for(int j=0;j<dimY();j++)
-      for(int i=0;i<dimX();i++)
-         fprintf(fp,"%f %f 0\n",v0.value(i,j),v1.value(i,j));  
+   size_t n = size_t(dimX())*dimY();
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+n*12+1)) return;
+   memcpy(mf.data(),hdr,hn);
 
-   fclose(fp);
+   char* p = mf.data()+hn;					//big-endian float triples, swapped in bulk
+   for(int j=0;j<dimY();j++)
+      for(int i=0;i<dimX();i++,p+=12)
+      {
+         float vec[3] = { 0,0,0 };
+         if (!f || !f->alive(i,j)) { vec[0] = v0.value(i,j); vec[1] = v1.value(i,j); }
+         memcpy(p,vec,12);
+      }
+   swap4BERange(mf.data()+hn,int(n*3));
+   *p = '\n';
 }	
 
 
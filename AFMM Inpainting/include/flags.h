@@ -33,9 +33,11 @@ class FLAGS : public FIELD<int>
 		enum FLAG_TYPE { NARROW_BAND,ALIVE,FAR_AWAY,EXTREMUM };
 
 
-		     FLAGS(FIELD<float>& f,float low);		//Ctor. See info above. 
+		     FLAGS(FIELD<float>& f,float low,		//Ctor. See info above. 
+			   ARENA* =0);				//The flags are stored in the arena, if any.
 		     FLAGS(FIELD<float>& f,			//Ctor. See info above.
-			   const FIELD<float>& t,float low);
+			   const FIELD<float>& t,float low,ARENA* =0);
+		     FLAGS(const FLAGS&,ARENA* =0);		//Copy ctor, possibly into an arena
 
 		int  alive(int i,int j) const 		{ return value(i,j)==ALIVE; }
 		int  narrowband(int i,int j) const	{ return value(i,j)==NARROW_BAND; }
@@ -5,6 +5,7 @@
 #include "darray.h"
 #include "field.h"
 #include <map>
+#include <vector>
 
 
 
@@ -14,6 +15,8 @@ class 	FastMarchingMethod
 	public:	
 	
 		typedef FIELD<std::multimap<float,Coord>::iterator> POINTERS;
+		typedef int (*PROGRESS)(void*);			//see progress()
+		struct NarrowbandPoint { float value; int i; int j; };
 	
 			FastMarchingMethod(FIELD<float>*,FLAGS*,int=1000000);	
                                                                         //Ctor
@@ -24,6 +27,13 @@ class 	FastMarchingMethod
 									//to stop the marching when the constructed signal reaches it.
 									//This is useful e.g. when we reconstruct a curve knowing the
 									//distance to it (see FLAGS).	
+		void	progress(PROGRESS p,void* a,int n=4096)		//Call p(a) every n iterations of execute(), which
+			{ prog = p; prog_arg = a; prog_every = n; }	//stops there if p returns nonzero
+		void	mark_rows(char* d)	{ dirty = d; }		//Set d[j] to 1 for every row j diffuse() changes
+		void	quiet(bool q)		{ reports = !q; }	//Don't print every 1000th iteration to cout
+		void	narrowband(std::vector<NarrowbandPoint>&) const;	//Get the narrowband in the order it is extracted
+		void	narrowband(const NarrowbandPoint*,int);		//Set it back, e.g. from a checkpoint: the points
+									//must be the ones NARROW_BAND in the flags
 	protected:
 	
 		virtual void						//Called by execute() whenever a FAR_AWAY
@@ -35,6 +45,8 @@ class 	FastMarchingMethod
 									//the narrowband
 	protected:
 
+		struct NewValue { int i; int j; float value; };	//Used in the diffuse() routine
+
 		void    	      tag_nbs(int,int,int,int,Coord*,int&);
 		virtual int           diffuse();
 		virtual void          solve(int,int,float,float,float&);		
@@ -49,6 +61,12 @@ class 	FastMarchingMethod
 		int 		      negd;		//Number of failures in solve2()
 		int		      nextr;		//Number of extremum points detected in diffuse()
 		float		      maxf;		//Threshold to stop evolution (see execute()).
+		NewValue	      newp[4];		//Scratch for diffuse(): new values of the updated neighbours
+		PROGRESS	      prog;		//Progress callback (see progress()), or 0
+		void*		      prog_arg;
+		int		      prog_every;
+		char*		      dirty;		//Rows changed (see mark_rows()), or 0
+		bool		      reports;		//Print the iterations (see quiet())
 	};	
 
 
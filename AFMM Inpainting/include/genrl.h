@@ -29,6 +29,8 @@ struct Coord {
 		int operator==(const Coord& c) const { return i==c.i && j==c.j; } 
 	      };
 
+struct Vec2 { float x,y; };				//2D vector, e.g. a gradient stored as an interleaved pair
+
 
 int JacobiN(float **a, int n, float *w, float **v);
 int JacobiN(double **a, int n, double *w, double **v);
@@ -10,8 +10,8 @@ using namespace std;
 template <class T> class IMAGE
 	{
 	public:
-			IMAGE(int x=0,int y=0):r(x,y),g(x,y),b(x,y) {}
-                        IMAGE(const IMAGE& i):r(i.r),g(i.g),b(i.b)  {}
+			IMAGE(int x=0,int y=0,ARENA* a=0):r(x,y,a),g(x,y,a),b(x,y,a) {}
+                        IMAGE(const IMAGE& i,ARENA* a=0):r(i.r,a),g(i.g,a),b(i.b,a)  {}
         void            setValue(int,int,T);
 	void		size(int i,int j)		{ r.size(i,j); g.size(i,j); b.size(i,j); } 
 	void		size(const FIELD<T>& f)         { r.size(f); g.size(f); b.size(f); }	
@@ -21,15 +21,14 @@ template <class T> class IMAGE
 	int		dimY() const			{ return r.dimY(); }
         void            normalize()                    { r.normalize(); g.normalize(); b.normalize(); }
 	
-	static IMAGE*	read(char*);
+	static IMAGE*	read(char*);				//read from BMP, PPM/PGM or PFM file
+        void            writePFM(char*) const;                  //write the planes as they are to color PFM file
 
         private:
 
         static IMAGE*   readBMP(char*);
-        static unsigned long
-                        getLong(fstream&);
-        static unsigned short
-                        getShort(fstream&);
+        static IMAGE*   readPNM(char*);
+        static IMAGE*   readPFM(char*);
 	};
 		
 	
@@ -38,6 +37,8 @@ template <class T> IMAGE<T>* IMAGE<T>::read(char* fname)
    switch(FIELD<T>::fileType(fname))
    {
    case FIELD<T>::BMP:   return readBMP(fname);
+   case FIELD<T>::PGM:   return readPNM(fname);
+   case FIELD<T>::PFM:   return readPFM(fname);
    default:    return 0;
    }
 }
@@ -47,70 +48,87 @@ template <class T> inline void IMAGE<T>::setValue(int i,int j,T v)
 
 template <class T> IMAGE<T>* IMAGE<T>::readBMP(char* fname)
 {
-   fstream inf;
-   inf.open(fname, ios::in|ios::binary);
-   if (!inf) return 0;
-   char ch1,ch2;
-   inf.get(ch1); inf.get(ch2);                             //read BMP header
-   unsigned long  fileSize = getLong(inf);      
-   unsigned short res1     = getShort(inf);
-   unsigned short res2     = getShort(inf);
-   unsigned long  offBits  = getLong(inf);
-   unsigned long  hdrSize  = getLong(inf);
-   unsigned long  numCols  = getLong(inf);     
-   unsigned long  numRows  = getLong(inf);     
-   unsigned short planes   = getShort(inf);
-   unsigned short bytesPix = getShort(inf);                //8 or 24
-   unsigned long  compr    = getLong(inf); 
-   unsigned long  imgSize  = getLong(inf);
-   unsigned long  xPels    = getLong(inf);
-   unsigned long  yPels    = getLong(inf);
-   unsigned long  lut      = getLong(inf);
-   unsigned long  impCols  = getLong(inf);
-   int bpp = bytesPix/8;                                   //1 or 3                        
-   unsigned int nBytesInRow  = ((bpp*numCols+3)/4)*4;
-   unsigned int numPadBytes  = nBytesInRow - bpp*numCols; 
-   IMAGE<float>* f = new IMAGE<float>(numCols,numRows);
-   float *rd = f->r.data(), *gd = f->g.data(), *bd = f->b.data();
-   char ch;
-   for(unsigned int row=0;row<numRows;row++)               //for every row     
+   MAPPED_FILE mf; BMP_HEADER h;
+   if (!mf.open(fname) || !readBMPHeader(mf,h)) return 0;
+   IMAGE<T>* f = new IMAGE<T>(h.nx,h.ny);
+   T *rd = f->r.data(), *gd = f->g.data(), *bd = f->b.data();
+   for(int row=0;row<h.ny;row++)                           //for every row, as the file has them
    {
-      for(unsigned int col=0;col<numCols;col++)
-      {
-         if (bpp==3)                                       //read data as RGB colors
-         {  
-            char R,G,B; inf.get(B); inf.get(G); inf.get(R);
-            *rd++ = R; *gd++ = G; *bd++ = B;
-         }
-         else                                              //read data as 8-bit luminance
-         {  inf.get(ch); *rd++ = ch; *gd++ = ch; *bd++ = ch; }
-      }
-      for(unsigned int k=0;k<numPadBytes;k++) inf>>ch;     //skip pad bytes at end of row
+      const unsigned char* p = (const unsigned char*)mf.data()+h.offset+row*h.rowBytes;
+      if (h.bpp==3)                                        //read data as RGB colors
+         for(int col=0;col<h.nx;col++,p+=3)
+         {  *rd++ = p[2]; *gd++ = p[1]; *bd++ = p[0];  }
+      else                                                 //read data as 8-bit luminance
+         for(int col=0;col<h.nx;col++)
+         {  *rd++ = p[col]; *gd++ = p[col]; *bd++ = p[col];  }
    }
-   inf.close();
    return f;
 }
 
 
-     
+template <class T> IMAGE<T>* IMAGE<T>::readPNM(char* fname)
+{
+   MAPPED_FILE mf; NETPBM_HEADER h;
+   if (!mf.open(fname) || !readNetpbmHeader(mf,h) || h.bytes>2) return 0;
+
+   int n = h.nx*h.ny, c = h.channels;                      //gray: the same value in the 3 planes
+   char* vals = mf.data()+h.offset;
+   if (h.bytes==2) swap2BERange(vals,n*c);                 //16-bit values are big-endian
+   IMAGE<T>* f = new IMAGE<T>(h.nx,h.ny);
+   T* planes[3] = { f->r.data(), f->g.data(), f->b.data() };
+   for(int k=0;k<n;k++)
+      for(int p=0;p<3;p++)
+      {
+         int at = k*c+((c==3)? p : 0);
+         if (h.bytes==1) planes[p][k] = ((const unsigned char*)vals)[at];
+         else { unsigned short x; memcpy(&x,vals+at*2,2); planes[p][k] = x; }
+      }
+   return f;
+}
 
-template <class T> unsigned long IMAGE<T>::getLong(fstream& inf)
+
+template <class T> IMAGE<T>* IMAGE<T>::readPFM(char* fname)
 {
-   unsigned long ip; char ic;
-   unsigned char uc;
-   inf.get(ic); uc = ic; ip = uc;
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<8);
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<16);
-   inf.get(ic); uc = ic; ip |= ((unsigned long)uc <<24);
-   return ip;
+   MAPPED_FILE mf; NETPBM_HEADER h;
+   if (!mf.open(fname) || !readNetpbmHeader(mf,h) || h.bytes!=4) return 0;
+
+   int c = h.channels;
+   char* vals = mf.data()+h.offset;
+   if (h.maxval<0) swap4LERange(vals,h.nx*h.ny*c);         //a negative scale: little-endian floats
+   else            swap4BERange(vals,h.nx*h.ny*c);
+   IMAGE<T>* f = new IMAGE<T>(h.nx,h.ny);
+   T* planes[3] = { f->r.data(), f->g.data(), f->b.data() };
+   for(int j=0;j<h.ny;j++)                                 //the rows go bottom to top
+   {
+      const char* row = vals+size_t(h.ny-1-j)*h.nx*c*4;
+      for(int i=0;i<h.nx;i++)
+      {
+         float x[3]; memcpy(x,row+i*c*4,c*4);
+         for(int p=0;p<3;p++) planes[p][j*h.nx+i] = x[(c==3)? p : 0];
+      }
+   }
+   return f;
 }
 
-template <class T> unsigned short IMAGE<T>::getShort(fstream& inf)
+
+template <class T> void IMAGE<T>::writePFM(char* fname) const
 {
-   char ic; unsigned short ip;
-   inf.get(ic); ip = ic;
-   inf.get(ic); ip |= ((unsigned short)ic << 8);
-   return ip;
+   int nx = dimX(), ny = dimY();
+   char hdr[64]; int hn = writeNetpbmHeader(hdr,'F',nx,ny);
+   MAPPED_FILE mf;
+   if (!mf.create(fname,hn+size_t(nx)*ny*12)) return;
+   memcpy(mf.data(),hdr,hn);
+
+   const T* planes[3] = { r.data(), g.data(), b.data() };
+   for(int j=0;j<ny;j++)                                   //the rows go bottom to top, the floats
+   {                                                       //in this machine's byte order
+      char* row = mf.data()+hn+size_t(ny-1-j)*nx*12;
+      for(int i=0;i<nx;i++)
+      {
+         float x[3] = { float(planes[0][j*nx+i]), float(planes[1][j*nx+i]), float(planes[2][j*nx+i]) };
+         memcpy(row+i*12,x,12);
+      }
+   }
 }
 
 
@@ -16,8 +16,8 @@ class 	ModifiedFastMarchingMethod : public FastMarchingMethod
 			ModifiedFastMarchingMethod(FIELD<float>* f,
 						   FLAGS*,
 						   IMAGE<float>* img,
-						   FIELD<float>* gx,
-						   FIELD<float>* gy,
+						   FIELD<Vec2>* grad,
+						   Coord grad_org,
 						   FIELD<float>* dst,
 						   int B_radius,
 						   int dst_weighting,
@@ -35,7 +35,8 @@ class 	ModifiedFastMarchingMethod : public FastMarchingMethod
 		IMAGE<float>*	image;					//Image to inpaint
 									//
 		FIELD<float>   *dist;					//Distance field, needed for inpainting
-		FIELD<float>   *grad_x,*grad_y;				//Gradient of 'dist' field, needed for inpainting
+		FIELD<Vec2>    *grad;					//Gradient of 'dist' field, needed for inpainting. Only
+		Coord		grad0;					//known on the box of the zone, which starts at grad0
 		int		B_radius;				//Radius of inpainting-neighborhood, in pixels
 		int		dst_weighting;				//Flag telling if we use dist-based weighting (def: 1)
 		int		lev_weighting;				//Flag telling if we use level-based weighting (def: 1)
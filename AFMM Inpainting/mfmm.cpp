@@ -6,14 +6,12 @@
 #include <iostream>
 
 
-struct  NewValue {  int i; int j; float value;  }; 
-
 
 ModifiedFastMarchingMethod::ModifiedFastMarchingMethod
 			    (FIELD<float>* f_,FLAGS* flags_,IMAGE<float>* image_,
-			     FIELD<float>* gx,FIELD<float>* gy,FIELD<float>* d,int br,
+			     FIELD<Vec2>* g,Coord g0,FIELD<float>* d,int br,
 			     int dst_wt,int lev_wt,int N_)
-		   :FastMarchingMethod(f_,flags_,N_),image(image_),grad_x(gx),grad_y(gy),dist(d),
+		   :FastMarchingMethod(f_,flags_,N_),image(image_),grad(g),grad0(g0),dist(d),
 		    B_radius(br),dst_weighting(dst_wt),lev_weighting(lev_wt)
 {
 }
@@ -37,6 +35,7 @@ void ModifiedFastMarchingMethod::add_to_narrowband(int i,int j,int active_i,int
     float cnt=0,cntx=0,cnty=0,r;
 
     float dst0 = dist->value(i,j);
+    const Vec2& g0 = grad->value(i-grad0.i,j-grad0.j);		//(i,j) is in the zone, so its gradient is known
     int N = B_radius;
 
     for(ii=-N;ii<=N;ii++)					//look at the known pixels in a window around current-point
@@ -49,21 +48,11 @@ void ModifiedFastMarchingMethod::add_to_narrowband(int i,int j,int active_i,int
        if (dd>N) continue;
        float ndirx = dirx/dd, ndiry = diry/dd;			//(ndirx,ndiry) is unit-direction (i,j)->(i+ii,j+jj)
        float dst = dist->value(i+ii,j+jj);
-       r = ndirx*grad_x->value(i,j) + ndiry*grad_y->value(i,j);	//do directional weighting
+       r = ndirx*g0.x + ndiry*g0.y;				//do directional weighting
        r = fabs(r);
        if (dst_weighting) r /= dd*dd;				//do distance weighting (optional)
        if (lev_weighting) r /= (1+(dst-dst0)*(dst-dst0));	//do level-weighting (optional)
 
-       if (!flags->faraway(i+ii+1,j+jj) && !flags->faraway(i+ii-1,j+jj) &&
-           !flags->faraway(i+ii,j+jj+1) && !flags->faraway(i+ii,j+jj-1))
-       {
-           float igx = image->r.value(i+ii+1,j+jj)-image->r.value(i+ii-1,j+jj);
-	   float igy = image->r.value(i+ii,j+jj+1)-image->r.value(i+ii,j+jj-1);
-	   float  il = sqrt(igx*igx+igy*igy);
-	   float f   = il + igy * grad_x->value(i+ii,j+jj) - igx * grad_y->value(i+ii,j+jj);
-	   //r *= 1/(1+f);
-       }
-
        //r = r*fabs(grad_x->value(i+ii,j+jj)*grad_x->value(i,j)+grad_y->value(i+ii,j+jj)*grad_y->value(i,j));
 
        im_r += r*image->r.value(i+ii,j+jj);			//computed image-avg weighted by the above projection
@@ -212,8 +201,6 @@ void ModifiedFastMarchingMethod::add_to_narrowband(int i,int j,int active_i,int
 
 int ModifiedFastMarchingMethod::diffuse()
 {
-    static NewValue newp[20]; 
-
     //*** 1. FIND MIN-POINT IN NARROWBAND WITH LOWEST VALUE
     int min_i,min_j;
     std::multimap<float,Coord>::iterator it=map.begin();
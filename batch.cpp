@@ -0,0 +1,444 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <fltk/Image.h>
+#include <fltk/filename.h>
+#include <fltk/run.h>
+#include <fltk/Threads.h>
+
+#include "batch.h"
+#include "image_io.h"
+#include "inpaint_batch.h"
+#include "operations.h"
+#include "parallel.h"
+#include "row_stream.h"
+#include "tile_store.h"
+
+using namespace std;
+using namespace fltk;
+
+
+struct BatchFile
+{
+	string input, output;
+	bool ok;
+	int w, h;
+	double load, ops, save;	// seconds
+	StreamStats streamed;
+	TileStats tiled;
+};
+
+struct Batch
+{
+	vector<const char*> ops;
+	bool stream;
+	vector<BatchFile> files;
+	Mutex print_lock;
+};
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: image-editor [--jobs N] [--format EXT] [--stream] [--op SPEC ...] INPUT... OUTPUT\n"
+		"  INPUT may be a glob pattern; with several inputs OUTPUT is a directory\n"
+		"  --jobs N      files processed at a time (default: one per processor)\n"
+		"  --format EXT  file format of the results in a directory (default: the input's)\n"
+		"  --stream      a row at a time from file to file, for images too large for memory;\n"
+		"                with no --op, converts between formats\n"
+		"  .tiles files to .tiles files are run a tile at a time\n"
+		"   or: image-editor --manifest FILE [--jobs N] [--output DIR] [--report CSV]\n"
+		"   or: image-editor --stress N --op SPEC [--op SPEC ...] INPUT\n"
+		"  runs the operations on INPUT N times at once, checking every result is\n"
+		"  the same as that of a run on its own\n"
+		"operations, SPEC being NAME or NAME:KEY=VALUE,...:\n%s", operation_help());
+}
+
+static bool has_wildcards(const char* s)
+{
+	return strpbrk(s, "*?[{") != 0;
+}
+
+// The files matching a pattern in the last component of the path, sorted
+static bool expand_glob(const string& pattern, vector<string>& files)
+{
+	size_t slash = pattern.find_last_of("/\\");
+	string dir = slash == string::npos ? string(".") : pattern.substr(0, slash + 1);
+	string name = slash == string::npos ? pattern : pattern.substr(slash + 1);
+	string prefix = slash == string::npos ? string() : dir;
+	dirent** list = 0;
+	int n = filename_list(dir.c_str(), &list);
+	if(n < 0)
+		return false;
+	bool found = false;
+	for(int k = 0; k < n; k++)
+	{
+		string path = prefix + list[k]->d_name;
+		if(filename_match(list[k]->d_name, name.c_str()) && filename_isfile(path.c_str()))
+		{
+			files.push_back(path);
+			found = true;
+		}
+		free(list[k]);
+	}
+	free(list);
+	return found;
+}
+
+static bool make_dir(const char* path)
+{
+	if(filename_isdir(path))
+		return true;
+#ifdef _WIN32
+	return _mkdir(path) == 0;
+#else
+	return mkdir(path, 0777) == 0;
+#endif
+}
+
+// Through the stages of row_stream.h, with only the rows they keep in memory
+static void stream_file(Batch& batch, BatchFile& file)
+{
+	string error;
+	double t = get_time_secs();
+	file.ok = stream_image(file.input.c_str(), file.output.c_str(), batch.ops, error, &file.streamed);
+	file.ops = get_time_secs() - t;
+	file.w = file.streamed.w;
+	file.h = file.streamed.h;
+
+	batch.print_lock.lock();
+	if(file.ok)
+		printf("%s -> %s: %dx%d, streamed in %.1f ms, %d passes, %lu KB of rows\n", file.input.c_str(),
+			file.output.c_str(), file.w, file.h, file.ops * 1000, file.streamed.passes,
+			(unsigned long)(file.streamed.memory >> 10));
+	else
+		fprintf(stderr, "%s: %s\n", file.input.c_str(), error.c_str());
+	fflush(stdout);
+	batch.print_lock.unlock();
+}
+
+// From tile store to tile store, with only the tiles the LRU keeps mapped
+static void tile_file(Batch& batch, BatchFile& file)
+{
+	string error;
+	double t = get_time_secs();
+	file.ok = run_tile_operations(file.input.c_str(), file.output.c_str(), batch.ops, error, &file.tiled);
+	file.ops = get_time_secs() - t;
+	TileStore* res = file.ok ? TileStore::open(file.output.c_str(), false, error) : 0;
+	if(res)
+	{
+		file.w = res->width();
+		file.h = res->height();
+		delete res;
+	}
+
+	batch.print_lock.lock();
+	if(file.ok)
+		printf("%s -> %s: %dx%d, by tiles in %.1f ms, %lu hits, %lu misses, %lu evictions, %lu KB mapped at most\n",
+			file.input.c_str(), file.output.c_str(), file.w, file.h, file.ops * 1000, file.tiled.hits,
+			file.tiled.misses, file.tiled.evictions, (unsigned long)(file.tiled.peak >> 10));
+	else
+		fprintf(stderr, "%s: %s\n", file.input.c_str(), error.c_str());
+	fflush(stdout);
+	batch.print_lock.unlock();
+}
+
+static void process_file(Batch& batch, BatchFile& file)
+{
+	string error;
+	file.ok = false;
+	file.w = file.h = 0;
+	file.load = file.ops = file.save = 0;
+	if(batch.stream)
+	{
+		stream_file(batch, file);
+		return;
+	}
+	if(file_extension(file.input.c_str()) == "tiles" && file_extension(file.output.c_str()) == "tiles")
+	{
+		tile_file(batch, file);
+		return;
+	}
+
+	double t = get_time_secs();
+	Image* img = load_image(file.input.c_str(), error);
+	file.load = get_time_secs() - t;
+	for(size_t k = 0; img && k < batch.ops.size(); k++)
+	{
+		t = get_time_secs();
+		Image* res = run_operation(batch.ops[k], img, error);
+		file.ops += get_time_secs() - t;
+		delete img;
+		img = res;
+	}
+	if(img)
+	{
+		file.w = img->buffer_width();
+		file.h = img->buffer_height();
+		t = get_time_secs();
+		file.ok = save_image(file.output.c_str(), img, error);
+		file.save = get_time_secs() - t;
+		delete img;
+	}
+
+	batch.print_lock.lock();
+	if(file.ok)
+		printf("%s -> %s: %dx%d, load %.1f ms, ops %.1f ms, save %.1f ms\n", file.input.c_str(),
+			file.output.c_str(), file.w, file.h, file.load * 1000, file.ops * 1000, file.save * 1000);
+	else
+		fprintf(stderr, "%s: %s\n", file.input.c_str(), error.c_str());
+	fflush(stdout);
+	batch.print_lock.unlock();
+}
+
+static void process_files(int lo, int hi, void* arg)
+{
+	Batch* batch = (Batch*)arg;
+	for(int k = lo; k < hi; k++)
+		process_file(*batch, batch->files[k]);
+}
+
+// The operations in order, on a copy of 'input'
+static Image* run_operations(const vector<const char*>& ops, const Image* input, string& error)
+{
+	Image* img = new Image;
+	img->setimage(input->buffer(), RGB32, input->buffer_width(), input->buffer_height());
+	for(size_t k = 0; img && k < ops.size(); k++)
+	{
+		Image* res = run_operation(ops[k], img, error);
+		delete img;
+		img = res;
+	}
+	return img;
+}
+
+static bool same_pixels(const Image* a, const Image* b)
+{
+	return a->buffer_width() == b->buffer_width() && a->buffer_height() == b->buffer_height() &&
+		memcmp(a->buffer(), b->buffer(), size_t(a->buffer_width()) * a->buffer_height() * 4) == 0;
+}
+
+// --stress: the same operations on the same image, many times at once
+struct StressTest
+{
+	vector<const char*> ops;
+	const Image* input;
+	const Image* expected;	// of a run on its own
+	vector<char> same;	// for every run
+};
+
+static void stress_runs(int lo, int hi, void* arg)
+{
+	StressTest* s = (StressTest*)arg;
+	for(int k = lo; k < hi; k++)
+	{
+		string error;
+		Image* res = run_operations(s->ops, s->input, error);
+		s->same[k] = res && same_pixels(res, s->expected);
+		delete res;
+	}
+}
+
+static int stress_test(const vector<const char*>& ops, const char* input, int runs)
+{
+	string error;
+	StressTest s;
+	s.ops = ops;
+	Image* img = load_image(input, error);
+	Image* expected = img ? run_operations(ops, img, error) : 0;
+	if(!expected)
+	{
+		fprintf(stderr, "%s: %s\n", input, error.c_str());
+		delete img;
+		return 1;
+	}
+	s.input = img;
+	s.expected = expected;
+	s.same.assign(runs, 0);
+
+	// one thread per run; the operations' own parallel loops run serially in them
+	set_worker_count(runs);
+	double t = get_time_secs();
+	parallel_for(0, runs, 1, stress_runs, &s);
+	t = get_time_secs() - t;
+	set_worker_count(0);
+
+	int differ = 0;
+	for(int k = 0; k < runs; k++)
+		differ += !s.same[k];
+	printf("%s: %d runs at once in %.3f s, %d of them different from a run on its own\n", input, runs, t,
+		differ);
+	delete expected;
+	delete img;
+	return differ ? 1 : 0;
+}
+
+int batch_main(int argc, char** argv)
+{
+	for(int k = 1; k < argc; k++)
+		if(strcmp(argv[k], "--manifest") == 0)
+			return inpaint_batch_main(argc, argv);
+
+	Batch batch;
+	batch.stream = false;
+	vector<const char*> args;
+	int jobs = 0;
+	int stress = 0;
+	const char* format = 0;
+	for(int k = 1; k < argc; k++)
+	{
+		const char* a = argv[k];
+		if(strcmp(a, "--help") == 0 || strcmp(a, "-h") == 0)
+		{
+			usage();
+			return 0;
+		}
+		if(strcmp(a, "--stream") == 0)
+		{
+			batch.stream = true;
+			continue;
+		}
+		if(strcmp(a, "--op") == 0 || strcmp(a, "--jobs") == 0 || strcmp(a, "--format") == 0 ||
+		 strcmp(a, "--stress") == 0)
+		{
+			if(k + 1 == argc)
+			{
+				fprintf(stderr, "%s: missing value\n", a);
+				return 2;
+			}
+			const char* value = argv[++k];
+			if(strcmp(a, "--op") == 0)
+				batch.ops.push_back(value);
+			else if(strcmp(a, "--jobs") == 0 || strcmp(a, "--stress") == 0)
+			{
+				int& n = strcmp(a, "--jobs") == 0 ? jobs : stress;
+				n = atoi(value);
+				if(n <= 0)
+				{
+					fprintf(stderr, "%s: not a positive number: %s\n", a, value);
+					return 2;
+				}
+			}
+			else
+				format = *value == '.' ? value + 1 : value;
+			continue;
+		}
+		if(strncmp(a, "--", 2) == 0)
+		{
+			fprintf(stderr, "unknown option: %s\n", a);
+			usage();
+			return 2;
+		}
+		args.push_back(a);
+	}
+	if(stress && (batch.ops.empty() || batch.stream || args.size() != 1))
+	{
+		usage();
+		return 2;
+	}
+	if(!stress && ((batch.ops.empty() && !batch.stream) || args.size() < 2))
+	{
+		usage();
+		return 2;
+	}
+	for(size_t k = 0; k < batch.ops.size(); k++)
+	{
+		string error;
+		if(!check_operation(batch.ops[k], error, batch.stream))
+		{
+			fprintf(stderr, "%s\n", error.c_str());
+			return 2;
+		}
+	}
+	if(stress)
+		return stress_test(batch.ops, args[0], stress);
+
+	vector<string> inputs;
+	for(size_t k = 0; k + 1 < args.size(); k++)
+	{
+		if(!has_wildcards(args[k]))
+			inputs.push_back(args[k]);
+		else if(!expand_glob(args[k], inputs))
+			fprintf(stderr, "%s: no files match\n", args[k]);
+	}
+	if(inputs.empty())
+		return 1;
+
+	// One input and an OUTPUT that isn't a directory: OUTPUT is the result
+	string output = args.back();
+	bool to_dir = inputs.size() > 1 || args.size() > 2 || has_wildcards(args[0]) ||
+		filename_isdir(output.c_str());
+	if(to_dir)
+	{
+		if(!make_dir(output.c_str()))
+		{
+			fprintf(stderr, "%s: can't create the directory\n", output.c_str());
+			return 1;
+		}
+		char last = output[output.size() - 1];
+		if(last != '/' && last != '\\')
+			output += '/';
+	}
+	batch.files.resize(inputs.size());
+	for(size_t k = 0; k < inputs.size(); k++)
+	{
+		BatchFile& file = batch.files[k];
+		file.input = inputs[k];
+		if(!to_dir)
+		{
+			file.output = output;
+			continue;
+		}
+		file.output = output + filename_name(inputs[k].c_str());
+		if(format)
+		{
+			const char* ext = filename_ext(file.output.c_str());
+			file.output.resize(ext - file.output.c_str());
+			file.output = file.output + "." + format;
+		}
+	}
+
+	// Several files at once, each on one thread; a single file, or a
+	// single job, gets all the threads for the operations instead
+	if(jobs == 0)
+		jobs = worker_count();
+	double t = get_time_secs();
+	if(jobs > 1 && batch.files.size() > 1)
+	{
+		set_worker_count(jobs);
+		parallel_for(0, int(batch.files.size()), 1, process_files, &batch);
+		set_worker_count(0);
+	}
+	else
+		process_files(0, int(batch.files.size()), &batch);
+	t = get_time_secs() - t;
+
+	int failed = 0;
+	double pixels = 0;
+	for(size_t k = 0; k < batch.files.size(); k++)
+	{
+		if(!batch.files[k].ok)
+			failed++;
+		else
+			pixels += double(batch.files[k].w) * batch.files[k].h;
+	}
+	int done = int(batch.files.size()) - failed;
+	printf("%d files in %.3f s, %d jobs: %.2f files/s, %.2f Mpixel/s", done, t, jobs,
+		t > 0 ? done / t : 0, t > 0 ? pixels / t / 1e6 : 0);
+	if(failed)
+		printf(", %d failed", failed);
+	DecodeCacheStats cache = decode_cache_stats();
+	if(cache.hits)
+		printf(", decode cache: %lu hits, %lu misses", cache.hits, cache.misses);
+	printf("\n");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// The editor without a window:
+//
+//   image-editor [--jobs N] [--format EXT] [--stream] [--op SPEC ...] INPUT... OUTPUT
+//
+// applies the operations (see run_operation()) in order to every input and
+// saves the results. The inputs may be glob patterns; with more than one
+// input OUTPUT is a directory, the results keeping the inputs' names. The
+// files are processed N at a time (one per processor by default), and the
+// time each of them took is printed as it is done.
+//
+// With --stream, the images go from file to file a row at a time, without
+// ever being in memory whole (see stream_image()); only the operations that
+// look at a few rows around the one they make can be used. Without any --op
+// it converts, to and from tile stores (.tiles, see tile_store.h) as well.
+//
+// From a .tiles input to a .tiles output the operations run a tile at a time
+// on the mapped stores instead (see run_tile_operations()).
+//
+// With --manifest, runs inpaint_batch_main() instead.
+//
+//   image-editor --stress N --op SPEC ... INPUT
+//
+// runs the operations on INPUT N times at once, on a thread each, and checks
+// every result is the same, to the byte, as that of a run on its own.
+//
+// Returns the exit status: 0 if every file was processed.
+int batch_main(int argc, char** argv);
+
+#endif
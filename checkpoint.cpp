@@ -0,0 +1,329 @@
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <fltk/run.h>
+#include <fltk/Threads.h>
+
+#include "checkpoint.h"
+
+using namespace std;
+using namespace fltk;
+
+
+static const char CHECKPOINT_MAGIC[8] = { 'I', 'N', 'P', 'C', 'K', 'P', 'T', '1' };
+static const unsigned BYTE_ORDER_MARK = 0x01020304;
+
+struct FileHeader
+{
+	char magic[8];
+	unsigned byte_order;	// BYTE_ORDER_MARK as written by the machine
+	unsigned kind;
+	unsigned long long key;
+	int w, h;
+	unsigned sections;
+	unsigned reserved;
+};
+
+struct FileSection
+{
+	unsigned tag;
+	unsigned reserved;
+	unsigned long long offset, size;  // in bytes from the start of the file
+};
+
+static size_t align_up(size_t n)
+{
+	return (n + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+
+// FNV-1a [1], a 64 bit word at a time
+static unsigned long long hash_words(unsigned long long hash, const uchar* p, size_t n)
+{
+	const unsigned long long prime = 1099511628211ULL;
+	size_t k = 0;
+	for(; k + 8 <= n; k += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, p + k, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for(; k < n; k++)
+		hash = (hash ^ p[k]) * prime;
+	return hash;
+}
+
+unsigned long long checkpoint_key(const Image* image, const Image* mask, unsigned long long salt)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	hash = hash_words(hash, (const uchar*)&salt, sizeof(salt));
+	hash = hash_words(hash, image->buffer(), size_t(image->buffer_width()) * image->buffer_height() * 4);
+	hash = hash_words(hash, mask->buffer(), size_t(mask->buffer_width()) * mask->buffer_height() * 4);
+	return hash;
+}
+
+
+CheckpointWriter::CheckpointWriter(const char* path_, int kind, unsigned long long key, int w, int h,
+	double interval) :
+	path(new char[strlen(path_) + 1]), kind(kind), key(key), w(w), h(h), interval(interval),
+	last(get_time_secs()), sections(), dirty(h > 0 ? h : 1, 0),
+	lock(new SignalMutex), pending(false), writing(false), quit(false), running(true), files(0), max_stop(0)
+{
+	strcpy(path, path_);
+	Thread t;
+	int rc = create_thread(t, writer_thread, this);
+#ifdef _WIN32
+	if(rc == -1)
+		running = false;
+#else
+	if(rc != 0)
+		running = false;
+	else
+		pthread_detach(t);
+#endif
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	finish();
+	lock->lock();
+	quit = true;
+	lock->signal();
+	while(running)
+		lock->wait();
+	lock->unlock();
+	delete lock;
+	delete[] path;
+}
+
+void CheckpointWriter::finish()
+{
+	lock->lock();
+	while(running && (pending || writing))
+		lock->wait();
+	lock->unlock();
+}
+
+int CheckpointWriter::written()
+{
+	lock->lock();
+	int n = files;
+	lock->unlock();
+	return n;
+}
+
+void CheckpointWriter::add_rows(unsigned tag, const void* data, size_t row_bytes)
+{
+	Section s = { tag, (const char*)data, row_bytes, vector<char>() };
+	sections.push_back(s);
+	sections.back().copy.assign(s.data, s.data + row_bytes * h);
+}
+
+void CheckpointWriter::add_blob(unsigned tag)
+{
+	Section s = { tag, 0, 0, vector<char>() };
+	sections.push_back(s);
+}
+
+bool CheckpointWriter::due()
+{
+	if(get_time_secs() - last < interval)
+		return false;
+	lock->lock();
+	bool busy = pending || writing || !running;
+	lock->unlock();
+	return !busy;
+}
+
+void CheckpointWriter::snapshot(const void* const* blobs, const size_t* blob_sizes)
+{
+	double t = get_time_secs();
+	lock->lock();
+	while(running && (pending || writing))
+		lock->wait();
+	if(!running)
+	{
+		lock->unlock();
+		return;
+	}
+	lock->unlock();
+
+	// The copies are the writer thread's only while it is writing, so
+	// they can be brought up to date here without holding the lock
+	int blob = 0;
+	for(size_t k = 0; k < sections.size(); k++)
+	{
+		Section& s = sections[k];
+		if(!s.data)
+		{
+			s.copy.resize(blob_sizes[blob]);
+			if(blob_sizes[blob])
+				memcpy(&s.copy[0], blobs[blob], blob_sizes[blob]);
+			blob++;
+			continue;
+		}
+		for(int y = 0; y < h; y++)
+		{
+			if(!dirty[y])
+				continue;
+			int y1 = y + 1;  // one memcpy() for a run of dirty rows
+			while(y1 < h && dirty[y1])
+				y1++;
+			memcpy(&s.copy[y * s.row_bytes], s.data + y * s.row_bytes, (y1 - y) * s.row_bytes);
+			y = y1;
+		}
+	}
+	memset(&dirty[0], 0, dirty.size());
+
+	lock->lock();
+	pending = true;
+	lock->signal();
+	lock->unlock();
+	last = get_time_secs();
+	if(last - t > max_stop)
+		max_stop = last - t;
+}
+
+void* CheckpointWriter::writer_thread(void* arg)
+{
+	CheckpointWriter* c = (CheckpointWriter*)arg;
+	c->lock->lock();
+	for(;;)
+	{
+		while(!c->pending && !c->quit)
+			c->lock->wait();
+		if(!c->pending)
+			break;
+		c->pending = false;
+		c->writing = true;
+		c->lock->unlock();
+		c->write_file();
+		c->lock->lock();
+		c->writing = false;
+		c->files++;
+		c->lock->signal();
+	}
+	c->running = false;
+	c->lock->signal();
+	c->lock->unlock();
+	return 0;
+}
+
+void CheckpointWriter::write_file()
+{
+	string tmp = string(path) + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if(!f)
+		return;
+
+	FileHeader header;
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.byte_order = BYTE_ORDER_MARK;
+	header.kind = kind;
+	header.key = key;
+	header.w = w;
+	header.h = h;
+	header.sections = unsigned(sections.size());
+	header.reserved = 0;
+	vector<FileSection> table(sections.size());
+	size_t offset = align_up(sizeof(header) + table.size() * sizeof(FileSection));
+	for(size_t k = 0; k < sections.size(); k++)
+	{
+		table[k].tag = sections[k].tag;
+		table[k].reserved = 0;
+		table[k].offset = offset;
+		table[k].size = sections[k].copy.size();
+		offset = align_up(offset + sections[k].copy.size());
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if(!table.empty())
+		ok = ok && fwrite(&table[0], sizeof(FileSection), table.size(), f) == table.size();
+	size_t pos = sizeof(header) + table.size() * sizeof(FileSection);
+	static const char zeros[CHECKPOINT_ALIGN] = { 0 };
+	for(size_t k = 0; k < sections.size() && ok; k++)
+	{
+		ok = fwrite(zeros, 1, size_t(table[k].offset) - pos, f) == size_t(table[k].offset) - pos;
+		const vector<char>& copy = sections[k].copy;
+		if(!copy.empty())
+			ok = ok && fwrite(&copy[0], 1, copy.size(), f) == copy.size();
+		pos = size_t(table[k].offset) + copy.size();
+	}
+	ok = fclose(f) == 0 && ok;
+	if(!ok)
+	{
+		remove(tmp.c_str());
+		return;
+	}
+#ifdef _WIN32
+	MoveFileExA(tmp.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+	rename(tmp.c_str(), path);
+#endif
+}
+
+
+CheckpointReader::CheckpointReader() : file(), base(0), length(0)
+{
+}
+
+CheckpointReader::~CheckpointReader()
+{
+	close();
+}
+
+void CheckpointReader::close()
+{
+	file.close();
+	base = 0;
+	length = 0;
+}
+
+bool CheckpointReader::open(const char* path, int kind, unsigned long long key, int w, int h)
+{
+	close();
+	if(!file.open(path) || file.size() < sizeof(FileHeader))
+	{
+		close();
+		return false;
+	}
+	base = file.data();
+	length = file.size();
+
+	const FileHeader* header = (const FileHeader*)base;
+	bool ok = memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0 &&
+		header->byte_order == BYTE_ORDER_MARK && header->kind == unsigned(kind) &&
+		header->key == key && header->w == w && header->h == h &&
+		sizeof(FileHeader) + header->sections * sizeof(FileSection) <= length;
+	const FileSection* table = (const FileSection*)(base + sizeof(FileHeader));
+	for(unsigned k = 0; ok && k < header->sections; k++)
+		ok = table[k].offset <= length && table[k].size <= length - table[k].offset;
+	if(!ok)
+		close();
+	return ok;
+}
+
+const void* CheckpointReader::section(unsigned tag, size_t* size) const
+{
+	if(!base)
+		return 0;
+	const FileHeader* header = (const FileHeader*)base;
+	const FileSection* table = (const FileSection*)(base + sizeof(FileHeader));
+	for(unsigned k = 0; k < header->sections; k++)
+		if(table[k].tag == tag)
+		{
+			if(size)
+				*size = size_t(table[k].size);
+			return base + table[k].offset;
+		}
+	return 0;
+}
+
+// Список литературы:
+//  [1] G. Fowler, L. C. Noll, K.-P. Vo, "The FNV Non-Cryptographic Hash Algorithm", 2011
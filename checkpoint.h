@@ -0,0 +1,139 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstddef>
+#include <vector>
+
+#include <fltk/Image.h>
+
+#include "binio.h"
+
+namespace fltk { class SignalMutex; }
+
+// Checkpoints of a long inpaint, to stop it and take it up again later, or
+// after a crash.
+//
+// A checkpoint file is a header, a table of sections and the sections, each
+// of them a plain array in the byte order of the machine starting at a
+// multiple of CHECKPOINT_ALIGN bytes, so that a reader can map the file and
+// use the arrays where they lie. The file is written as 'path'.tmp and renamed
+// over 'path' once complete: a crash while writing leaves the last one whole.
+
+enum CheckpointKind
+{
+	CHECKPOINT_CRIMINISI = 1,	// result, SourceRegion, C, Ix, Iy, the state of the search
+	CHECKPOINT_FAST_MARCHING = 2	// f, FLAGS, the image planes, the narrow band heap
+};
+
+const size_t CHECKPOINT_ALIGN = 4096;
+
+// Checkpointing of one inpaint
+struct CheckpointConfig
+{
+	const char* path;	// file the state is saved to while the inpaint runs (0: none);
+				// it is removed when the inpaint is done
+	double every;		// seconds between the checkpoints
+	bool resume;		// start from the file, if it is a checkpoint of the same inpaint
+	volatile bool* stop;	// set by another thread to stop the inpaint: the state is saved
+				// and the partial result returned (0: never)
+
+	CheckpointConfig() : path(0), every(10), resume(false), stop(0) {}
+};
+
+// Tells the checkpoints of different inpaints apart: a hash of the image,
+// the mask and 'salt' (the settings that change the result)
+unsigned long long checkpoint_key(const fltk::Image* image, const fltk::Image* mask,
+	unsigned long long salt = 0);
+
+// Writes checkpoints of the state of an inpaint, from a thread of its own.
+//
+// The state is a set of sections the inpaint keeps updating: 'rows' sections,
+// arrays of one row per image row, and 'blob' sections, copied whole on every
+// snapshot. The writer keeps a copy of the rows sections; snapshot() only
+// brings the rows marked dirty since the last one up to date in it, so that
+// the inpaint stops for as long as it takes to copy what changed and the file
+// is written while it goes on.
+class CheckpointWriter
+{
+public:
+	// A checkpoint every 'interval' seconds of a w x h inpaint
+	CheckpointWriter(const char* path, int kind, unsigned long long key, int w, int h,
+		double interval);
+	~CheckpointWriter();  // finish()es
+
+	// 'data' stays the inpaint's and must not move; it is copied whole
+	// here, before the inpaint starts. The tags are the caller's, to find
+	// the sections again when reading.
+	void add_rows(unsigned tag, const void* data, size_t row_bytes);
+	void add_blob(unsigned tag);
+
+	// The rows the inpaint writes to have to be marked, by touch() or
+	// directly in dirty_rows(), one char per row
+	void touch(int y0, int y1)	{ for(int y = y0 < 0 ? 0 : y0; y < y1 && y < h; y++) dirty[y] = 1; }
+	char* dirty_rows()		{ return &dirty[0]; }
+
+	// True if 'interval' has passed since the last snapshot and the file
+	// before is written, so that snapshot() doesn't wait
+	bool due();
+	// Takes the state; the blobs are given here, in the order of add_blob()
+	void snapshot(const void* const* blobs = 0, const size_t* blob_sizes = 0);
+
+	// Waits for the file being written, if any
+	void finish();
+
+	int written();		// files written so far
+	double longest_stop() const	{ return max_stop; }	// seconds spent in snapshot() at most
+
+private:
+	struct Section
+	{
+		unsigned tag;
+		const char* data;	// rows: the inpaint's array, 0 for blobs
+		size_t row_bytes;
+		std::vector<char> copy;
+	};
+
+	static void* writer_thread(void*);
+	void write_file();
+
+	char* path;
+	int kind;
+	unsigned long long key;
+	int w, h;
+	double interval, last;
+	std::vector<Section> sections;
+	std::vector<char> dirty;
+
+	fltk::SignalMutex* lock;	// guards the fields below
+	bool pending, writing, quit, running;
+	int files;
+	double max_stop;
+
+	CheckpointWriter(const CheckpointWriter&);
+	CheckpointWriter& operator=(const CheckpointWriter&);
+};
+
+// A checkpoint file, mapped into memory
+class CheckpointReader
+{
+public:
+	CheckpointReader();
+	~CheckpointReader();
+
+	// False if the file is missing or not a checkpoint of this kind, key and size
+	bool open(const char* path, int kind, unsigned long long key, int w, int h);
+	// The section, or 0 if there's none tagged so
+	const void* section(unsigned tag, size_t* size = 0) const;
+
+private:
+	void close();
+
+	MAPPED_FILE file;
+	const char* base;
+	size_t length;
+
+	CheckpointReader(const CheckpointReader&);
+	CheckpointReader& operator=(const CheckpointReader&);
+};
+
+#endif
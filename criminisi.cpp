@@ -1,75 +1,966 @@
 
 #include <cassert>
 #include <cmath>
-#include <cfloat>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <vector>
+#include <algorithm>
 
 #include <fltk/Image.h>
+#include <fltk/run.h>
+
+#include "inpaint.h"
+#include "patch_ssd.h"
+#include "gradient.h"
+#include "parallel.h"
+#include "patch_index.h"
+#include "pyramid.h"
+#include "checkpoint.h"
 
 using namespace std;
 using namespace fltk;
 
 
 static const int patch_size = 9;
+static const int CRIMINISI_COARSE_HOLE = 32;  // multi-scale: hole thickness at the coarsest level
+
 
-extern Image* filter(double* kernel, int kern_height, int kern_width, const Image* img);
+typedef pair<int, int> coord;  // first == x, second == y
 
-//    
-//
+// Fill front: the unknown pixels with a known one among their 8 neighbours,
+// the image wrapping around at the borders. The front pixels are kept in an
+// indexed max-heap by priority; ties go to the lowest x, then y.
+class FillFront
+{
+public:
+	FillFront(int w, int h) : w(w), pos(w*h, -1), prio(w*h), conf(w*h) {}
 
-double x_gradient_kernel[9] = 	
-	{+1, 0, -1, 
-	 +2, 0, -2,
-	 +1, 0, -1};
-double y_gradient_kernel[9] = 
-	{+1, +2, +1,
-	 0, 0, 0,
-	 -1, -2, -1};
+	bool empty() const		{ return heap.empty(); }
+	size_t size() const		{ return heap.size(); }
+	int top() const			{ return heap[0]; }  // pixel index of the highest priority
+	// Both stay known after the pixel is removed, until it is set again
+	double priority(int idx) const	{ return prio[idx]; }
+	double confidence(int idx) const { return conf[idx]; }
 
-Image* gradientX(const Image* img)
+	void set(int idx, double priority, double confidence)  // adds or updates a pixel
+	{
+		prio[idx] = priority;
+		conf[idx] = confidence;
+		if(pos[idx] < 0)
+		{
+			pos[idx] = int(heap.size());
+			heap.push_back(idx);
+		}
+		sift_down(sift_up(pos[idx]));
+	}
+
+	void remove(int idx)
+	{
+		int i = pos[idx];
+		if(i < 0)
+			return;
+		pos[idx] = -1;
+		int last = heap.back();
+		heap.pop_back();
+		if(i < int(heap.size()))
+		{
+			place(i, last);
+			sift_down(sift_up(i));
+		}
+	}
+
+private:
+	bool before(int a, int b) const
+	{
+		if(prio[a] != prio[b])
+			return prio[a] > prio[b];
+		int ax = a % w, bx = b % w;
+		return ax < bx || (ax == bx && a < b);
+	}
+
+	void place(int i, int idx)
+	{
+		heap[i] = idx;
+		pos[idx] = i;
+	}
+
+	int sift_up(int i)
+	{
+		int idx = heap[i];
+		while(i > 0 && before(idx, heap[(i - 1) / 2]))
+		{
+			place(i, heap[(i - 1) / 2]);
+			i = (i - 1) / 2;
+		}
+		place(i, idx);
+		return i;
+	}
+
+	void sift_down(int i)
+	{
+		int idx = heap[i], n = int(heap.size());
+		for(;;)
+		{
+			int c = 2*i + 1;
+			if(c >= n)
+				break;
+			if(c + 1 < n && before(heap[c + 1], heap[c]))
+				c++;
+			if(!before(heap[c], idx))
+				break;
+			place(i, heap[c]);
+			i = c;
+		}
+		place(i, idx);
+	}
+
+	int w;
+	vector<int> heap;     // pixel indices y*w + x
+	vector<int> pos;      // place of every pixel in 'heap', -1 if not on the front
+	vector<double> prio;  // C*D
+	vector<double> conf;  // C
+};
+
+static inline int wrap(int v, int n)
 {
-	return filter(x_gradient_kernel, 3, 3, img);
+	return v < 0 ? v + n : v >= n ? v - n : v;
 }
 
-Image* gradientY(const Image* img)
+static bool on_front(const bool* known, int w, int h, int x, int y)
 {
-	return filter(y_gradient_kernel, 3, 3, img);
+	if(known[y*w + x])
+		return false;
+	for(int i = -1; i <= 1; i++)
+		for(int j = -1; j <= 1; j++)
+			if(known[wrap(y + i, h)*w + wrap(x + j, w)])
+				return true;
+	return false;
 }
 
-double* conv(bool* arr, int w, int h, double* kernel)
+// Unit normal of the source region's border at (x, y), by the Sobel kernels
+static pair<double, double> front_normal(const bool* known, int w, int h, int x, int y)
 {
-	double* res = new double[w*h];
-	for(int y = 0; y < h; y++)
-		for(int x = 0; x < w; x++)
+	static const double x_kernel[9] =
+		{+1, 0, -1,
+		 +2, 0, -2,
+		 +1, 0, -1};
+	static const double y_kernel[9] =
+		{+1, +2, +1,
+		 0, 0, 0,
+		 -1, -2, -1};
+	pair<double, double> n(0, 0);
+	for(int i = -1; i <= 1; i++)
+		for(int j = -1; j <= 1; j++)
 		{
-			double r = 0;
-			for(int i = -1; i <= 1; i++)
+			int kern_idx = (i + 1)*3 + j + 1;
+			int k = known[wrap(y + i, h)*w + wrap(x + j, w)];
+			n.first  += x_kernel[kern_idx] * k;
+			n.second += y_kernel[kern_idx] * k;
+		}
+	double factor = sqrt(n.first*n.first + n.second*n.second);
+	if(factor != 0)
+	{
+		n.first  /= factor;
+		n.second /= factor;
+	}
+	return n;
+}
+
+// Brings the front membership and normals up to date in the box
+// [x0, x0+bw) x [y0, y0+bh), which may stick out of the image: it wraps
+// around, like the front does. Pixels leaving the front leave the heap too.
+static void update_front(const bool* known, int w, int h, int x0, int y0, int bw, int bh,
+	vector<char>& on, vector<pair<double, double> >& N, FillFront& front)
+{
+	for(int y = y0; y < y0 + bh; y++)
+		for(int x = x0; x < x0 + bw; x++)
+		{
+			int xx = ((x % w) + w) % w, yy = ((y % h) + h) % h, idx = yy*w + xx;
+			on[idx] = on_front(known, w, h, xx, yy);
+			if(on[idx])
+				N[idx] = front_normal(known, w, h, xx, yy);
+			else
+				front.remove(idx);
+		}
+}
+
+// Recomputes the priority of the front pixels in the box, as above
+static void update_priorities(const double* C, const float* Ix, const float* Iy, int w, int h,
+	int x0, int y0, int bw, int bh, const vector<char>& on, const vector<pair<double, double> >& N,
+	FillFront& front)
+{
+	for(int py = y0; py < y0 + bh; py++)
+		for(int px = x0; px < x0 + bw; px++)
+		{
+			int xx = ((px % w) + w) % w, yy = ((py % h) + h) % h, idx = yy*w + xx;
+			if(!on[idx])
+				continue;
+
+			// calculate confidence term
+			double c = 0;
+			for(int x = xx - patch_size / 2; x < xx + patch_size / 2; x++)
+				for(int y = yy - patch_size / 2; y < yy + patch_size / 2; y++)
+					if(x > 0 && y > 0 && x < w && y < h)
+						c += C[y*w + x];
+			c /= (patch_size * patch_size);
+
+			// calculate data term
+			double d = abs(Ix[idx] * N[idx].first + Iy[idx] * N[idx].second) + 0.001;
+
+			front.set(idx, c * d, c);
+		}
+}
+
+// The centres of the source patches, the ones lying whole in the image and
+// in SourceRegion. The number of unknown pixels under every patch is taken
+// from an integral image of the mask once, and then only counted down as the
+// pixels get filled; the centres whose count reaches 0 join the lists of
+// their rows, kept in order of x.
+class SourceIndex
+{
+public:
+	SourceIndex(const bool* known, int w, int h) : w(w), h(h), missing(w*h, INT_MAX), rows(h), added(0)
+	{
+		vector<int> sum((w + 1)*(h + 1), 0);  // unknown pixels above and left of every one
+		for(int y = 0; y < h; y++)
+			for(int x = 0; x < w; x++)
+				sum[(y + 1)*(w + 1) + x + 1] = !known[y*w + x] + sum[y*(w + 1) + x + 1] +
+					sum[(y + 1)*(w + 1) + x] - sum[y*(w + 1) + x];
+		const int r = patch_size / 2;
+		for(int y = r; y < h - r; y++)
+			for(int x = r; x < w - r; x++)
 			{
-				int y_idx = y + i;
-				if(y_idx < 0)
-					y_idx += h;
-				if(y_idx >= h)
-					y_idx -= h;
-				for(int j = -1; j <= 1; j++)
+				int x0 = x - r, y0 = y - r, x1 = x + r + 1, y1 = y + r + 1;
+				missing[y*w + x] = sum[y1*(w + 1) + x1] - sum[y0*(w + 1) + x1] -
+					sum[y1*(w + 1) + x0] + sum[y0*(w + 1) + x0];
+				if(!missing[y*w + x])
+					rows[y].push_back(x);
+			}
+	}
+
+	// Whether the patch centred at (x, y) is whole in the image and known
+	bool valid(int x, int y) const
+	{
+		return x >= 0 && y >= 0 && x < w && y < h && !missing[y*w + x];
+	}
+
+	const vector<int>& row(int y) const	{ return rows[y]; }
+
+	// The centres becoming valid from now on are also appended to 'a',
+	// as y*w + x
+	void track(vector<int>* a)	{ added = a; }
+
+	// The pixel (x, y) was unknown and has just been filled
+	void fill(int x, int y)
+	{
+		const int r = patch_size / 2;
+		for(int cy = max(y - r, r); cy <= min(y + r, h - 1 - r); cy++)
+			for(int cx = max(x - r, r); cx <= min(x + r, w - 1 - r); cx++)
+				if(!--missing[cy*w + cx])
 				{
-					int x_idx = x + j;
-					if(x_idx < 0)
-						x_idx += w;
-					if(x_idx >= w)
-						x_idx -= w;
-
-					int kern_idx = (j + 1)*3 + i + 1;
-					r += kernel[kern_idx] * (int)arr[y_idx*w + x_idx];
+					rows[cy].insert(lower_bound(rows[cy].begin(), rows[cy].end(), cx), cx);
+					if(added)
+						added->push_back(cy*w + cx);
+				}
+	}
+
+private:
+	int w, h;
+	vector<int> missing;        // unknown pixels of the patch at every centre, INT_MAX off the edges
+	vector<vector<int> > rows;  // x of the valid centres, for every y
+	vector<int>* added;
+};
+
+// What the exemplar search needs to know about the target patch
+struct ExemplarQuery
+{
+	const uchar* buf;   // RGB32 pixels being filled
+	const bool* known;  // SourceRegion
+	const SourceIndex* sources;
+	int w, h;
+	int p_x, p_y;       // centre of the target patch
+};
+
+// Whether the source patch centred at (x, y) is too close to the target one
+static bool near_target(const ExemplarQuery& q, int x, int y)
+{
+	return abs(q.p_x - x) <= patch_size || abs(q.p_y - y) <= patch_size;
+}
+
+// Whether the patch centred at (x, y) can be copied into the target one
+static bool valid_source(const ExemplarQuery& q, int x, int y)
+{
+	return q.sources->valid(x, y) && !near_target(q, x, y);
+}
+
+// Sum of squared differences between the source patch centred at (x, y) and
+// the known pixels of the target patch, or anything over 'limit' once it is
+// sure to be
+static unsigned int patch_sse(const ExemplarQuery& q, int x, int y, unsigned int limit)
+{
+	int x0 = max(-patch_size / 2, -q.p_x), x1 = min(patch_size / 2, q.w - 1 - q.p_x);
+	int y0 = max(-patch_size / 2, -q.p_y), y1 = min(patch_size / 2, q.h - 1 - q.p_y);
+	int stride = q.w * 4;
+	return patch_ssd(&q.buf[(y + y0)*stride + (x + x0)*4], stride,
+		&q.buf[(q.p_y + y0)*stride + (q.p_x + x0)*4], stride,
+		(const uchar*)&q.known[(q.p_y + y0)*q.w + q.p_x + x0], q.w,
+		x1 - x0 + 1, y1 - y0 + 1, limit);
+}
+
+// Tries every source patch centred in the window, keeps the first one with
+// the least SSE. The search is split into tiles of this many rows, spread
+// over the worker threads.
+static const int SEARCH_TILE_ROWS = 8;
+
+// Best candidate of one tile: the least SSE, and of equal ones the first in
+// the row by row order
+struct SearchTile
+{
+	unsigned int sse;
+	int x, y;
+};
+
+struct ExhaustiveSearch
+{
+	const ExemplarQuery* q;
+	int x0, y0, x1, y1;  // window of the source centres, inclusive
+	vector<SearchTile> tiles;
+	// The least SSE any tile has found so far, to cut the others' sums short.
+	// A tile reads it and lowers it to its own best, atomically, once a row.
+	unsigned int bound;
+};
+
+static void search_tiles(int lo, int hi, void* arg)
+{
+	ExhaustiveSearch* s = (ExhaustiveSearch*)arg;
+	const ExemplarQuery& q = *s->q;
+	for(int t = lo; t < hi; t++)
+	{
+		SearchTile& best = s->tiles[t];
+		best.sse = UINT_MAX;
+		best.x = best.y = -1;
+		int y0 = s->y0 + t*SEARCH_TILE_ROWS;
+		int y1 = min(y0 + SEARCH_TILE_ROWS - 1, s->y1);
+		for(int y = y0; y <= y1; y++)
+		{
+			unsigned int row_best = best.sse;
+			unsigned int limit = min(best.sse, atomic_read(&s->bound));
+			const vector<int>& xs = q.sources->row(y);
+			for(vector<int>::const_iterator i = lower_bound(xs.begin(), xs.end(), s->x0);
+				i != xs.end() && *i <= s->x1; ++i)
+			{
+				int x = *i;
+				if(near_target(q, x, y))
+					continue;
+				unsigned int sse = patch_sse(q, x, y, limit);
+				if(sse <= limit && sse < best.sse)
+				{
+					best.sse = limit = sse;
+					best.x = x;
+					best.y = y;
 				}
 			}
-			res[y*w + x] = r;
+			if(best.sse < row_best)
+				atomic_min(&s->bound, best.sse);
 		}
-	return res;
+	}
 }
 
-typedef pair<int, int> coord;  // first == x, second == y
+// The tiles are searched in parallel, each with its own best, and then the
+// bests are reduced in tile order. The tiles go top to bottom, so taking only
+// a strictly lesser SSE keeps the lowest y, then x, of the equal ones: the
+// same candidate the search over the whole window on one thread finds.
+// A candidate found in the window replaces the one passed in only if its SSE
+// is less; the search is cut short by 'best_sse'.
+static bool search_window(const ExemplarQuery& q, int x0, int y0, int x1, int y1,
+	unsigned int& best_sse, int& best_x, int& best_y)
+{
+	ExhaustiveSearch s;
+	s.q = &q;
+	s.x0 = x0;
+	s.y0 = max(y0, 0);
+	s.x1 = x1;
+	s.y1 = min(y1, q.h - 1);
+	s.bound = best_sse;
+	if(s.y1 < s.y0)
+		return false;
+	s.tiles.resize((s.y1 - s.y0 + SEARCH_TILE_ROWS) / SEARCH_TILE_ROWS);
+	parallel_for(0, int(s.tiles.size()), 1, search_tiles, &s);
+
+	bool found = false;
+	for(size_t t = 0; t < s.tiles.size(); t++)
+		if(s.tiles[t].x >= 0 && s.tiles[t].sse < best_sse)
+		{
+			best_sse = s.tiles[t].sse;
+			best_x = s.tiles[t].x;
+			best_y = s.tiles[t].y;
+			found = true;
+		}
+	return found;
+}
+
+static bool find_exemplar_exhaustive(const ExemplarQuery& q, int& best_x, int& best_y)
+{
+	unsigned int best_sse = UINT_MAX;
+	return search_window(q, 0, 0, q.w - 1, q.h - 1, best_sse, best_x, best_y);
+}
+
+// PatchMatch [2]: the nearest neighbour field of the target patches is kept
+// for the whole inpaint. A query starts from the patch's own match and the
+// ones of its neighbours, shifted back by their offset, then searches at
+// random around the best one in windows halving in size. Filling a patch
+// sets the matches of the pixels it covers, so the next patches along the
+// front start from a coherent guess.
+
+static const int PM_RANDOM_TRIES = 64;  // random sources tried when there is no guess at all
+static const int PM_SEARCH_ROUNDS = 4;  // random search passes per query
+
+struct NNField
+{
+	int w, h;
+	vector<int> x, y;  // source patch centre for every target centre, -1 if none yet
+	unsigned seed;
+};
+
+static unsigned next_random(unsigned& s)
+{
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	return s;
+}
+
+static void try_source(const ExemplarQuery& q, int x, int y, unsigned int& best_sse, int& best_x, int& best_y)
+{
+	if(!valid_source(q, x, y))
+		return;
+	unsigned int sse = patch_sse(q, x, y, best_sse);
+	if(sse < best_sse)
+	{
+		best_sse = sse;
+		best_x = x;
+		best_y = y;
+	}
+}
+
+static bool find_exemplar_patchmatch(const ExemplarQuery& q, NNField& nnf, int& best_x, int& best_y)
+{
+	static const int dx[4] = { -1, 1, 0, 0 }, dy[4] = { 0, 0, -1, 1 };
+
+	unsigned int best_sse = UINT_MAX;
+	best_x = best_y = -1;
+	int p = q.p_y*q.w + q.p_x;
+	if(nnf.x[p] >= 0)
+		try_source(q, nnf.x[p], nnf.y[p], best_sse, best_x, best_y);
+	for(int k = 0; k < 4; k++)
+	{
+		int n_x = q.p_x + dx[k], n_y = q.p_y + dy[k];
+		if(n_x < 0 || n_y < 0 || n_x >= q.w || n_y >= q.h)
+			continue;
+		int n = n_y*q.w + n_x;
+		if(nnf.x[n] >= 0)
+			try_source(q, nnf.x[n] - dx[k], nnf.y[n] - dy[k], best_sse, best_x, best_y);
+	}
+	for(int t = 0; t < PM_RANDOM_TRIES && best_x < 0; t++)
+		try_source(q, next_random(nnf.seed) % q.w, next_random(nnf.seed) % q.h, best_sse, best_x, best_y);
+	if(best_x < 0)
+		return false;
+
+	for(int r = 0; r < PM_SEARCH_ROUNDS; r++)
+		for(int radius = max(q.w, q.h); radius >= 1; radius /= 2)
+		{
+			int x = best_x + int(next_random(nnf.seed) % (2*radius + 1)) - radius;
+			int y = best_y + int(next_random(nnf.seed) % (2*radius + 1)) - radius;
+			try_source(q, x, y, best_sse, best_x, best_y);
+		}
+	nnf.x[p] = best_x;
+	nnf.y[p] = best_y;
+	return true;
+}
+
+// Local search: the source patches used for the targets recently filled
+// nearby, shifted by the targets' offset, are tried first, then every patch
+// in a window around the target. While the best one's mean squared error per
+// known pixel is over the threshold, the window is doubled, up to the whole
+// image, and the ring added to it searched. Of equal matches the one found
+// first, the nearer, is kept. The recent sources are kept in a hash table of fixed size keyed by
+// the target's cell; each bucket holds the latest few.
+
+static const int RECENT_CELL = 16;       // target cell size, pixels
+static const int RECENT_BUCKETS = 4096;  // power of 2
+static const int RECENT_WAYS = 4;        // sources kept per bucket
+
+class RecentSources
+{
+public:
+	RecentSources()
+	{
+		for(int b = 0; b < RECENT_BUCKETS; b++)
+			for(int k = 0; k < RECENT_WAYS; k++)
+				table[b][k].cx = INT_MIN;
+	}
+
+	void add(int p_x, int p_y, int x, int y)
+	{
+		int cx = p_x / RECENT_CELL, cy = p_y / RECENT_CELL;
+		Entry* e = table[bucket(cx, cy)];
+		for(int k = RECENT_WAYS - 1; k > 0; k--)
+			e[k] = e[k - 1];
+		Entry n = { cx, cy, p_x, p_y, x, y };
+		e[0] = n;
+	}
+
+	// Tries the sources used in the target's cell and the cells around it
+	void try_all(const ExemplarQuery& q, unsigned int& best_sse, int& best_x, int& best_y) const
+	{
+		int cx = q.p_x / RECENT_CELL, cy = q.p_y / RECENT_CELL;
+		for(int j = cy - 1; j <= cy + 1; j++)
+			for(int i = cx - 1; i <= cx + 1; i++)
+			{
+				const Entry* e = table[bucket(i, j)];
+				for(int k = 0; k < RECENT_WAYS; k++)
+					if(e[k].cx == i && e[k].cy == j)
+						try_source(q, e[k].x + q.p_x - e[k].p_x, e[k].y + q.p_y - e[k].p_y,
+							best_sse, best_x, best_y);
+			}
+	}
+
+	// The table as it lies in memory, for a checkpoint
+	const void* data() const	{ return table; }
+	size_t bytes() const		{ return sizeof(table); }
+	void restore(const void* saved)	{ memcpy(table, saved, sizeof(table)); }
+
+private:
+	struct Entry
+	{
+		int cx, cy;    // target cell, cx INT_MIN if empty
+		int p_x, p_y;  // target centre
+		int x, y;      // source centre copied there
+	};
+
+	static int bucket(int cx, int cy)
+	{
+		return int((unsigned(cx)*73856093u ^ unsigned(cy)*19349663u) & (RECENT_BUCKETS - 1));
+	}
+
+	Entry table[RECENT_BUCKETS][RECENT_WAYS];
+};
+
+// Number of known pixels in the target patch
+static int known_in_target(const ExemplarQuery& q)
+{
+	int n = 0;
+	for(int y = max(q.p_y - patch_size / 2, 0); y <= min(q.p_y + patch_size / 2, q.h - 1); y++)
+		for(int x = max(q.p_x - patch_size / 2, 0); x <= min(q.p_x + patch_size / 2, q.w - 1); x++)
+			n += q.known[y*q.w + x];
+	return n;
+}
+
+static bool find_exemplar_local(const ExemplarQuery& q, const CriminisiConfig& config,
+	const RecentSources& recent, int& best_x, int& best_y)
+{
+	unsigned int best_sse = UINT_MAX;
+	best_x = best_y = -1;
+	recent.try_all(q, best_sse, best_x, best_y);
+
+	double enough = config.grow_above * known_in_target(q);
+	for(int r = max(config.search_radius, 1), inner = -1; ; inner = r, r *= 2)
+	{
+		int x0 = q.p_x - r, y0 = q.p_y - r, x1 = q.p_x + r, y1 = q.p_y + r;
+		if(inner < 0)
+			search_window(q, x0, y0, x1, y1, best_sse, best_x, best_y);
+		else
+		{
+			int ix0 = q.p_x - inner, iy0 = q.p_y - inner, ix1 = q.p_x + inner, iy1 = q.p_y + inner;
+			search_window(q, x0, y0, x1, iy0 - 1, best_sse, best_x, best_y);
+			search_window(q, x0, iy0, ix0 - 1, iy1, best_sse, best_x, best_y);
+			search_window(q, ix1 + 1, iy0, x1, iy1, best_sse, best_x, best_y);
+			search_window(q, x0, iy1 + 1, x1, y1, best_sse, best_x, best_y);
+		}
+		bool whole = q.p_x - r <= 0 && q.p_y - r <= 0 && q.p_x + r >= q.w - 1 && q.p_y + r >= q.h - 1;
+		if(whole || (best_x >= 0 && (config.grow_above < 0 || best_sse <= enough)))
+			break;
+	}
+	return best_x >= 0;
+}
+
+// Descriptor search: the source patches centred on every other pixel of
+// every other row are described by the projection of their 9x9x3 pixels on
+// the first principal components. The sources with the descriptors nearest
+// to the target's, and the ones around them, get their exact SSE. The
+// unknown pixels of the target take the mean of its known ones. The sources that become valid while filling get descriptors
+// at once, but join the tree only when there are enough of them; until then
+// they are compared one by one.
+
+static const int DESCRIPTOR_SIZE = 16;
+static const int DESCRIPTOR_STEP = 2;         // between the described centres
+static const int PCA_SAMPLES = 4096;          // source patches the basis is fitted to
+static const double TREE_REBUILD_SHARE = 0.25; // sources waiting for the tree, of the ones in it
+
+class DescriptorIndex
+{
+public:
+	DescriptorIndex(const ExemplarQuery& q, const CriminisiConfig& config)
+		: tree(make_point_index(config.index_kind)), candidates(max(config.candidates, 1)),
+		builds(0), queries(0), build_time(0), query_time(0)
+	{
+		double t = get_time_secs();
+		vector<int> all;
+		for(int y = 0; y < q.h; y += DESCRIPTOR_STEP)
+		{
+			const vector<int>& xs = q.sources->row(y);
+			for(size_t k = 0; k < xs.size(); k++)
+				if(xs[k] % DESCRIPTOR_STEP == 0)
+					all.push_back(y*q.w + xs[k]);
+		}
+		int step = max(int(all.size()) / PCA_SAMPLES, 1);
+		vector<float> samples;
+		for(size_t k = 0; k < all.size(); k += step)
+		{
+			samples.resize(samples.size() + PATCH_VALUES);
+			read_patch(q, all[k], &samples[samples.size() - PATCH_VALUES]);
+		}
+		pca.fit(samples.empty() ? 0 : &samples[0], int(samples.size() / PATCH_VALUES),
+			PATCH_VALUES, DESCRIPTOR_SIZE);
+		build_time += get_time_secs() - t;
+		add(q, all);
+	}
 
-Image* inpaint_criminisi(const Image* image, const Image* mask)
+	// The index of a checkpoint, as save() left it, or 0 if 'saved' isn't one
+	static DescriptorIndex* restore(const void* saved, size_t size, const CriminisiConfig& config)
+	{
+		int counts[4];  // PCA dimensions and components, sources in the tree and waiting for it
+		if(size < sizeof(counts))
+			return 0;
+		memcpy(counts, saved, sizeof(counts));
+		int dims = counts[0], components = counts[1];
+		if(dims != PATCH_VALUES || components != DESCRIPTOR_SIZE || counts[2] < 0 || counts[3] < 0 ||
+			size != sizeof(counts) + ((1 + components) * dims + size_t(counts[2] + counts[3]) *
+				(components + 1)) * sizeof(float))
+			return 0;
+		DescriptorIndex* index = new DescriptorIndex(config);
+		const char* p = (const char*)saved + sizeof(counts);
+		const float* mean = take<float>(p, dims);
+		const float* basis = take<float>(p, components * dims);
+		index->pca.restore(mean, basis, dims, components);
+		const float* desc = take<float>(p, counts[2] * components);
+		const int* centre = take<int>(p, counts[2]);
+		const float* pending = take<float>(p, counts[3] * components);
+		const int* pending_centre = take<int>(p, counts[3]);
+		index->desc.assign(desc, desc + counts[2] * components);
+		index->centre.assign(centre, centre + counts[2]);
+		index->pending.assign(pending, pending + counts[3] * components);
+		index->pending_centre.assign(pending_centre, pending_centre + counts[3]);
+		index->tree->build(index->desc.empty() ? 0 : &index->desc[0], counts[2], components);
+		return index;
+	}
+
+	~DescriptorIndex()
+	{
+		delete tree;
+	}
+
+	// The state of the index, for a checkpoint: the tree is built again from it
+	void save(vector<char>& out) const
+	{
+		int counts[4] = { pca.dimensions(), pca.size(), int(centre.size()), int(pending_centre.size()) };
+		out.clear();
+		put(out, counts, 4);
+		put(out, pca.average(), pca.dimensions());
+		put(out, pca.vectors(), pca.size() * pca.dimensions());
+		put(out, desc.empty() ? 0 : &desc[0], desc.size());
+		put(out, centre.empty() ? 0 : &centre[0], centre.size());
+		put(out, pending.empty() ? 0 : &pending[0], pending.size());
+		put(out, pending_centre.empty() ? 0 : &pending_centre[0], pending_centre.size());
+	}
+
+	// Describes the new sources, rebuilds the tree if there are many
+	void add(const ExemplarQuery& q, const vector<int>& sources)
+	{
+		double t = get_time_secs();
+		float v[PATCH_VALUES];
+		for(size_t k = 0; k < sources.size(); k++)
+		{
+			if(sources[k] % q.w % DESCRIPTOR_STEP || sources[k] / q.w % DESCRIPTOR_STEP)
+				continue;
+			read_patch(q, sources[k], v);
+			pending.resize(pending.size() + DESCRIPTOR_SIZE);
+			pca.project(v, &pending[pending.size() - DESCRIPTOR_SIZE]);
+			pending_centre.push_back(sources[k]);
+		}
+		if(pending_centre.size() > TREE_REBUILD_SHARE * centre.size())
+		{
+			desc.insert(desc.end(), pending.begin(), pending.end());
+			centre.insert(centre.end(), pending_centre.begin(), pending_centre.end());
+			pending.clear();
+			pending_centre.clear();
+			tree->build(desc.empty() ? 0 : &desc[0], int(centre.size()), DESCRIPTOR_SIZE);
+			builds++;
+		}
+		build_time += get_time_secs() - t;
+	}
+
+	bool find(const ExemplarQuery& q, int& best_x, int& best_y)
+	{
+		double t = get_time_secs();
+		queries++;
+		float v[PATCH_VALUES], d[DESCRIPTOR_SIZE];
+		bool known[patch_size * patch_size];
+		double sum[3] = { 0, 0, 0 };
+		int count = 0;
+		for(int j = -patch_size / 2, n = 0; j <= patch_size / 2; j++)
+			for(int i = -patch_size / 2; i <= patch_size / 2; i++, n++)
+			{
+				int x = q.p_x + i, y = q.p_y + j;
+				known[n] = x >= 0 && y >= 0 && x < q.w && y < q.h && q.known[y*q.w + x];
+				for(int c = 0; c < 3; c++)
+				{
+					v[n*3 + c] = known[n] ? q.buf[(y*q.w + x)*4 + c] : 0;
+					sum[c] += v[n*3 + c];
+				}
+				count += known[n];
+			}
+		for(int n = 0; n < patch_size * patch_size; n++)
+			if(!known[n])
+				for(int c = 0; c < 3; c++)
+					v[n*3 + c] = float(sum[c] / max(count, 1));
+		pca.project(v, d);
+
+		// the nearest ones in the tree and among those waiting for it
+		tree->nearest(d, candidates, found);
+		for(size_t k = 0; k < found.size(); k++)
+			found[k] = centre[found[k]];
+		waiting.clear();
+		for(size_t k = 0; k < pending_centre.size(); k++)
+		{
+			float dist = 0;
+			for(int i = 0; i < DESCRIPTOR_SIZE; i++)
+				dist += (pending[k*DESCRIPTOR_SIZE + i] - d[i]) * (pending[k*DESCRIPTOR_SIZE + i] - d[i]);
+			waiting.push_back(make_pair(dist, pending_centre[k]));
+		}
+		if(int(waiting.size()) > candidates)
+			nth_element(waiting.begin(), waiting.begin() + candidates, waiting.end());
+		for(size_t k = 0; k < waiting.size() && int(k) < candidates; k++)
+			found.push_back(waiting[k].second);
+
+		// and the ones around them, in row by row order, so that of equal
+		// SSEs the first is kept
+		near.clear();
+		for(size_t k = 0; k < found.size(); k++)
+			for(int j = -DESCRIPTOR_STEP / 2; j <= DESCRIPTOR_STEP / 2; j++)
+				for(int i = -DESCRIPTOR_STEP / 2; i <= DESCRIPTOR_STEP / 2; i++)
+					near.push_back(found[k] + j*q.w + i);
+		found.swap(near);
+		sort(found.begin(), found.end());
+		found.erase(unique(found.begin(), found.end()), found.end());
+		unsigned int best_sse = UINT_MAX;
+		best_x = best_y = -1;
+		for(size_t k = 0; k < found.size(); k++)
+			if(found[k] >= 0)
+				try_source(q, found[k] % q.w, found[k] / q.w, best_sse, best_x, best_y);
+		query_time += get_time_secs() - t;
+		return best_x >= 0;
+	}
+
+	void report() const
+	{
+		printf("descriptor index: %d builds %.3f s, %d queries %.3f s\n",
+			builds, build_time, queries, query_time);
+	}
+
+private:
+	static const int PATCH_VALUES = patch_size * patch_size * 3;
+
+	DescriptorIndex(const CriminisiConfig& config)
+		: tree(make_point_index(config.index_kind)), candidates(max(config.candidates, 1)),
+		builds(0), queries(0), build_time(0), query_time(0)
+	{
+	}
+
+	template <class T> static void put(vector<char>& out, const T* data, size_t n)
+	{
+		size_t at = out.size();
+		out.resize(at + n * sizeof(T));
+		if(n)
+			memcpy(&out[at], data, n * sizeof(T));
+	}
+
+	// The next n values of a saved index, which is mapped at an aligned
+	// address and holds nothing but ints and floats
+	template <class T> static const T* take(const char*& p, size_t n)
+	{
+		const T* data = (const T*)p;
+		p += n * sizeof(T);
+		return data;
+	}
+
+	static void read_patch(const ExemplarQuery& q, int centre, float* v)
+	{
+		int x0 = centre % q.w - patch_size / 2, y0 = centre / q.w - patch_size / 2;
+		for(int j = 0, n = 0; j < patch_size; j++)
+		{
+			const uchar* p = &q.buf[((y0 + j)*q.w + x0)*4];
+			for(int i = 0; i < patch_size; i++, n += 3, p += 4)
+			{
+				v[n + 0] = p[0];
+				v[n + 1] = p[1];
+				v[n + 2] = p[2];
+			}
+		}
+	}
+
+	PCA pca;
+	PointIndex* tree;
+	int candidates;
+	vector<float> desc;              // descriptors of the sources in the tree
+	vector<int> centre;              // and their centres, y*w + x
+	vector<float> pending;           // the same for the ones waiting for it
+	vector<int> pending_centre;
+	vector<int> found, near;
+	vector<pair<float, int> > waiting;
+	int builds, queries;
+	double build_time, query_time;
+};
+
+// One of the target patches filled in an iteration
+struct FillJob
+{
+	ExemplarQuery q;
+	double confidence;  // C of the target
+	int best_x, best_y;
+	bool found;
+};
+
+struct BatchSearch
+{
+	vector<FillJob>* jobs;
+	const CriminisiConfig* config;
+	const RecentSources* recent;
+};
+
+// Exhaustive and local searches only read the image, so the patches of a
+// batch are looked for in parallel
+static void search_batch(int lo, int hi, void* arg)
+{
+	BatchSearch* b = (BatchSearch*)arg;
+	for(int k = lo; k < hi; k++)
+	{
+		FillJob& job = (*b->jobs)[k];
+		if(job.found)
+			continue;
+		if(b->config->search == SEARCH_LOCAL)
+			job.found = find_exemplar_local(job.q, *b->config, *b->recent, job.best_x, job.best_y);
+		else
+			job.found = find_exemplar_exhaustive(job.q, job.best_x, job.best_y);
+	}
+}
+
+// Multi-scale mode: at the finer levels, the source of every target is
+// first looked for around the one its parent pixel was filled from at the
+// coarser level, scaled up
+
+struct GuidedSearch
+{
+	vector<FillJob>* jobs;
+	const NNField* guide;  // of the coarser level
+	int radius;
+};
+
+static void search_guided(int lo, int hi, void* arg)
+{
+	GuidedSearch* g = (GuidedSearch*)arg;
+	for(int k = lo; k < hi; k++)
+	{
+		FillJob& job = (*g->jobs)[k];
+		const ExemplarQuery& q = job.q;
+		int cx = min(q.p_x / 2, g->guide->w - 1), cy = min(q.p_y / 2, g->guide->h - 1);
+		int c = cy*g->guide->w + cx;
+		if(g->guide->x[c] < 0)
+			continue;
+		int sx = 2*g->guide->x[c] + q.p_x - 2*cx, sy = 2*g->guide->y[c] + q.p_y - 2*cy;
+		unsigned int best_sse = UINT_MAX;
+		job.found = search_window(q, sx - g->radius, sy - g->radius, sx + g->radius, sy + g->radius,
+			best_sse, job.best_x, job.best_y);
+	}
+}
+
+// The state of the fill kept in a checkpoint: everything else is found again
+// from SourceRegion, C and the isophotes when resuming
+enum CriminisiSection
+{
+	CRIMINISI_PIXELS = 1,	// rows: the result, SourceRegion, C, the isophotes,
+	CRIMINISI_SOURCE,
+	CRIMINISI_CONFIDENCE,
+	CRIMINISI_IX,
+	CRIMINISI_IY,
+	CRIMINISI_NNF_X,	// and the nearest neighbour field of PatchMatch
+	CRIMINISI_NNF_Y,
+	CRIMINISI_SEED,		// blobs: PatchMatch's random state,
+	CRIMINISI_RECENT,	// the recent sources of the local search,
+	CRIMINISI_INDEX,	// the descriptor index, empty until it is made
+	CRIMINISI_ROWS = 7
+};
+
+static const size_t criminisi_pixel_bytes[CRIMINISI_ROWS] =
+	{ 4, sizeof(bool), sizeof(double), sizeof(float), sizeof(float), sizeof(int), sizeof(int) };
+
+// The parts of the state a fill has, other than the rows
+struct CriminisiSearchState
+{
+	NNField* nnf;			// PatchMatch
+	RecentSources* recent;		// SEARCH_LOCAL
+	DescriptorIndex** descriptors;	// SEARCH_DESCRIPTORS
+};
+
+// Nothing is taken from the file unless all of the state is there
+static bool resume_criminisi(const char* path, unsigned long long key, int w, int h,
+	void* const* rows, int n_rows, const CriminisiSearchState& state, const CriminisiConfig& config)
+{
+	CheckpointReader file;
+	if(!file.open(path, CHECKPOINT_CRIMINISI, key, w, h))
+		return false;
+	const void* saved[CRIMINISI_ROWS];
+	for(int k = 0; k < n_rows; k++)
+	{
+		size_t size;
+		saved[k] = file.section(CRIMINISI_PIXELS + k, &size);
+		if(!saved[k] || size != criminisi_pixel_bytes[k] * w * h)
+			return false;
+	}
+	size_t seed_size, recent_size, index_size;
+	const void* seed = file.section(CRIMINISI_SEED, &seed_size);
+	const void* recent = file.section(CRIMINISI_RECENT, &recent_size);
+	const void* index = file.section(CRIMINISI_INDEX, &index_size);
+	if(state.nnf && (!seed || seed_size != sizeof(state.nnf->seed)))
+		return false;
+	if(state.recent && (!recent || recent_size != state.recent->bytes()))
+		return false;
+	DescriptorIndex* descriptors = 0;
+	if(state.descriptors)
+	{
+		if(!index)
+			return false;
+		if(index_size && !(descriptors = DescriptorIndex::restore(index, index_size, config)))
+			return false;
+	}
+
+	for(int k = 0; k < n_rows; k++)
+		memcpy(rows[k], saved[k], criminisi_pixel_bytes[k] * w * h);
+	if(state.nnf)
+		memcpy(&state.nnf->seed, seed, sizeof(state.nnf->seed));
+	if(state.recent)
+		state.recent->restore(recent);
+	if(state.descriptors)
+		*state.descriptors = descriptors;
+	return true;
+}
+
+// One scale of the inpaint. With 'guide', the NNF of the level half as large,
+// the searches start from it; into 'filled_from' go the source pixels of the
+// pixels filled.
+static Image* criminisi_fill(const Image* image, const Image* mask, const CriminisiConfig& config,
+	const NNField* guide, NNField* filled_from)
 {
 	assert(image->buffer_width() == mask->buffer_width());
 	assert(image->buffer_height() == mask->buffer_height());
@@ -102,175 +993,332 @@ Image* inpaint_criminisi(const Image* image, const Image* mask)
 				C[i*w+j] = 1;
 			}
 
-	// calculate transposed gradient
-	Image* ix = gradientX(image);
-	Image* iy = gradientY(image);
-	double* Ix = new double[picsize];
-	double* Iy = new double[picsize];
-	uchar *xbuf = ix->buffer(), *ybuf = iy->buffer();
-	for(int i = 0; i < h; i++)
-		for(int j = 0; j < w; j++)
+	// calculate gradient
+	float* Ix = new float[picsize];
+	float* Iy = new float[picsize];
+	sobel_gradient(image->buffer(), w, h, Ix, Iy);
+
+	NNField own_nnf;
+	NNField& nnf = filled_from ? *filled_from : own_nnf;
+	if(config.search == SEARCH_PATCHMATCH || filled_from)
+	{
+		nnf.w = w;
+		nnf.h = h;
+		nnf.x.assign(picsize, -1);
+		nnf.y.assign(picsize, -1);
+		nnf.seed = 2463534242u;
+	}
+	RecentSources* recent = config.search == SEARCH_LOCAL ? new RecentSources : 0;  // 384 KB
+	DescriptorIndex* descriptors = 0;  // made when first needed
+	vector<int> new_sources;
+
+	// Only the full size fill is checkpointed, the others are quick. Along
+	// with the pixels goes the state of the search, so that a resumed fill
+	// makes the same choices as one that never stopped.
+	const CheckpointConfig& checkpoint = config.checkpoint;
+	bool full_size = !filled_from;
+	CheckpointWriter* saver = 0;
+	CriminisiSearchState search_state = { config.search == SEARCH_PATCHMATCH ? &nnf : 0, recent,
+		config.search == SEARCH_DESCRIPTORS ? &descriptors : 0 };
+	vector<char> saved_index;
+	if(full_size && checkpoint.path)
+	{
+		// every setting that changes the result, folded in one at a time
+		long long settings[] = { patch_size, config.search, config.index_kind, config.candidates,
+			config.levels, config.nnf_radius, config.batch, config.search_radius,
+			(long long)(config.grow_above * 1000) };
+		unsigned long long salt = 0;
+		for(size_t k = 0; k < sizeof(settings) / sizeof(settings[0]); k++)
+			salt = salt * 1099511628211ULL ^ (unsigned long long)settings[k];
+		unsigned long long key = checkpoint_key(image, mask, salt);
+		void* rows[CRIMINISI_ROWS] = { res->buffer(), SourceRegion, C, Ix, Iy, 0, 0 };
+		int n_rows = CRIMINISI_NNF_X - CRIMINISI_PIXELS;
+		if(search_state.nnf)
 		{
-			int idx = i*w*4 + j*4;
-			Ix[j*h + i] = (xbuf[idx]+xbuf[idx+1]+xbuf[idx+2]) / (3. * 255.);
-			Iy[j*h + i] = (ybuf[idx]+ybuf[idx+1]+ybuf[idx+2]) / (3. * 255.);
+			rows[n_rows++] = &nnf.x[0];
+			rows[n_rows++] = &nnf.y[0];
 		}
-	delete iy; delete ix;
+		if(checkpoint.resume && resume_criminisi(checkpoint.path, key, w, h, rows, n_rows, search_state, config) &&
+			!config.quiet)
+			printf("criminisi: resumed from %s\n", checkpoint.path);
+		saver = new CheckpointWriter(checkpoint.path, CHECKPOINT_CRIMINISI, key, w, h, checkpoint.every);
+		for(int k = 0; k < n_rows; k++)
+			saver->add_rows(CRIMINISI_PIXELS + k, rows[k], criminisi_pixel_bytes[k] * w);
+		if(search_state.nnf)
+			saver->add_blob(CRIMINISI_SEED);
+		if(search_state.recent)
+			saver->add_blob(CRIMINISI_RECENT);
+		if(search_state.descriptors)
+			saver->add_blob(CRIMINISI_INDEX);
+	}
+	bool stopped = false;
+
+	SourceIndex sources(SourceRegion, w, h);
+	if(descriptors)
+		sources.track(&new_sources);
 
-	vector<coord> dOmega;
-	Image* dR = new Image;
-	dR->setsize(w, h);
+	FillFront dOmega(w, h);
+	vector<char> on_dOmega(picsize);
+	vector<pair<double, double> > N(picsize);
+	update_front(SourceRegion, w, h, 0, 0, w, h, on_dOmega, N, dOmega);
+	update_priorities(C, Ix, Iy, w, h, 0, 0, w, h, on_dOmega, N, dOmega);
+	int batch = max(config.batch, 1);
+	vector<FillJob> jobs;
+	vector<int> skipped;
+	vector<uchar> pixels;  // the source patches of a batch
+	vector<float> isophotes;
+	const int patch_area = patch_size * patch_size;
 	for(;;)
 	{
-		// Update fill front
-		uchar whitepix[4];
-		uchar blackpix[4];
-		whitepix[0] = whitepix[1] = whitepix[2] = 255;
-		whitepix[3] = blackpix[0] = blackpix[1] = blackpix[2] = blackpix[3] = 0;
-		for(int i = 0; i < h; i++)
-			for(int j = 0; j < w; j++)
-				if(SourceRegion[i*w+j])
-					dR->setpixels(&whitepix[0], Rectangle(j, i, 1, 1));
-				else
-					dR->setpixels(&blackpix[0], Rectangle(j, i, 1, 1));
-		double edgedet[9] = { 1, 1, 1, 1, -8, 1, 1, 1, 1 };
-		Image* edges = filter(edgedet, 3, 3, dR);
-		dOmega.clear();
-		for(int j = 0; j < w; j++)
-			for(int i = 0; i < h; i++)
-				if(edges->buffer()[i*w*4+j*4] > 0)
-					dOmega.push_back(coord(j, i));
-
 		if(dOmega.empty())
 			break;
-		printf("%d points left\n", dOmega.size());
-		
-		double* Nx = conv(SourceRegion, w, h, x_gradient_kernel);
-		double* Ny = conv(SourceRegion, w, h, y_gradient_kernel);
-		vector<pair<double, double>> N;
-		for(size_t i = 0; i < dOmega.size(); i++)
-		{
-			pair<double, double> p;
-			p.first  = Nx[dOmega[i].second*w + dOmega[i].first];
-			p.second = Ny[dOmega[i].second*w + dOmega[i].first];
-			N.push_back(p);
-		}
-//		delete Ny; delete Nx;
-		for(size_t i = 0; i < N.size(); i++)
+		if(!config.quiet)
+			printf("%d points left\n", int(dOmega.size()));
+		stopped = full_size && checkpoint.stop && *checkpoint.stop;
+		if(saver && (stopped || saver->due()))
 		{
-			double factor = sqrt(N[i].first*N[i].first + N[i].second*N[i].second);
-			if(factor != 0)
+			// the blobs, in the order they were added
+			const void* blobs[3];
+			size_t sizes[3];
+			int n = 0;
+			if(search_state.nnf)
+			{
+				blobs[n] = &nnf.seed;
+				sizes[n++] = sizeof(nnf.seed);
+			}
+			if(recent)
+			{
+				blobs[n] = recent->data();
+				sizes[n++] = recent->bytes();
+			}
+			if(search_state.descriptors)
 			{
-				N[i].first  /= factor;
-				N[i].second /= factor;
+				saved_index.clear();
+				if(descriptors)
+					descriptors->save(saved_index);
+				blobs[n] = saved_index.empty() ? 0 : &saved_index[0];
+				sizes[n++] = saved_index.size();
 			}
+			saver->snapshot(blobs, sizes);
 		}
+		if(stopped)
+			break;
 
-		// Compute priorities for all points from front,
-		//  find the patch with maximum priority
-		double max_priority = 0;
-		size_t phi_p = -1;
-		double new_confidence;
-		for(size_t p = 0; p < dOmega.size(); p++)
+		// The patches with maximum priority, up to 'batch' of them not
+		// overlapping each other
+		jobs.clear();
+		skipped.clear();
+		while(int(jobs.size()) < batch && !dOmega.empty() && int(skipped.size()) < 8*batch)
 		{
-			// calculate confidence term
-			double c = 0;
-			for(int x = dOmega[p].first - patch_size / 2; x < dOmega[p].first + patch_size / 2; x++)
-				for(int y = dOmega[p].second - patch_size / 2; y < dOmega[p].second + patch_size / 2; y++)
-					if(x > 0 && y > 0 && x < w && y < h)
-						c += C[y*w + x];
-			c /= (patch_size * patch_size);
-
-			// calculate data term
-			double d = abs(Ix[dOmega[p].second * w + dOmega[p].first] * N[p].first + 
-				Iy[dOmega[p].second * w + dOmega[p].first] * N[p].second) + 0.001;
-
-			double P = c * d;
-			if(P > max_priority)
+			int top = dOmega.top();
+			int p_x = top % w, p_y = top / w;
+			bool overlaps = false;
+			for(size_t k = 0; k < jobs.size() && !overlaps; k++)
+				overlaps = abs(jobs[k].q.p_x - p_x) < patch_size && abs(jobs[k].q.p_y - p_y) < patch_size;
+			if(overlaps)
+				skipped.push_back(top);
+			else
 			{
-				max_priority = P;
-				phi_p = p;
-				new_confidence = c;
+				FillJob job = { { res->buffer(), SourceRegion, &sources, w, h, p_x, p_y },
+					dOmega.confidence(top), -1, -1, false };
+				jobs.push_back(job);
 			}
+			dOmega.remove(top);
 		}
+		for(size_t k = 0; k < skipped.size(); k++)
+			dOmega.set(skipped[k], dOmega.priority(skipped[k]), dOmega.confidence(skipped[k]));
 
-		// Find the exemplar that minimizes distance
-		int p_x = dOmega[phi_p].first;
-		int p_y = dOmega[phi_p].second;
-		double best_sse = DBL_MAX;
-		int best_x, best_y;
-		for(int y = patch_size / 2; y < h - patch_size / 2; y++)
-			for(int x = patch_size / 2; x < w - patch_size / 2; x++)
-			{
-				if(abs(p_x - x) <= patch_size || abs(p_y - y) <= patch_size)
-					goto bad_patch;
-				double sse = 0;
-				for(int i = -patch_size / 2; i <= patch_size / 2; i++)
-					for(int j = -patch_size / 2; j <= patch_size / 2; j++)
-					{
-						int x_idx = x + i;
-						int y_idx = y + j;
-
-						if(!SourceRegion[y_idx * w + x_idx])
-							goto bad_patch;
-						if(p_x + i >= w || p_y + j >= h)
-							continue;
-						if(SourceRegion[(p_y + j)*w + p_x + i])
-						{
-							uchar* p1 = &res->buffer()[y_idx*w*4+x_idx*4];
-							uchar* p2 = &res->buffer()[(p_y+j)*w*4+(p_x+i)*4];
-							sse += (double(p1[0]-p2[0])*double(p1[0]-p2[0])+
-								double(p1[1]-p2[1])*double(p1[1]-p2[1])+
-								double(p1[2]-p2[2])*double(p1[2]-p2[2]));
-						}
-					}
-				if(sse < best_sse)
+		// Find the exemplars that minimize distance. They are all searched
+		// for, and copied from, the image as it was before the batch.
+		if(guide)
+		{
+			GuidedSearch g = { &jobs, guide, max(config.nnf_radius, 0) };
+			parallel_for(0, int(jobs.size()), 1, search_guided, &g);
+		}
+		if(config.search == SEARCH_DESCRIPTORS && !descriptors)
+			for(size_t k = 0; k < jobs.size() && !descriptors; k++)
+				if(!jobs[k].found)
 				{
-					best_sse = sse;
-					best_x = x;
-					best_y = y;
+					ExemplarQuery q = { res->buffer(), SourceRegion, &sources, w, h, 0, 0 };
+					descriptors = new DescriptorIndex(q, config);
+					sources.track(&new_sources);
 				}
-bad_patch:		sse = 0;
+		if(config.search == SEARCH_PATCHMATCH)
+		{
+			for(size_t k = 0; k < jobs.size(); k++)
+				if(!jobs[k].found)
+					jobs[k].found = find_exemplar_patchmatch(jobs[k].q, nnf, jobs[k].best_x, jobs[k].best_y) ||
+						find_exemplar_exhaustive(jobs[k].q, jobs[k].best_x, jobs[k].best_y);
 		}
-	
-		// Copy image data from it
-		const uchar* image_buffer = res->buffer();
-		for(int i = -patch_size / 2; i <= patch_size / 2; i++)
+		else if(config.search == SEARCH_DESCRIPTORS)
 		{
-			for(int j = -patch_size / 2; j <= patch_size / 2; j++)
+			for(size_t k = 0; k < jobs.size(); k++)
+				if(!jobs[k].found)
+					jobs[k].found = descriptors->find(jobs[k].q, jobs[k].best_x, jobs[k].best_y) ||
+						find_exemplar_exhaustive(jobs[k].q, jobs[k].best_x, jobs[k].best_y);
+		}
+		else
+		{
+			BatchSearch b = { &jobs, &config, recent };
+			parallel_for(0, int(jobs.size()), 1, search_batch, &b);
+		}
+		bool any = false;
+		for(size_t k = 0; k < jobs.size(); k++)
+			if(jobs[k].found)
 			{
-				int x_idx = best_x + i;
-				int y_idx = best_y + j;
-				if(p_x+i >= w || p_y+j >= h)
-					continue;
-				uchar newpix[4];
-				newpix[0] = image_buffer[y_idx*w*4+x_idx*4];
-				newpix[1] = image_buffer[y_idx*w*4+x_idx*4+1];
-				newpix[2] = image_buffer[y_idx*w*4+x_idx*4+2];
-				newpix[3] = 0;
-				res->setpixels(&newpix[0], Rectangle(p_x+i, p_y+j, 1, 1));
-				SourceRegion[(p_y+j)*w+p_x+i] = true;
+				any = true;
+				if(config.search == SEARCH_LOCAL)
+					recent->add(jobs[k].q.p_x, jobs[k].q.p_y, jobs[k].best_x, jobs[k].best_y);
 			}
-		}
-
-		// Update confidence values
-		for(int i = -patch_size / 2; i <= patch_size / 2; i++)
-			for(int j = -patch_size / 2; j <= patch_size / 2; j++)
+			else  // back to the front, for the next batch
 			{
-				int x_idx = p_x + i;
-				int y_idx = p_y + j;
-				C[y_idx*w+x_idx] = new_confidence;
+				int idx = jobs[k].q.p_y*w + jobs[k].q.p_x;
+				dOmega.set(idx, dOmega.priority(idx), dOmega.confidence(idx));
 			}
+		if(!any)
+			break;  // no patch left to copy from
+
+		// Read the source patches
+		const uchar* image_buffer = res->buffer();
+		pixels.resize(jobs.size() * patch_area * 4);
+		isophotes.resize(jobs.size() * patch_area * 2);
+		for(size_t k = 0; k < jobs.size(); k++)
+		{
+			if(!jobs[k].found)
+				continue;
+			int best_x = jobs[k].best_x, best_y = jobs[k].best_y;
+			for(int i = -patch_size / 2; i <= patch_size / 2; i++)
+				for(int j = -patch_size / 2; j <= patch_size / 2; j++)
+				{
+					int n = int(k)*patch_area + (j + patch_size / 2)*patch_size + i + patch_size / 2;
+					int idx = (best_y+j)*w + best_x+i;
+					pixels[n*4 + 0] = image_buffer[idx*4];
+					pixels[n*4 + 1] = image_buffer[idx*4+1];
+					pixels[n*4 + 2] = image_buffer[idx*4+2];
+					pixels[n*4 + 3] = 0;
+					isophotes[n*2 + 0] = Ix[idx];
+					isophotes[n*2 + 1] = Iy[idx];
+				}
+		}
+
+		for(size_t k = 0; k < jobs.size(); k++)
+		{
+			if(!jobs[k].found)
+				continue;
+			int p_x = jobs[k].q.p_x, p_y = jobs[k].q.p_y;
+			int best_x = jobs[k].best_x, best_y = jobs[k].best_y;
+			if(saver)
+				saver->touch(p_y - patch_size / 2, p_y + patch_size / 2 + 1);
 
-		// Propagate isophote values
-		for(int i = -patch_size / 2; i <= patch_size / 2; i++)
-			for(int j = -patch_size / 2; j <= patch_size / 2; j++)
+			// Copy image data, confidence and isophote values into the patch
+			for(int i = -patch_size / 2; i <= patch_size / 2; i++)
 			{
-				int x_idx = p_x + i;
-				int y_idx = p_y + j;
-				Ix[y_idx*w+x_idx] = Ix[(best_y+j)*w+best_x+i];
-				Iy[y_idx*w+x_idx] = Iy[(best_y+j)*w+best_x+i];
+				for(int j = -patch_size / 2; j <= patch_size / 2; j++)
+				{
+					if(p_x+i < 0 || p_y+j < 0 || p_x+i >= w || p_y+j >= h)
+						continue;
+					int n = int(k)*patch_area + (j + patch_size / 2)*patch_size + i + patch_size / 2;
+					int idx = (p_y+j)*w + p_x+i;
+					res->setpixels(&pixels[n*4], Rectangle(p_x+i, p_y+j, 1, 1));
+					if(!SourceRegion[idx])
+					{
+						SourceRegion[idx] = true;
+						sources.fill(p_x+i, p_y+j);
+					}
+					if(!nnf.x.empty())
+					{
+						nnf.x[idx] = best_x + i;
+						nnf.y[idx] = best_y + j;
+					}
+					C[idx] = jobs[k].confidence;
+					Ix[idx] = isophotes[n*2 + 0];
+					Iy[idx] = isophotes[n*2 + 1];
+				}
 			}
+		}
+
+		// Only the pixels around the patches can enter or leave the front,
+		// and only the front pixels whose patch overlaps one change priority
+		if(descriptors)
+		{
+			descriptors->add(jobs[0].q, new_sources);
+			new_sources.clear();
+		}
+
+		for(size_t k = 0; k < jobs.size(); k++)
+		{
+			if(!jobs[k].found)
+				continue;
+			int p_x = jobs[k].q.p_x, p_y = jobs[k].q.p_y;
+			update_front(SourceRegion, w, h, p_x - patch_size / 2 - 1, p_y - patch_size / 2 - 1,
+				patch_size + 2, patch_size + 2, on_dOmega, N, dOmega);
+		}
+		for(size_t k = 0; k < jobs.size(); k++)
+		{
+			if(!jobs[k].found)
+				continue;
+			int p_x = jobs[k].q.p_x, p_y = jobs[k].q.p_y;
+			update_priorities(C, Ix, Iy, w, h, p_x - patch_size + 1, p_y - patch_size + 1,
+				2*patch_size - 1, 2*patch_size - 1, on_dOmega, N, dOmega);
+		}
+	}
+
+	if(saver)
+	{
+		saver->finish();
+		if(!config.quiet)
+			printf("criminisi: %d checkpoints, the fill stopped for %.1f ms at most\n",
+				saver->written(), saver->longest_stop() * 1000);
+		delete saver;
+		if(!stopped)
+			remove(checkpoint.path);
+	}
+	if(descriptors && !config.quiet)
+		descriptors->report();
+	delete descriptors;
+	delete recent;
+	delete[] Iy; delete[] Ix;
+	delete[] SourceRegion; delete[] C;
+	return res;
+}
+
+Image* inpaint_criminisi(const Image* image, const Image* mask, const CriminisiConfig& config,
+	vector<double>* level_seconds)
+{
+	if(level_seconds)
+		level_seconds->clear();
+	int levels = config.levels < 0 ? pyramid_depth(mask, CRIMINISI_COARSE_HOLE) : config.levels;
+	if(levels == 0)
+	{
+		double t = get_time_secs();
+		Image* res = criminisi_fill(image, mask, config, 0, 0);
+		if(level_seconds)
+			level_seconds->push_back(get_time_secs() - t);
+		return res;
+	}
+
+	// The coarsest level is filled by the configured search alone, the
+	// finer ones starting from the NNF of the level below
+	vector<PyramidLevel> pyr;
+	build_pyramid(image, mask, levels, pyr);
+	NNField guide, nnf;
+	Image* res = 0;
+	for(int l = levels; l >= 0; l--)
+	{
+		double t = get_time_secs();
+		delete res;
+		if(l)
+		{
+			Image* im = pyramid_image(pyr[l]);
+			Image* m = pyramid_mask(pyr[l]);
+			res = criminisi_fill(im, m, config, l < levels ? &guide : 0, &nnf);
+			delete m; delete im;
+		}
+		else
+			res = criminisi_fill(image, mask, config, &guide, 0);
+		swap(guide, nnf);
+		if(level_seconds)
+			level_seconds->push_back(get_time_secs() - t);
 	}
 	return res;
 }
\ No newline at end of file
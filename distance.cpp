@@ -0,0 +1,301 @@
+
+#include <cmath>
+#include <vector>
+
+#include "genrl.h"
+#include "distance.h"
+#include "parallel.h"
+
+using namespace std;
+
+
+// Box of the field the distance backends work on: the bounding box of the
+// zone grown by the band width. All features that matter for it lie inside
+// the box, and the pixels outside of it are never read by the inpainting.
+struct DistanceBox
+{
+	int x0, y0;  // top left corner in the field
+	int w, h;
+};
+
+static bool in_zone(float v, float k)		{ return (k>0 && v<k) || (k<0 && v>-k); }	//ALIVE for FLAGS(f,k)
+static bool outside_zone(float v, float k)	{ return (k<0 && v<-k) || (k>0 && v>k); }	//ALIVE for FLAGS(f,-k)
+
+static bool zone_box(FIELD<float>* fi, float k, float maxd, DistanceBox& b)
+{
+	int nx = fi->dimX(), ny = fi->dimY();
+	const float* in = fi->data();
+	int x0 = nx, y0 = ny, x1 = -1, y1 = -1;
+	for(int j = 0; j < ny; j++)
+		for(int i = 0; i < nx; i++)
+		{
+			if(!in_zone(in[j*nx + i], k))
+				continue;
+			if(i < x0) x0 = i;
+			if(i > x1) x1 = i;
+			if(j < y0) y0 = j;
+			if(j > y1) y1 = j;
+		}
+	if(x1 < 0)
+		return false;
+
+	int margin = int(maxd) + 2;
+	x0 = x0 - margin < 0 ? 0 : x0 - margin;
+	y0 = y0 - margin < 0 ? 0 : y0 - margin;
+	x1 = x1 + margin >= nx ? nx - 1 : x1 + margin;
+	y1 = y1 + margin >= ny ? ny - 1 : y1 + margin;
+	b.x0 = x0;
+	b.y0 = y0;
+	b.w = x1 - x0 + 1;
+	b.h = y1 - y0 + 1;
+	return true;
+}
+
+// Initializes both transforms over the box: 0 on their features, 'far' elsewhere
+static void seed_box(FIELD<float>* fi, float k, const DistanceBox& b, float* to_zone, float* to_outside, float far)
+{
+	const float* in = fi->data();
+	for(int j = 0; j < b.h; j++)
+		for(int i = 0; i < b.w; i++)
+		{
+			float v = in[(b.y0 + j)*fi->dimX() + b.x0 + i];
+			to_zone[j*b.w + i] = in_zone(v, k) ? 0 : far;
+			to_outside[j*b.w + i] = outside_zone(v, k) ? 0 : far;
+		}
+}
+
+// Combines both distances in a single signed field, like compute_distance() does
+static FIELD<float>* combine_box(int nx, int ny, const DistanceBox& b, const float* to_zone, const float* to_outside, float maxd, ARENA* arena)
+{
+	FIELD<float>* f = new FIELD<float>(nx, ny, arena);
+	*f = 0;
+	float* out = f->data();
+	for(int j = 0; j < b.h; j++)
+		for(int i = 0; i < b.w; i++)
+		{
+			float* o = &out[(b.y0 + j)*nx + b.x0 + i];
+			if(to_zone[j*b.w + i] > 0)
+				*o = to_zone[j*b.w + i];
+			else
+				*o = to_outside[j*b.w + i] <= maxd ? -to_outside[j*b.w + i] : 0;
+		}
+	return f;
+}
+
+
+// Exact Euclidean distance transform
+//
+
+static const float EDT_INF = 1.0e20f;
+
+// 1D squared distance transform of the n samples f[0], f[stride], ... [1].
+// Samples equal to EDT_INF are not features. d, v and z are scratch arrays
+// of n, n and n+1 elements.
+static void dt1d(float* f, int n, int stride, float* d, int* v, float* z)
+{
+	int k = -1;
+	for(int q = 0; q < n; q++)
+	{
+		float fq = f[q*stride];
+		if(fq >= EDT_INF)
+			continue;
+		float s = 0;
+		while(k >= 0)
+		{
+			int p = v[k];
+			s = float(((double(fq) + double(q)*q) - (double(f[p*stride]) + double(p)*p)) / (2.0*(q - p)));
+			if(s > z[k])
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = k ? s : -EDT_INF;
+	}
+	if(k < 0)
+		return;  // no features on this line, leave it at EDT_INF
+	z[k+1] = EDT_INF;
+
+	for(int q = 0, j = 0; q < n; q++)
+	{
+		while(z[j+1] < q)
+			j++;
+		d[q] = float(q - v[j])*float(q - v[j]) + f[v[j]*stride];
+	}
+	for(int q = 0; q < n; q++)
+		f[q*stride] = d[q];
+}
+
+struct EdtPass
+{
+	float* g[2];  // squared distances to the zone and to its outside
+	int w, h;     // size of the processed box
+};
+
+static void edt_columns(int lo, int hi, void* arg)
+{
+	EdtPass* e = (EdtPass*)arg;
+	vector<float> d(e->h), z(e->h + 1);
+	vector<int> v(e->h);
+	for(int x = lo; x < hi; x++)
+		for(int k = 0; k < 2; k++)
+			dt1d(e->g[k] + x, e->h, e->w, &d[0], &v[0], &z[0]);
+}
+
+static void edt_rows(int lo, int hi, void* arg)
+{
+	EdtPass* e = (EdtPass*)arg;
+	vector<float> d(e->w), z(e->w + 1);
+	vector<int> v(e->w);
+	for(int y = lo; y < hi; y++)
+		for(int k = 0; k < 2; k++)
+		{
+			float* g = e->g[k] + y*e->w;
+			dt1d(g, e->w, 1, &d[0], &v[0], &z[0]);
+			for(int x = 0; x < e->w; x++)
+				g[x] = sqrt(g[x]);
+		}
+}
+
+FIELD<float>* compute_distance_edt(FIELD<float>* fi, float k, float maxd, ARENA* arena)
+{
+	DistanceBox b;
+	if(!zone_box(fi, k, maxd, b))
+	{
+		FIELD<float>* f = new FIELD<float>(fi->dimX(), fi->dimY(), arena);
+		*f = 0;
+		return f;
+	}
+
+	FIELD<float> to_zone(b.w, b.h, arena), to_outside(b.w, b.h, arena);  // scratch
+	seed_box(fi, k, b, to_zone.data(), to_outside.data(), EDT_INF);
+
+	EdtPass e;
+	e.g[0] = to_zone.data();
+	e.g[1] = to_outside.data();
+	e.w = b.w;
+	e.h = b.h;
+	parallel_for(0, e.w, 16, edt_columns, &e);
+	parallel_for(0, e.h, 16, edt_rows, &e);  // also takes the square roots
+
+	return combine_box(fi->dimX(), fi->dimY(), b, to_zone.data(), to_outside.data(), maxd, arena);
+}
+
+
+// Fast sweeping method [2]
+//
+
+static const float SWEEP_INF = 1.0e7f;
+static const float SWEEP_EPS = 1.0e-4f;	//stop when no value changes more than this in a round
+static const int SWEEP_MAX_ROUNDS = 1000;
+
+// Gauss-Seidel sweeps of the upwind eikonal update over rows [r0, r1) of u in
+// the four alternating orderings. Returns the largest decrease of a value.
+static float sweep_rows(float* u, int w, int h, int r0, int r1)
+{
+	float change = 0;
+	for(int s = 0; s < 4; s++)
+	{
+		int dx = (s & 1) ? -1 : 1, dy = (s & 2) ? -1 : 1;
+		int y = dy > 0 ? r0 : r1 - 1;
+		for(; y >= r0 && y < r1; y += dy)
+		{
+			int x = dx > 0 ? 0 : w - 1;
+			for(; x >= 0 && x < w; x += dx)
+			{
+				float* p = &u[y*w + x];
+				if(*p == 0)
+					continue;  // feature
+				float a = MIN(x > 0 ? p[-1] : SWEEP_INF, x < w - 1 ? p[1] : SWEEP_INF);
+				float c = MIN(y > 0 ? p[-w] : SWEEP_INF, y < h - 1 ? p[w] : SWEEP_INF);
+				if(a >= SWEEP_INF && c >= SWEEP_INF)
+					continue;
+				float d;
+				if(fabs(a - c) >= 1)
+					d = MIN(a, c) + 1;
+				else
+					d = (a + c + sqrt(2 - (a - c)*(a - c))) / 2;
+				if(d < *p)
+				{
+					if(*p - d > change)
+						change = *p - d;
+					*p = d;
+				}
+			}
+		}
+	}
+	return change;
+}
+
+struct SweepPass
+{
+	float* u[2];          // distances to the zone and to its outside
+	int w, h;             // size of the processed box
+	int bands;            // number of row bands the box is split in
+	int parity;           // bands processed by this pass: even or odd ones
+	vector<float> change; // per band result of sweep_rows()
+
+	SweepPass() : u(), w(0), h(0), bands(0), parity(0), change() {}
+
+private:
+	SweepPass(const SweepPass&);
+	SweepPass& operator=(const SweepPass&);
+};
+
+// Adjacent bands never run at the same time, so a band can read the border
+// rows of its neighbours without them changing under it.
+static void sweep_bands(int lo, int hi, void* arg)
+{
+	SweepPass* s = (SweepPass*)arg;
+	for(int i = lo; i < hi; i++)
+	{
+		int band = 2*i + s->parity;
+		int r0 = band * s->h / s->bands, r1 = (band + 1) * s->h / s->bands;
+		float c0 = sweep_rows(s->u[0], s->w, s->h, r0, r1);
+		float c1 = sweep_rows(s->u[1], s->w, s->h, r0, r1);
+		s->change[band] = MAX(c0, c1);
+	}
+}
+
+FIELD<float>* compute_distance_sweep(FIELD<float>* fi, float k, float maxd, ARENA* arena)
+{
+	DistanceBox b;
+	if(!zone_box(fi, k, maxd, b))
+	{
+		FIELD<float>* f = new FIELD<float>(fi->dimX(), fi->dimY(), arena);
+		*f = 0;
+		return f;
+	}
+
+	FIELD<float> to_zone(b.w, b.h, arena), to_outside(b.w, b.h, arena);  // scratch
+	seed_box(fi, k, b, to_zone.data(), to_outside.data(), SWEEP_INF);
+
+	SweepPass s;
+	s.u[0] = to_zone.data();
+	s.u[1] = to_outside.data();
+	s.w = b.w;
+	s.h = b.h;
+	s.bands = 2 * worker_count();
+	if(s.bands > b.h / 8)
+		s.bands = b.h / 8;
+	if(s.bands < 1)
+		s.bands = 1;
+	s.change.resize(s.bands);
+
+	for(int round = 0; round < SWEEP_MAX_ROUNDS; round++)
+	{
+		for(s.parity = 0; s.parity < 2; s.parity++)
+			parallel_for(0, (s.bands + 1 - s.parity) / 2, 1, sweep_bands, &s);
+		float change = 0;
+		for(int i = 0; i < s.bands; i++)
+			change = MAX(change, s.change[i]);
+		if(change < SWEEP_EPS)
+			break;
+	}
+
+	return combine_box(fi->dimX(), fi->dimY(), b, to_zone.data(), to_outside.data(), maxd, arena);
+}
+
+// Список литературы:
+//  [1] P. Felzenszwalb, D. Huttenlocher, "Distance Transforms of Sampled Functions", 2004
+//  [2] H. Zhao, "A fast sweeping method for Eikonal equations", 2004
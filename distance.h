@@ -0,0 +1,18 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include "field.h"
+#include "distance_method.h"
+
+// Same result as compute_distance(): the zone is what FLAGS(fi,k) makes ALIVE.
+// Outside of the zone the field is the distance to it, inside the zone it is
+// minus the distance to what FLAGS(fi,-k) makes ALIVE, down to -maxd, and 0
+// deeper in. Pixels further than maxd from the zone's bounding box are left 0.
+// With an arena, the result and the scratch buffers are allocated in it.
+FIELD<float>* compute_distance_edt(FIELD<float>* fi, float k, float maxd, ARENA* arena = 0);
+
+// Same as above, solving the eikonal equation by fast sweeping until no value
+// changes any more. Converges to the same discrete solution as the FMM.
+FIELD<float>* compute_distance_sweep(FIELD<float>* fi, float k, float maxd, ARENA* arena = 0);
+
+#endif
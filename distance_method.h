@@ -0,0 +1,13 @@
+#ifndef DISTANCE_METHOD_H
+#define DISTANCE_METHOD_H
+
+// Backends that compute_distance() can use to build the signed distance field
+// around the inpainting zone
+enum DistanceMethod
+{
+	DISTANCE_FMM,	// two fast marching evolutions, inside and outside (Telea's original)
+	DISTANCE_EDT,	// exact Euclidean distance transform (Felzenszwalb-Huttenlocher)
+	DISTANCE_SWEEP	// fast sweeping, parallel over row bands
+};
+
+#endif
@@ -0,0 +1,115 @@
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GRADIENT_SSE
+#endif
+
+#include <vector>
+
+#include <fltk/Image.h>
+
+#include "gradient.h"
+#include "parallel.h"
+
+using namespace std;
+using namespace fltk;
+
+
+// A row of the input with its neighbours across the border on both sides:
+// p[-1] is the last pixel, p[w] the first
+static void luminance_row(const uchar* rgb32, int w, float* p)
+{
+	const float scale = 1.0f / (3 * 255);
+	for(int x = 0; x < w; x++)
+		p[x] = (rgb32[x*4 + 0] + rgb32[x*4 + 1] + rgb32[x*4 + 2]) * scale;
+	p[-1] = p[w - 1];
+	p[w] = p[0];
+}
+
+static void plane_row(const float* f, int w, float* p)
+{
+	for(int x = 0; x < w; x++)
+		p[x] = f[x];
+	p[-1] = p[w - 1];
+	p[w] = p[0];
+}
+
+// The gradients of the middle one of three padded rows
+static void sobel_row(const float* a, const float* b, const float* c, int w, float* gx, float* gy)
+{
+	int x = 0;
+#ifdef GRADIENT_SSE
+	const __m128 two = _mm_set1_ps(2);
+	for(; x + 4 <= w; x += 4)
+	{
+		__m128 al = _mm_loadu_ps(a + x - 1), ar = _mm_loadu_ps(a + x + 1);
+		__m128 bl = _mm_loadu_ps(b + x - 1), br = _mm_loadu_ps(b + x + 1);
+		__m128 cl = _mm_loadu_ps(c + x - 1), cr = _mm_loadu_ps(c + x + 1);
+		__m128 dx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(ar, al), _mm_sub_ps(cr, cl)),
+			_mm_mul_ps(two, _mm_sub_ps(br, bl)));
+		__m128 dy = _mm_add_ps(_mm_add_ps(_mm_sub_ps(cl, al), _mm_sub_ps(cr, ar)),
+			_mm_mul_ps(two, _mm_sub_ps(_mm_loadu_ps(c + x), _mm_loadu_ps(a + x))));
+		_mm_storeu_ps(gx + x, dx);
+		_mm_storeu_ps(gy + x, dy);
+	}
+#endif
+	for(; x < w; x++)
+	{
+		gx[x] = (a[x + 1] - a[x - 1]) + (c[x + 1] - c[x - 1]) + 2*(b[x + 1] - b[x - 1]);
+		gy[x] = (c[x - 1] - a[x - 1]) + (c[x + 1] - a[x + 1]) + 2*(c[x] - a[x]);
+	}
+}
+
+struct SobelJob
+{
+	const uchar* rgb32;  // either this
+	const float* f;      // or that is the input
+	int w, h;
+	float *gx, *gy;
+};
+
+// Rows [lo, hi), keeping the three input rows around the current one
+static void sobel_rows(int lo, int hi, void* arg)
+{
+	SobelJob* s = (SobelJob*)arg;
+	int w = s->w, h = s->h;
+	vector<float> buf(3 * (w + 2));
+	float* rows[3] = { &buf[1], &buf[w + 3], &buf[2*w + 5] };
+	for(int k = 0; k < 3; k++)
+	{
+		int y = (lo - 1 + k + h) % h;
+		if(s->rgb32)
+			luminance_row(s->rgb32 + y*w*4, w, rows[k]);
+		else
+			plane_row(s->f + y*w, w, rows[k]);
+	}
+	for(int y = lo; y < hi; y++)
+	{
+		sobel_row(rows[0], rows[1], rows[2], w, s->gx + y*w, s->gy + y*w);
+		if(y + 1 == hi)
+			break;
+		float* t = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = t;
+		int next = (y + 2) % h;
+		if(s->rgb32)
+			luminance_row(s->rgb32 + next*w*4, w, rows[2]);
+		else
+			plane_row(s->f + next*w, w, rows[2]);
+	}
+}
+
+void sobel_gradient(const uchar* rgb32, int w, int h, float* gx, float* gy)
+{
+	SobelJob s = { rgb32, 0, w, h, gx, gy };
+	if(w > 0 && h > 0)
+		parallel_for(0, h, 64, sobel_rows, &s);
+}
+
+void sobel_gradient(const float* f, int w, int h, float* gx, float* gy)
+{
+	SobelJob s = { 0, f, w, h, gx, gy };
+	if(w > 0 && h > 0)
+		parallel_for(0, h, 64, sobel_rows, &s);
+}
@@ -0,0 +1,17 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <fltk/Image.h>
+
+// Signed Sobel gradients, written to the w x h float planes gx and gy (the x
+// one growing to the right, the y one downwards). The image wraps around at
+// the borders, like for filter().
+
+// Of the luminance (R + G + B) / (3 * 255) of RGB32 pixels, in one pass with
+// no luminance plane in between
+void sobel_gradient(const unsigned char* rgb32, int w, int h, float* gx, float* gy);
+
+// Of a float plane
+void sobel_gradient(const float* f, int w, int h, float* gx, float* gy);
+
+#endif
@@ -0,0 +1,1395 @@
+
+#include <cctype>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <fltk/Image.h>
+#include <fltk/SharedImage.h>
+#include <fltk/filename.h>
+#include <fltk/Threads.h>
+
+#include <zlib.h>
+// The libjpeg in lib/ was built with jconfig.vc, whose boolean is windows.h's
+extern "C" {
+#include <jconfig.vc>
+#define JCONFIG_INCLUDED	// as jinclude.h does
+#include <jpeglib.h>
+}
+
+#include "image_io.h"
+#include "parallel.h"
+#include "tile_store.h"
+
+using namespace std;
+using namespace fltk;
+
+
+// SharedImage keeps the images it reads in a global tree, by name
+static Mutex decode_lock;
+
+string file_extension(const char* filename)
+{
+	const char* ext = filename_ext(filename);
+	string res;
+	if(ext && *ext == '.')
+		for(ext++; *ext; ext++)
+			res += char(tolower((unsigned char)*ext));
+	return res;
+}
+
+static Image* decode_image(const char* filename, string& error)
+{
+	string ext = file_extension(filename);
+	SharedImage* (*get)(const char*, const uchar*) = 0;
+	if(ext == "bmp")
+		get = bmpImage::get;
+	if(ext == "jpg" || ext == "jpeg")
+		get = jpegImage::get;
+	if(ext == "png")
+		get = pngImage::get;
+	if(!get)
+	{
+		error = string(filename) + ": unknown format";
+		return 0;
+	}
+	if(!filename_isfile(filename))
+	{
+		error = string(filename) + ": no such file";
+		return 0;
+	}
+
+	// The decoded pixels are copied out of the SharedImage, which is then
+	// let go, so that the image is ours alone and nothing stays in the tree
+	Image* img = 0;
+	decode_lock.lock();
+	SharedImage* shared = get(filename, 0);
+	if(shared)
+	{
+		shared->set_forceARGB32();
+		shared->fetch_if_needed();
+		const Image* decoded = shared;
+		int w = decoded->buffer_width(), h = decoded->buffer_height();
+		if(w > 0 && h > 0 && decoded->buffer() && decoded->buffer_depth() == 4)
+		{
+			img = new Image;
+			img->setimage(decoded->buffer(), RGB32, w, h, decoded->buffer_linedelta());
+		}
+		shared->remove();
+	}
+	decode_lock.unlock();
+	if(!img)
+		error = string(filename) + ": wrong format";
+	return img;
+}
+
+// The decode cache: owned copies of the images decoded, the last used first.
+// Like SharedImage's mem_usage_limit, but the pixels are ours, and a file
+// changed since is decoded again.
+struct CachedImage
+{
+	string filename;
+	long mtime;
+	FL_FILESIZE_T size;
+	int w, h;
+	vector<uchar> pixels;
+};
+
+static Mutex cache_lock;
+static list<CachedImage> cached;
+static size_t cache_limit = size_t(64) << 20;
+static DecodeCacheStats cache_stats;
+
+// The least recently used images go until 'bytes' more fit; cache_lock held
+static void make_room(size_t bytes)
+{
+	while(!cached.empty() && cache_stats.bytes + bytes > cache_limit)
+	{
+		cache_stats.bytes -= cached.back().pixels.size();
+		cached.pop_back();
+		cache_stats.evictions++;
+	}
+	cache_stats.images = int(cached.size());
+}
+
+Image* load_image(const char* filename, string& error)
+{
+	if(!filename_isfile(filename))
+		return decode_image(filename, error);
+	long mtime = filename_mtime(filename);
+	FL_FILESIZE_T size = filename_size(filename);
+
+	cache_lock.lock();
+	for(list<CachedImage>::iterator i = cached.begin(); i != cached.end(); ++i)
+		if(i->filename == filename)
+		{
+			if(i->mtime == mtime && i->size == size)
+			{
+				cached.splice(cached.begin(), cached, i);
+				cache_stats.hits++;
+				Image* img = new Image;
+				img->setimage(&i->pixels[0], RGB32, i->w, i->h);
+				cache_lock.unlock();
+				return img;
+			}
+			cache_stats.bytes -= i->pixels.size();
+			cached.erase(i);
+			cache_stats.images = int(cached.size());
+			break;
+		}
+	cache_stats.misses++;
+	cache_lock.unlock();
+
+	Image* img = decode_image(filename, error);
+	if(!img)
+		return 0;
+	int w = img->buffer_width(), h = img->buffer_height();
+	size_t bytes = size_t(w) * h * 4;
+	cache_lock.lock();
+	bool there = false;	// decoded by another thread meanwhile
+	for(list<CachedImage>::iterator i = cached.begin(); i != cached.end() && !there; ++i)
+		there = i->filename == filename && i->mtime == mtime && i->size == size;
+	if(!there && bytes <= cache_limit)
+	{
+		make_room(bytes);
+		cached.push_front(CachedImage());
+		CachedImage& c = cached.front();
+		c.filename = filename;
+		c.mtime = mtime;
+		c.size = size;
+		c.w = w;
+		c.h = h;
+		c.pixels.resize(bytes);
+		for(int y = 0; y < h; y++)
+			memcpy(&c.pixels[size_t(y) * w * 4], img->buffer() + size_t(y) * img->buffer_linedelta(),
+				size_t(w) * 4);
+		cache_stats.bytes += bytes;
+		if(cache_stats.bytes > cache_stats.peak)
+			cache_stats.peak = cache_stats.bytes;
+		cache_stats.images = int(cached.size());
+	}
+	cache_lock.unlock();
+	return img;
+}
+
+void set_decode_cache_limit(size_t bytes)
+{
+	cache_lock.lock();
+	cache_limit = bytes;
+	make_room(0);
+	cache_lock.unlock();
+}
+
+DecodeCacheStats decode_cache_stats()
+{
+	cache_lock.lock();
+	DecodeCacheStats s = cache_stats;
+	cache_lock.unlock();
+	return s;
+}
+
+static void put16(uchar* p, unsigned v)
+{
+	p[0] = uchar(v);
+	p[1] = uchar(v >> 8);
+}
+
+static void put32(uchar* p, unsigned long v)
+{
+	put16(p, unsigned(v & 0xffff));
+	put16(p + 2, unsigned(v >> 16));
+}
+
+// 24 bits per pixel, bottom-up, each row padded to 4 bytes
+static size_t bmp_row_bytes(int w)
+{
+	return (size_t(w) * 3 + 3) / 4 * 4;
+}
+
+static const size_t BMP_HEADER = 54;
+
+static void bmp_header(uchar* header, int w, int h)
+{
+	size_t row_bytes = bmp_row_bytes(w);
+	memset(header, 0, BMP_HEADER);
+	header[0] = 'B';
+	header[1] = 'M';
+	put32(header + 2, (unsigned long)(BMP_HEADER + row_bytes * h));	// file size
+	put32(header + 10, BMP_HEADER);		// offset of the pixels
+	put32(header + 14, 40);			// BITMAPINFOHEADER
+	put32(header + 18, w);
+	put32(header + 22, h);
+	put16(header + 26, 1);			// planes
+	put16(header + 28, 24);			// bits per pixel
+	put32(header + 34, (unsigned long)(row_bytes * h));
+	put32(header + 38, 2835);		// 72 dpi
+	put32(header + 42, 2835);
+}
+
+// RGB32 pixels as B, G, R bytes
+static void bgr_pixels(const uchar* buf, int w, uchar* row)
+{
+	for(int x = 0; x < w; x++)
+	{
+		unsigned pixel;
+		memcpy(&pixel, buf + x * 4, 4);
+		row[x*3 + 0] = uchar(pixel);
+		row[x*3 + 1] = uchar(pixel >> 8);
+		row[x*3 + 2] = uchar(pixel >> 16);
+	}
+}
+
+static bool save_bmp(FILE* f, const Image* img)
+{
+	int w = img->buffer_width(), h = img->buffer_height();
+	size_t row_bytes = bmp_row_bytes(w);
+	uchar header[BMP_HEADER];
+	bmp_header(header, w, h);
+	if(fwrite(header, sizeof(header), 1, f) != 1)
+		return false;
+
+	const uchar* buf = img->buffer();
+	vector<uchar> row(row_bytes, 0);
+	for(int y = h - 1; y >= 0; y--)
+	{
+		bgr_pixels(buf + size_t(y) * w * 4, w, &row[0]);
+		if(fwrite(&row[0], 1, row_bytes, f) != row_bytes)
+			return false;
+	}
+	return true;
+}
+
+// RGB32 pixels as R, G, B bytes
+static void rgb_pixels(const uchar* buf, int w, uchar* row)
+{
+	for(int x = 0; x < w; x++)
+	{
+		unsigned pixel;
+		memcpy(&pixel, buf + x * 4, 4);
+		row[x*3 + 0] = uchar(pixel >> 16);
+		row[x*3 + 1] = uchar(pixel >> 8);
+		row[x*3 + 2] = uchar(pixel);
+	}
+}
+
+// One row of the image as R, G, B bytes
+static void rgb_row(const Image* img, int y, uchar* row)
+{
+	int w = img->buffer_width();
+	rgb_pixels(img->buffer() + size_t(y) * w * 4, w, row);
+}
+
+// PNG: the filtered rows are cut into stripes deflated on their own threads,
+// each primed with the 32 KB before it as dictionary and ended by a sync
+// flush on a byte boundary, so that the pieces joined make one zlib stream
+// (as pigz [1] does). The Adler-32s of the stripes are combined for the end.
+
+static const size_t PNG_STRIPE_BYTES = 256 << 10;	// of filtered rows, at least
+static const size_t DEFLATE_WINDOW = 32768;
+
+struct PngEncoder
+{
+	const Image* img;
+	size_t row_bytes;		// filter type and R, G, B
+	int stripe_rows;
+	std::vector<uchar> filtered;
+	std::vector< std::vector<uchar> > stripes;
+	std::vector<unsigned long> adlers;
+	std::vector<char> failed;
+};
+
+static inline int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = p > a ? p - a : a - p;
+	int pb = p > b ? p - b : b - p;
+	int pc = p > c ? p - c : c - p;
+	if(pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// Each row gets the filter with the smallest sum of absolute differences,
+// the heuristic the PNG specification suggests [2]: cur, n bytes, is filtered
+// into out as the filter type and n bytes, prev being the row above it
+static void png_filter_row(const uchar* prev, const uchar* cur, size_t n, uchar* out, uchar* trial)
+{
+	unsigned long best_sum = (unsigned long)-1;
+	for(int type = 0; type < 5; type++)
+	{
+		unsigned long sum = 0;
+		for(size_t k = 0; k < n; k++)
+		{
+			int a = k >= 3 ? cur[k - 3] : 0, b = prev[k], c = k >= 3 ? prev[k - 3] : 0;
+			int predicted = type == 0 ? 0 : type == 1 ? a : type == 2 ? b :
+				type == 3 ? (a + b) / 2 : paeth(a, b, c);
+			uchar v = uchar(cur[k] - predicted);
+			trial[k] = v;
+			sum += v < 128 ? v : 256 - v;
+		}
+		if(sum < best_sum)
+		{
+			best_sum = sum;
+			out[0] = uchar(type);
+			memcpy(out + 1, trial, n);
+		}
+	}
+}
+
+static void png_filter_rows(int lo, int hi, void* arg)
+{
+	PngEncoder* e = (PngEncoder*)arg;
+	size_t n = e->row_bytes - 1;
+	std::vector<uchar> prev(n, 0), cur(n), trial(n);
+	if(lo > 0)
+		rgb_row(e->img, lo - 1, &prev[0]);
+	for(int y = lo; y < hi; y++)
+	{
+		rgb_row(e->img, y, &cur[0]);
+		png_filter_row(&prev[0], &cur[0], n, &e->filtered[size_t(y) * e->row_bytes], &trial[0]);
+		prev.swap(cur);
+	}
+}
+
+static void png_deflate_stripes(int lo, int hi, void* arg)
+{
+	PngEncoder* e = (PngEncoder*)arg;
+	int h = e->img->buffer_height();
+	for(int s = lo; s < hi; s++)
+	{
+		size_t start = size_t(s) * e->stripe_rows * e->row_bytes;
+		int rows = h - s * e->stripe_rows < e->stripe_rows ? h - s * e->stripe_rows : e->stripe_rows;
+		size_t length = size_t(rows) * e->row_bytes;
+		bool last = s == int(e->stripes.size()) - 1;
+		const uchar* in = &e->filtered[start];
+		e->adlers[s] = adler32(adler32(0L, Z_NULL, 0), in, uInt(length));
+
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			e->failed[s] = 1;
+			continue;
+		}
+		if(start > 0)
+		{
+			size_t dict = start < DEFLATE_WINDOW ? start : DEFLATE_WINDOW;
+			deflateSetDictionary(&z, in - dict, uInt(dict));
+		}
+		std::vector<uchar>& out = e->stripes[s];
+		out.resize(deflateBound(&z, uLong(length)) + 64);
+		z.next_in = (Bytef*)in;
+		z.avail_in = uInt(length);
+		size_t done = 0;
+		int rc;
+		do
+		{
+			if(done == out.size())
+				out.resize(out.size() * 2);
+			z.next_out = &out[done];
+			z.avail_out = uInt(out.size() - done);
+			rc = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+			done = out.size() - z.avail_out;
+		}
+		while(rc == Z_OK && (last || z.avail_out == 0));
+		if(!last && rc == Z_BUF_ERROR && z.avail_in == 0)
+			rc = Z_OK;	// the flush had just filled the buffer
+		out.resize(done);
+		if(rc != (last ? Z_STREAM_END : Z_OK))
+			e->failed[s] = 1;
+		deflateEnd(&z);
+	}
+}
+
+static void put_be32(uchar* p, unsigned long v)
+{
+	p[0] = uchar(v >> 24);
+	p[1] = uchar(v >> 16);
+	p[2] = uchar(v >> 8);
+	p[3] = uchar(v);
+}
+
+// A chunk whose data is the two parts one after the other
+static bool png_chunk(FILE* f, const char* type, const uchar* a, size_t na, const uchar* b = 0, size_t nb = 0)
+{
+	uchar head[8];
+	put_be32(head, (unsigned long)(na + nb));
+	memcpy(head + 4, type, 4);
+	unsigned long crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, head + 4, 4);
+	if(na)
+		crc = crc32(crc, a, uInt(na));
+	if(nb)
+		crc = crc32(crc, b, uInt(nb));
+	uchar tail[4];
+	put_be32(tail, crc);
+	return fwrite(head, 8, 1, f) == 1 && (!na || fwrite(a, 1, na, f) == na) &&
+		(!nb || fwrite(b, 1, nb, f) == nb) && fwrite(tail, 4, 1, f) == 1;
+}
+
+// The signature and the header of an 8 bit RGB image
+static bool png_start(FILE* f, int w, int h)
+{
+	static const uchar signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	uchar ihdr[13];
+	put_be32(ihdr, w);
+	put_be32(ihdr + 4, h);
+	ihdr[8] = 8;	// bits per sample
+	ihdr[9] = 2;	// RGB
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;	// deflate, adaptive filters, no interlace
+	return fwrite(signature, 8, 1, f) == 1 && png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+}
+
+static bool save_png(FILE* f, const Image* img)
+{
+	int w = img->buffer_width(), h = img->buffer_height();
+	PngEncoder e;
+	e.img = img;
+	e.row_bytes = 1 + size_t(w) * 3;
+	e.stripe_rows = int((PNG_STRIPE_BYTES + e.row_bytes - 1) / e.row_bytes);
+	if(worker_count() == 1 || e.stripe_rows >= h)
+		e.stripe_rows = h;
+	int count = (h + e.stripe_rows - 1) / e.stripe_rows;
+	e.filtered.resize(e.row_bytes * h);
+	e.stripes.resize(count);
+	e.adlers.resize(count);
+	e.failed.assign(count, 0);
+
+	parallel_for(0, h, e.stripe_rows, png_filter_rows, &e);
+	parallel_for(0, count, 1, png_deflate_stripes, &e);
+	unsigned long adler = adler32(0L, Z_NULL, 0);
+	for(int s = 0; s < count; s++)
+	{
+		if(e.failed[s])
+			return false;
+		int rows = h - s * e.stripe_rows < e.stripe_rows ? h - s * e.stripe_rows : e.stripe_rows;
+		adler = adler32_combine(adler, e.adlers[s], z_off_t(size_t(rows) * e.row_bytes));
+	}
+
+	static const uchar zlib_header[2] = { 0x78, 0x9c };
+	uchar zlib_trailer[4];
+	put_be32(zlib_trailer, adler);
+
+	bool ok = png_start(f, w, h) && png_chunk(f, "IDAT", zlib_header, 2);
+	for(int s = 0; s < count && ok; s++)
+	{
+		std::vector<uchar>& out = e.stripes[s];
+		ok = png_chunk(f, "IDAT", out.empty() ? 0 : &out[0], out.size(),
+			s == count - 1 ? zlib_trailer : 0, s == count - 1 ? 4 : 0);
+		std::vector<uchar>().swap(out);
+	}
+	return ok && png_chunk(f, "IEND", 0, 0);
+}
+
+
+// JPEG: the image is cut into stripes a whole number of MCU rows high, with
+// a restart interval of one stripe, so that every stripe's entropy-coded
+// segment depends on nothing before it [3]. The stripes are compressed on
+// their own threads as images of their own with the same settings, and their
+// segments joined, the RSTn markers between them, under the first one's
+// headers.
+
+static const int JPEG_MCU = 16;			// jpeg_set_defaults() subsamples the chroma 2x2
+static const int JPEG_STRIPE_PIXELS = 1 << 20;	// about, per stripe
+
+struct JpegError
+{
+	jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr c)
+{
+	longjmp(((JpegError*)c->err)->jump, 1);
+}
+
+struct JpegDest
+{
+	jpeg_destination_mgr pub;
+	std::vector<uchar>* out;
+	JOCTET buf[16384];
+};
+
+static void jpeg_init_destination(j_compress_ptr c)
+{
+	JpegDest* d = (JpegDest*)c->dest;
+	d->pub.next_output_byte = d->buf;
+	d->pub.free_in_buffer = sizeof(d->buf);
+}
+
+static boolean jpeg_empty_output_buffer(j_compress_ptr c)
+{
+	JpegDest* d = (JpegDest*)c->dest;
+	d->out->insert(d->out->end(), d->buf, d->buf + sizeof(d->buf));
+	d->pub.next_output_byte = d->buf;
+	d->pub.free_in_buffer = sizeof(d->buf);
+	return TRUE;
+}
+
+static void jpeg_term_destination(j_compress_ptr c)
+{
+	JpegDest* d = (JpegDest*)c->dest;
+	d->out->insert(d->out->end(), d->buf, d->buf + sizeof(d->buf) - d->pub.free_in_buffer);
+}
+
+struct JpegEncoder
+{
+	const Image* img;
+	int quality;
+	int stripe_rows;
+	unsigned restart;		// MCUs in a stripe, 0 if there's one
+	std::vector< std::vector<uchar> > stripes;
+	std::vector<char> failed;
+};
+
+// Rows [y0, y1) as a JPEG file of their own
+static bool jpeg_encode(const JpegEncoder* e, int y0, int y1, std::vector<uchar>& out)
+{
+	int w = e->img->buffer_width();
+	std::vector<uchar> row(size_t(w) * 3);
+	jpeg_compress_struct c;
+	JpegError error;
+	JpegDest dest;
+	c.err = jpeg_std_error(&error.pub);
+	error.pub.error_exit = jpeg_error_exit;
+	if(setjmp(error.jump))
+	{
+		jpeg_destroy_compress(&c);
+		return false;
+	}
+	jpeg_create_compress(&c);
+	dest.pub.init_destination = jpeg_init_destination;
+	dest.pub.empty_output_buffer = jpeg_empty_output_buffer;
+	dest.pub.term_destination = jpeg_term_destination;
+	dest.out = &out;
+	c.dest = &dest.pub;
+	c.image_width = w;
+	c.image_height = y1 - y0;
+	c.input_components = 3;
+	c.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&c);
+	jpeg_set_quality(&c, e->quality, TRUE);
+	c.restart_interval = e->restart;
+	jpeg_start_compress(&c, TRUE);
+	for(int y = y0; y < y1; y++)
+	{
+		rgb_row(e->img, y, &row[0]);
+		JSAMPROW r = &row[0];
+		jpeg_write_scanlines(&c, &r, 1);
+	}
+	jpeg_finish_compress(&c);
+	jpeg_destroy_compress(&c);
+	return true;
+}
+
+static void jpeg_encode_stripes(int lo, int hi, void* arg)
+{
+	JpegEncoder* e = (JpegEncoder*)arg;
+	int h = e->img->buffer_height();
+	for(int s = lo; s < hi; s++)
+	{
+		int y0 = s * e->stripe_rows;
+		int y1 = y0 + e->stripe_rows < h ? y0 + e->stripe_rows : h;
+		if(!jpeg_encode(e, y0, y1, e->stripes[s]))
+			e->failed[s] = 1;
+	}
+}
+
+// Where the entropy-coded segment of a JPEG file starts, after the SOS
+// header, and where its frame height is; 0 if it's not found
+static size_t jpeg_scan_start(const std::vector<uchar>& jpeg, size_t* height_at)
+{
+	size_t p = 2;	// after SOI
+	while(p + 4 <= jpeg.size() && jpeg[p] == 0xff)
+	{
+		uchar marker = jpeg[p + 1];
+		size_t length = (size_t(jpeg[p + 2]) << 8) | jpeg[p + 3];
+		if(marker >= 0xc0 && marker <= 0xc2)
+			*height_at = p + 5;
+		if(marker == 0xda)
+			return p + 2 + length;
+		p += 2 + length;
+	}
+	return 0;
+}
+
+static bool save_jpeg(FILE* f, const Image* img, int quality)
+{
+	int w = img->buffer_width(), h = img->buffer_height();
+	JpegEncoder e;
+	e.img = img;
+	e.quality = quality;
+	int mcus = (w + JPEG_MCU - 1) / JPEG_MCU;
+	int mcu_rows = (JPEG_STRIPE_PIXELS / (w > 0 ? w : 1) + JPEG_MCU - 1) / JPEG_MCU;
+	if(mcu_rows * mcus > 65535)	// the restart interval is 16 bits
+		mcu_rows = 65535 / mcus;
+	e.stripe_rows = mcu_rows * JPEG_MCU;
+	if(worker_count() == 1 || mcu_rows == 0 || e.stripe_rows >= h)
+		e.stripe_rows = h;
+	int count = (h + e.stripe_rows - 1) / e.stripe_rows;
+	e.restart = count > 1 ? unsigned(mcu_rows * mcus) : 0;
+	e.stripes.resize(count);
+	e.failed.assign(count, 0);
+	parallel_for(0, count, 1, jpeg_encode_stripes, &e);
+	for(int s = 0; s < count; s++)
+		if(e.failed[s])
+			return false;
+
+	if(count == 1)
+		return fwrite(&e.stripes[0][0], 1, e.stripes[0].size(), f) == e.stripes[0].size();
+	std::vector<uchar>& first = e.stripes[0];
+	size_t height_at = 0;
+	size_t start = jpeg_scan_start(first, &height_at);
+	if(!start || !height_at)
+		return false;
+	first[height_at] = uchar(h >> 8);
+	first[height_at + 1] = uchar(h);
+	bool ok = fwrite(&first[0], 1, first.size() - 2, f) == first.size() - 2;	// all but EOI
+	for(int s = 1; s < count && ok; s++)
+	{
+		std::vector<uchar>& stripe = e.stripes[s];
+		size_t ignored;
+		start = jpeg_scan_start(stripe, &ignored);
+		if(!start || stripe.size() < start + 2)
+			return false;
+		uchar rst[2] = { 0xff, uchar(0xd0 + (s - 1) % 8) };
+		ok = fwrite(rst, 2, 1, f) == 1 &&
+			fwrite(&stripe[start], 1, stripe.size() - 2 - start, f) == stripe.size() - 2 - start;
+	}
+	static const uchar eoi[2] = { 0xff, 0xd9 };
+	return ok && fwrite(eoi, 2, 1, f) == 1;
+}
+
+bool save_image(const char* filename, const Image* img, string& error, int jpeg_quality)
+{
+	string ext = file_extension(filename);
+	if(ext != "bmp" && ext != "tiles" && ext != "png" && ext != "jpg" && ext != "jpeg")
+	{
+		error = string(filename) + ": can't write ." + ext + " files";
+		return false;
+	}
+	if(img->buffer_width() <= 0 || img->buffer_height() <= 0)
+	{
+		error = string(filename) + ": the image is empty";
+		return false;
+	}
+	if(ext == "tiles")
+	{
+		RowWriter* writer = open_row_writer(filename, img->buffer_width(), img->buffer_height(), error);
+		if(!writer)
+			return false;
+		bool ok = true;
+		for(int y = 0; ok && y < img->buffer_height(); y++)
+			ok = writer->write(img->buffer() + size_t(y) * img->buffer_linedelta());
+		ok = ok && writer->finish();
+		delete writer;
+		if(!ok)
+			error = string(filename) + ": write error";
+		return ok;
+	}
+	FILE* f = fopen(filename, "wb");
+	if(!f)
+	{
+		error = string(filename) + ": can't create the file";
+		return false;
+	}
+	bool ok = ext == "bmp" ? save_bmp(f, img) : ext == "png" ? save_png(f, img) :
+		save_jpeg(f, img, jpeg_quality);
+	ok = fclose(f) == 0 && ok;
+	if(!ok)
+	{
+		remove(filename);
+		error = string(filename) + ": write error";
+	}
+	return ok;
+}
+
+
+// Reading and writing by rows
+
+static unsigned get16(const uchar* p)
+{
+	return p[0] | (unsigned(p[1]) << 8);
+}
+
+static unsigned long get32(const uchar* p)
+{
+	return get16(p) | ((unsigned long)get16(p + 2) << 16);
+}
+
+static unsigned long get_be32(const uchar* p)
+{
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool seek_to(FILE* f, long long pos)
+{
+#ifdef _WIN32
+	return _fseeki64(f, pos, SEEK_SET) == 0;
+#else
+	return fseeko(f, off_t(pos), SEEK_SET) == 0;
+#endif
+}
+
+static void put_rgb32(uchar* p, unsigned r, unsigned g, unsigned b)
+{
+	unsigned pixel = 0xff000000u | (r << 16) | (g << 8) | b;
+	memcpy(p, &pixel, 4);
+}
+
+// R, G, B bytes as RGB32 pixels
+static void rgb32_pixels(const uchar* rgb, int w, uchar* row)
+{
+	for(int x = 0; x < w; x++)
+		put_rgb32(row + x * 4, rgb[x*3 + 0], rgb[x*3 + 1], rgb[x*3 + 2]);
+}
+
+// 8 bit with a palette, 24 or 32 bit; the rows are found by seeking, as they
+// are usually bottom-up
+class BmpRowReader : public RowReader
+{
+public:
+	BmpRowReader(FILE* f) : f(f), y(0) {}
+	~BmpRowReader() { fclose(f); }
+
+	bool open(string& why)
+	{
+		uchar header[BMP_HEADER];
+		if(fread(header, sizeof(header), 1, f) != 1 || header[0] != 'B' || header[1] != 'M' ||
+			get32(header + 14) < 40)
+			return false;
+		offset = get32(header + 10);
+		w = int(get32(header + 18));
+		h = int(get32(header + 22));
+		bottom_up = h > 0;
+		if(h < 0)
+			h = -h;
+		bits = get16(header + 28);
+		if(get32(header + 30) != 0)
+		{
+			why = "compressed BMPs can't be read by rows";
+			return false;
+		}
+		if(w <= 0 || h == 0 || (bits != 8 && bits != 24 && bits != 32))
+			return false;
+		if(bits == 8)
+		{
+			memset(palette, 0, sizeof(palette));
+			unsigned long colors = get32(header + 46);
+			if(colors == 0 || colors > 256)
+				colors = 256;
+			if(!seek_to(f, 14 + (long long)get32(header + 14)) || fread(palette, 4, colors, f) != colors)
+				return false;
+		}
+		row_bytes = (size_t(w) * bits / 8 + 3) / 4 * 4;
+		line.resize(row_bytes);
+		return true;
+	}
+
+	bool read(uchar* row)
+	{
+		if(y == h)
+			return false;
+		int file_row = bottom_up ? h - 1 - y : y;
+		if(!seek_to(f, offset + (long long)file_row * row_bytes) || fread(&line[0], 1, row_bytes, f) != row_bytes)
+			return false;
+		for(int x = 0; x < w; x++)
+		{
+			const uchar* p = bits == 8 ? palette[line[x]] : &line[x * (bits / 8)];
+			put_rgb32(row + x * 4, p[2], p[1], p[0]);
+		}
+		y++;
+		return true;
+	}
+
+private:
+	FILE* f;
+	long long offset;
+	size_t row_bytes;
+	int bits;
+	bool bottom_up;
+	int y;
+	vector<uchar> line;
+	uchar palette[256][4];	// B, G, R, 0
+};
+
+// Decoded here as save_png() encodes: the IDAT chunks are inflated a row at
+// a time and each row unfiltered against the one above. Gray, palette and 16
+// bit images come out as 8 bit RGB, and alpha, tRNS's included, is dropped.
+// The critical chunks' CRCs are checked, and the zlib stream's Adler-32 after
+// the last row.
+class PngRowReader : public RowReader
+{
+public:
+	PngRowReader(FILE* f) : f(f), started(false), ended(false), crc(0), idat_left(0), y(0) {}
+	~PngRowReader()
+	{
+		if(started)
+			inflateEnd(&z);
+		fclose(f);
+	}
+
+	bool open(string& why)
+	{
+		static const uchar signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+		uchar head[8];
+		if(fread(head, 8, 1, f) != 1 || memcmp(head, signature, 8) != 0)
+			return false;
+		memset(palette, 0, sizeof(palette));
+		unsigned long colors = 0;
+		bool header = false;
+		for(;;)
+		{
+			unsigned long length;
+			char type[5];
+			if(!chunk_head(length, type) || header == (strcmp(type, "IHDR") == 0))	// IHDR first, once
+				return false;
+			if(strcmp(type, "IHDR") == 0)
+			{
+				uchar ihdr[13];
+				if(length != 13 || !data(ihdr, 13) || !chunk_end())
+					return false;
+				w = int(get_be32(ihdr));
+				h = int(get_be32(ihdr + 4));
+				depth = ihdr[8];
+				color = ihdr[9];
+				if(ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] > 1)
+					return false;
+				if(ihdr[12] != 0)
+				{
+					why = "interlaced PNGs can't be read by rows";
+					return false;
+				}
+				header = true;
+			}
+			else if(strcmp(type, "PLTE") == 0)
+			{
+				if(length > sizeof(palette) || length % 3 != 0 || !data(palette[0], length) || !chunk_end())
+					return false;
+				colors = length / 3;
+			}
+			else if(strcmp(type, "IDAT") == 0)
+			{
+				idat_left = length;
+				break;
+			}
+			else if(!(type[0] & 0x20) || !skip(length) || !chunk_end(true))	// an unknown critical chunk
+				return false;
+		}
+		channels = color == 0 || color == 3 ? 1 : color == 2 ? 3 : color == 4 ? 2 : color == 6 ? 4 : 0;
+		bool depth_ok = depth == 8 || (depth == 16 && color != 3) ||
+			((depth == 1 || depth == 2 || depth == 4) && (color == 0 || color == 3));
+		if(w <= 0 || h <= 0 || channels == 0 || !depth_ok || (color == 3 && colors == 0))
+			return false;
+		row_bytes = (size_t(w) * channels * depth + 7) / 8;
+		bpp = depth < 8 ? 1 : size_t(channels) * depth / 8;
+		cur.assign(row_bytes + 1, 0);
+		prev.assign(row_bytes + 1, 0);
+		in.resize(65536);
+		memset(&z, 0, sizeof(z));
+		if(inflateInit(&z) != Z_OK)
+			return false;
+		started = true;
+		return true;
+	}
+
+	bool read(uchar* row)
+	{
+		if(y == h)
+			return false;
+		z.next_out = &cur[0];
+		z.avail_out = uInt(cur.size());
+		while(z.avail_out > 0)
+		{
+			if(z.avail_in == 0 && !fill())
+				return false;
+			int rc = inflate(&z, Z_NO_FLUSH);
+			ended = rc == Z_STREAM_END;
+			if(ended ? z.avail_out > 0 : rc != Z_OK)
+				return false;
+		}
+		int type = cur[0];
+		if(type > 4)
+			return false;
+		uchar* p = &cur[1];
+		const uchar* q = &prev[1];
+		for(size_t k = 0; k < row_bytes; k++)
+		{
+			int a = k >= bpp ? p[k - bpp] : 0, b = q[k], c = k >= bpp ? q[k - bpp] : 0;
+			int predicted = type == 0 ? 0 : type == 1 ? a : type == 2 ? b :
+				type == 3 ? (a + b) / 2 : paeth(a, b, c);
+			p[k] = uchar(p[k] + predicted);
+		}
+		int step = depth / 8, mask = (1 << depth) - 1;
+		for(int x = 0; x < w; x++)
+		{
+			if(depth < 8)
+			{
+				int v = (p[x * depth / 8] >> (8 - depth - x * depth % 8)) & mask;
+				if(color == 3)
+					put_rgb32(row + x * 4, palette[v][0], palette[v][1], palette[v][2]);
+				else
+					put_rgb32(row + x * 4, v * 255 / mask, v * 255 / mask, v * 255 / mask);
+				continue;
+			}
+			const uchar* s = p + size_t(x) * channels * step;	// the high byte first if 16 bit
+			if(color == 3)
+				put_rgb32(row + x * 4, palette[s[0]][0], palette[s[0]][1], palette[s[0]][2]);
+			else if(color == 0 || color == 4)
+				put_rgb32(row + x * 4, s[0], s[0], s[0]);
+			else
+				put_rgb32(row + x * 4, s[0], s[step], s[2 * step]);
+		}
+		cur.swap(prev);
+		y++;
+		return y < h || finish();
+	}
+
+private:
+	// The zlib stream must end, its Adler-32 matching, right after the last
+	// row; the chunks left up to IEND are only checked against their CRCs
+	bool finish()
+	{
+		uchar extra;
+		while(!ended)
+		{
+			z.next_out = &extra;
+			z.avail_out = 1;
+			if(z.avail_in == 0 && !fill())
+				return false;
+			int rc = inflate(&z, Z_NO_FLUSH);
+			ended = rc == Z_STREAM_END;
+			if(z.avail_out == 0 || (!ended && rc != Z_OK))
+				return false;
+		}
+		if(!skip(idat_left) || !chunk_end())
+			return false;
+		for(;;)
+		{
+			unsigned long length;
+			char type[5];
+			if(!chunk_head(length, type) || !skip(length) || !chunk_end((type[0] & 0x20) != 0))
+				return false;
+			if(strcmp(type, "IEND") == 0)
+				return length == 0;
+		}
+	}
+
+	bool chunk_head(unsigned long& length, char* type)
+	{
+		uchar head[8];
+		if(fread(head, 8, 1, f) != 1)
+			return false;
+		length = get_be32(head);
+		memcpy(type, head + 4, 4);
+		type[4] = 0;
+		crc = crc32(0, head + 4, 4);
+		return length < 0x80000000ul;
+	}
+
+	// The chunk's data, through its CRC
+	bool data(uchar* p, size_t n)
+	{
+		if(n > 0 && fread(p, 1, n, f) != n)
+			return false;
+		crc = crc32(crc, p, uInt(n));
+		return true;
+	}
+
+	bool skip(unsigned long n)
+	{
+		uchar buffer[4096];
+		while(n > 0)
+		{
+			size_t step = n < sizeof(buffer) ? size_t(n) : sizeof(buffer);
+			if(!data(buffer, step))
+				return false;
+			n -= step;
+		}
+		return true;
+	}
+
+	// A damaged ancillary chunk is only ignored, as libpng does
+	bool chunk_end(bool ancillary = false)
+	{
+		uchar stored[4];
+		return fread(stored, 4, 1, f) == 1 && (ancillary || get_be32(stored) == crc);
+	}
+
+	// More of the compressed rows, from the next IDAT chunks if this one is done
+	bool fill()
+	{
+		while(idat_left == 0)
+		{
+			unsigned long length;
+			char type[5];
+			if(!chunk_end() || !chunk_head(length, type) || strcmp(type, "IDAT") != 0)
+				return false;
+			idat_left = length;
+		}
+		size_t n = idat_left < in.size() ? size_t(idat_left) : in.size();
+		if(!data(&in[0], n))
+			return false;
+		idat_left -= n;
+		z.next_in = &in[0];
+		z.avail_in = uInt(n);
+		return true;
+	}
+
+	FILE* f;
+	z_stream z;
+	bool started, ended;
+	unsigned long crc;	// of the chunk being read, so far
+	unsigned long idat_left;	// of the IDAT chunk being read
+	int depth, color, channels;
+	size_t row_bytes, bpp;
+	int y;
+	vector<uchar> in, cur, prev;	// cur and prev with the filter type byte
+	uchar palette[256][3];
+};
+
+class JpegRowReader : public RowReader
+{
+public:
+	JpegRowReader(FILE* f) : f(f), created(false) {}
+	~JpegRowReader()
+	{
+		if(created)
+			jpeg_destroy_decompress(&d);
+		fclose(f);
+	}
+
+	bool open(string&)
+	{
+		d.err = jpeg_std_error(&error.pub);
+		error.pub.error_exit = jpeg_error_exit;
+		if(setjmp(error.jump))
+			return false;
+		jpeg_create_decompress(&d);
+		created = true;
+		jpeg_stdio_src(&d, f);
+		jpeg_read_header(&d, TRUE);
+		d.out_color_space = JCS_RGB;
+		jpeg_start_decompress(&d);
+		w = int(d.output_width);
+		h = int(d.output_height);
+		if(w <= 0 || h <= 0 || d.output_components != 3)
+			return false;
+		rgb.resize(size_t(w) * 3);
+		return true;
+	}
+
+	bool read(uchar* row)
+	{
+		if(setjmp(error.jump) || d.output_scanline >= d.output_height)
+			return false;
+		JSAMPROW r = &rgb[0];
+		if(jpeg_read_scanlines(&d, &r, 1) != 1)
+			return false;
+		rgb32_pixels(&rgb[0], w, row);
+		return true;
+	}
+
+private:
+	FILE* f;
+	jpeg_decompress_struct d;
+	JpegError error;
+	bool created;
+	vector<uchar> rgb;
+};
+
+RowReader* open_row_reader(const char* filename, string& error)
+{
+	string ext = file_extension(filename);
+	if(ext == "tiles")
+		return open_tile_rows(filename, error);
+	if(ext != "bmp" && ext != "png" && ext != "jpg" && ext != "jpeg")
+	{
+		error = string(filename) + ": unknown format";
+		return 0;
+	}
+	FILE* f = filename_isfile(filename) ? fopen(filename, "rb") : 0;
+	if(!f)
+	{
+		error = string(filename) + ": no such file";
+		return 0;
+	}
+	string why;
+	bool ok;
+	RowReader* reader;
+	if(ext == "bmp")
+	{
+		BmpRowReader* bmp = new BmpRowReader(f);
+		ok = bmp->open(why);
+		reader = bmp;
+	}
+	else if(ext == "png")
+	{
+		PngRowReader* png = new PngRowReader(f);
+		ok = png->open(why);
+		reader = png;
+	}
+	else
+	{
+		JpegRowReader* jpeg = new JpegRowReader(f);
+		ok = jpeg->open(why);
+		reader = jpeg;
+	}
+	if(ok)
+		return reader;
+	delete reader;
+	error = string(filename) + ": " + (why.empty() ? "wrong format" : why);
+	return 0;
+}
+
+// The file is removed unless it's closed by finish()
+class FileRowWriter : public RowWriter
+{
+public:
+	FileRowWriter(FILE* f, const char* filename, int w, int h) : f(f), filename(filename), w(w), h(h), y(0) {}
+	~FileRowWriter()
+	{
+		if(f)
+		{
+			fclose(f);
+			remove(filename.c_str());
+		}
+	}
+
+protected:
+	bool close()
+	{
+		bool ok = fclose(f) == 0;
+		f = 0;
+		if(!ok)
+			remove(filename.c_str());
+		return ok;
+	}
+
+	FILE* f;
+	string filename;
+	int w, h;
+	int y;		// rows written
+};
+
+// Bottom-up as save_bmp() has it, each row seeked to
+class BmpRowWriter : public FileRowWriter
+{
+public:
+	BmpRowWriter(FILE* f, const char* filename, int w, int h) :
+		FileRowWriter(f, filename, w, h), line(bmp_row_bytes(w), 0) {}
+
+	bool open()
+	{
+		uchar header[BMP_HEADER];
+		bmp_header(header, w, h);
+		return fwrite(header, sizeof(header), 1, f) == 1;
+	}
+
+	bool write(const uchar* row)
+	{
+		if(y == h)
+			return false;
+		bgr_pixels(row, w, &line[0]);
+		long long pos = BMP_HEADER + (long long)(h - 1 - y) * line.size();
+		y++;
+		return seek_to(f, pos) && fwrite(&line[0], 1, line.size(), f) == line.size();
+	}
+
+	bool finish()
+	{
+		return y == h && close();
+	}
+
+private:
+	vector<uchar> line;
+};
+
+// The rows are filtered as save_png() does and deflated as one stream, an
+// IDAT chunk every PNG_STRIPE_BYTES of it
+class PngRowWriter : public FileRowWriter
+{
+public:
+	PngRowWriter(FILE* f, const char* filename, int w, int h) :
+		FileRowWriter(f, filename, w, h), started(false), prev(size_t(w) * 3, 0), cur(size_t(w) * 3),
+		trial(size_t(w) * 3), filtered(1 + size_t(w) * 3), out(PNG_STRIPE_BYTES)
+	{
+		memset(&z, 0, sizeof(z));
+	}
+	~PngRowWriter()
+	{
+		if(started)
+			deflateEnd(&z);
+	}
+
+	bool open()
+	{
+		if(deflateInit(&z, Z_DEFAULT_COMPRESSION) != Z_OK)
+			return false;
+		started = true;
+		z.next_out = &out[0];
+		z.avail_out = uInt(out.size());
+		return png_start(f, w, h);
+	}
+
+	bool write(const uchar* row)
+	{
+		if(y == h)
+			return false;
+		rgb_pixels(row, w, &cur[0]);
+		png_filter_row(&prev[0], &cur[0], cur.size(), &filtered[0], &trial[0]);
+		prev.swap(cur);
+		y++;
+		z.next_in = &filtered[0];
+		z.avail_in = uInt(filtered.size());
+		while(z.avail_in > 0)
+		{
+			if(deflate(&z, Z_NO_FLUSH) != Z_OK)
+				return false;
+			if(z.avail_out == 0 && !flush())
+				return false;
+		}
+		return true;
+	}
+
+	bool finish()
+	{
+		if(y != h)
+			return false;
+		int rc;
+		do
+		{
+			rc = deflate(&z, Z_FINISH);
+			if((rc != Z_OK && rc != Z_STREAM_END) || ((z.avail_out == 0 || rc == Z_STREAM_END) && !flush()))
+				return false;
+		}
+		while(rc != Z_STREAM_END);
+		return png_chunk(f, "IEND", 0, 0) && close();
+	}
+
+private:
+	// The deflated bytes so far as an IDAT chunk
+	bool flush()
+	{
+		size_t n = out.size() - z.avail_out;
+		z.next_out = &out[0];
+		z.avail_out = uInt(out.size());
+		return n == 0 || png_chunk(f, "IDAT", &out[0], n);
+	}
+
+	z_stream z;
+	bool started;
+	vector<uchar> prev, cur, trial, filtered, out;
+};
+
+class JpegRowWriter : public FileRowWriter
+{
+public:
+	JpegRowWriter(FILE* f, const char* filename, int w, int h) :
+		FileRowWriter(f, filename, w, h), created(false), rgb(size_t(w) * 3) {}
+	~JpegRowWriter()
+	{
+		if(created)
+			jpeg_destroy_compress(&c);
+	}
+
+	bool open(int quality)
+	{
+		c.err = jpeg_std_error(&error.pub);
+		error.pub.error_exit = jpeg_error_exit;
+		if(setjmp(error.jump))
+			return false;
+		jpeg_create_compress(&c);
+		created = true;
+		jpeg_stdio_dest(&c, f);
+		c.image_width = w;
+		c.image_height = h;
+		c.input_components = 3;
+		c.in_color_space = JCS_RGB;
+		jpeg_set_defaults(&c);
+		jpeg_set_quality(&c, quality, TRUE);
+		jpeg_start_compress(&c, TRUE);
+		return true;
+	}
+
+	bool write(const uchar* row)
+	{
+		if(y == h || setjmp(error.jump))
+			return false;
+		rgb_pixels(row, w, &rgb[0]);
+		JSAMPROW r = &rgb[0];
+		y++;
+		return jpeg_write_scanlines(&c, &r, 1) == 1;
+	}
+
+	bool finish()
+	{
+		if(y != h || setjmp(error.jump))
+			return false;
+		jpeg_finish_compress(&c);
+		return close();
+	}
+
+private:
+	jpeg_compress_struct c;
+	JpegError error;
+	bool created;
+	vector<uchar> rgb;
+};
+
+RowWriter* open_row_writer(const char* filename, int w, int h, string& error, int jpeg_quality)
+{
+	string ext = file_extension(filename);
+	if(ext != "bmp" && ext != "tiles" && ext != "png" && ext != "jpg" && ext != "jpeg")
+	{
+		error = string(filename) + ": can't write ." + ext + " files";
+		return 0;
+	}
+	if(w <= 0 || h <= 0)
+	{
+		error = string(filename) + ": the image is empty";
+		return 0;
+	}
+	if(ext == "tiles")
+		return create_tile_rows(filename, w, h, error);
+	FILE* f = fopen(filename, "wb");
+	if(!f)
+	{
+		error = string(filename) + ": can't create the file";
+		return 0;
+	}
+	bool ok;
+	RowWriter* writer;
+	if(ext == "bmp")
+	{
+		BmpRowWriter* bmp = new BmpRowWriter(f, filename, w, h);
+		ok = bmp->open();
+		writer = bmp;
+	}
+	else if(ext == "png")
+	{
+		PngRowWriter* png = new PngRowWriter(f, filename, w, h);
+		ok = png->open();
+		writer = png;
+	}
+	else
+	{
+		JpegRowWriter* jpeg = new JpegRowWriter(f, filename, w, h);
+		ok = jpeg->open(jpeg_quality);
+		writer = jpeg;
+	}
+	if(ok)
+		return writer;
+	delete writer;
+	error = string(filename) + ": write error";
+	return 0;
+}
+
+
+// Список литературы:
+//  [1] M. Adler, "pigz: A parallel implementation of gzip", https://zlib.net/pigz/
+//  [2] "PNG (Portable Network Graphics) Specification, Version 1.2", section 12.8, "Filter selection"
+//  [3] ITU-T Rec. T.81, "Digital compression and coding of continuous-tone still images", B.2.1, F.1.2.3
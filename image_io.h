@@ -0,0 +1,70 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <string>
+
+#include <fltk/Image.h>
+
+// Reading and writing image files, with no window needed. The images are
+// RGB32: 32 bit words 0xXXRRGGBB, one per pixel, rows one after another.
+
+// Decodes a BMP, JPEG or PNG file (by its extension) into a new RGB32 image,
+// or returns 0 with the reason in 'error'. Safe to call from several threads.
+// A file opened again, with the same modification time and size, is copied
+// from the decode cache instead.
+fltk::Image* load_image(const char* filename, std::string& error);
+
+// The decode cache keeps the images load_image() decoded, the least recently
+// used going when they pass the limit (64 MB by default; 0 turns it off)
+struct DecodeCacheStats
+{
+	unsigned long hits, misses, evictions;
+	size_t bytes, peak;	// of the pixels kept, now and at most
+	int images;
+};
+void set_decode_cache_limit(size_t bytes);
+DecodeCacheStats decode_cache_stats();
+
+// Writes the image as BMP, JPEG, PNG or a tile store (see tile_store.h), by the
+// extension; false, with the reason in 'error', if it can't. Large PNGs and JPEGs are compressed in
+// stripes, in parallel.
+bool save_image(const char* filename, const fltk::Image* img, std::string& error,
+	int jpeg_quality = 90);
+
+// Reading and writing a row at a time, for images too large to have in
+// memory whole: only a row or so and the codec's own state are kept. The rows
+// go top to bottom, RGB32, width() * 4 bytes each.
+class RowReader
+{
+public:
+	virtual ~RowReader() {}
+	int width() const { return w; }
+	int height() const { return h; }
+	// The next row into 'row'; false on a read error or past the last row
+	virtual bool read(uchar* row) = 0;
+
+protected:
+	int w, h;
+};
+
+class RowWriter
+{
+public:
+	// Without finish() the file is removed
+	virtual ~RowWriter() {}
+	virtual bool write(const uchar* row) = 0;
+	// After the last row; false if the file couldn't be completed
+	virtual bool finish() = 0;
+};
+
+// A BMP (uncompressed), JPEG, PNG (not interlaced) or tile store (see
+// tile_store.h) file opened to be read by rows, or 0 with the reason in 'error'
+RowReader* open_row_reader(const char* filename, std::string& error);
+// A BMP, JPEG, PNG or tile store file of w x h pixels created to be written by
+// rows, or 0 with the reason in 'error'
+RowWriter* open_row_writer(const char* filename, int w, int h, std::string& error, int jpeg_quality = 90);
+
+// The extension of a file name, lowercase and without the dot ("" if none)
+std::string file_extension(const char* filename);
+
+#endif
@@ -1,7 +1,16 @@
 
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <cmath>
+#include <string>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define INPAINT_SSE
+#endif
 
 #include <fltk/Image.h>
 
@@ -9,23 +18,26 @@
 #include "image.h"
 #include "flags.h"
 #include "mfmm.h"
+#include "arena.h"
+#include "inpaint.h"
+#include "distance.h"
+#include "checkpoint.h"
 
+using namespace std;
 using namespace fltk;
 
 
 // Fast marching method
 //
 
-float   B_radius = 5;					//the inpainting neighborhood radius
 const int   N = 0;					//window for smoothing during gradient computation
 							//(if N=0, no smoothing is attempted)
-int   dst_wt = 1;					//use dist-weighting in inpainting (t/f)
-int   lev_wt = 1;					//use level-weighting in inpainting (t/f)
+							//(the other settings are per call, see InpaintConfig)
 
 
-FIELD<float>* image2field(const Image* image)
+FIELD<float>* image2field(const Image* image, ARENA* arena = 0)
 {
-	FIELD<float>* f = new FIELD<float>(image->buffer_width(), image->buffer_height());
+	FIELD<float>* f = new FIELD<float>(image->buffer_width(), image->buffer_height(), arena);
 	float* data = f->data();
 	for(int y = 0; y < image->buffer_height(); y++)
 		for(int x = 0; x < image->buffer_width(); x++)
@@ -39,9 +51,9 @@ FIELD<float>* image2field(const Image* image)
 	return f;
 }
 
-IMAGE<float>* fltkimage2image(const Image* image)
+IMAGE<float>* fltkimage2image(const Image* image, ARENA* arena = 0)
 {
-	IMAGE<float>* f = new IMAGE<float>(image->buffer_width(), image->buffer_height());
+	IMAGE<float>* f = new IMAGE<float>(image->buffer_width(), image->buffer_height(), arena);
 	float *rd = f->r.data(), *gd = f->g.data(), *bd = f->b.data();
 	for(int y = 0; y < image->buffer_height(); y++)
 		for(int x = 0; x < image->buffer_width(); x++)
@@ -72,21 +84,28 @@ Image* image2fltkimage(IMAGE<float>* f)
 	return res;
 }
 
-FIELD<float>* compute_distance(FIELD<float>* fi,float k,float maxd)
+FIELD<float>* compute_distance(FIELD<float>* fi,float k,float maxd,int method,bool quiet,ARENA* arena = 0)
 {
+   if (method == DISTANCE_EDT)				//exact EDT: no marching, no field copies
+      return compute_distance_edt(fi,k,maxd,arena);
+   if (method == DISTANCE_SWEEP)			//fast sweeping, parallel
+      return compute_distance_sweep(fi,k,maxd,arena);
+
    int nfail,nextr;
-   FIELD<float>*    fin = new FIELD<float>(*fi);	//Copy input field 
-   FLAGS*   	flagsin = new FLAGS(*fin,k);		//Make flags field
-   FLAGS*       fcopy   = new FLAGS(*flagsin);          //Copy flags field for combining the two fields afterwards
+   FIELD<float>*    fin = new FIELD<float>(*fi,arena);	//Copy input field 
+   FLAGS*   	flagsin = new FLAGS(*fin,k,arena);	//Make flags field
+   FLAGS*       fcopy   = new FLAGS(*flagsin,arena);    //Copy flags field for combining the two fields afterwards
    FastMarchingMethod fmmi(fin,flagsin);
+   fmmi.quiet(quiet);
    fmmi.execute(nfail,nextr);
 
-   FIELD<float>*   fout = new FIELD<float>(*fi);	//Copy input field 
-   FLAGS*      flagsout = new FLAGS(*fout,-k);		//Make flags field    
+   FIELD<float>*   fout = new FIELD<float>(*fi,arena);	//Copy input field 
+   FLAGS*      flagsout = new FLAGS(*fout,-k,arena);	//Make flags field    
    FastMarchingMethod fmmo(fout,flagsout);
-   fmmo.execute(nfail,nextr,2*B_radius);		//Executr FMM only in a band 2*B_radius deep, we need no more
+   fmmo.quiet(quiet);
+   fmmo.execute(nfail,nextr,maxd);			//Executr FMM only in a band maxd deep, we need no more
 
-   FIELD<float>* f = new FIELD<float>(*fin);		//Combine in and out-fields in a single distance field 'f'
+   FIELD<float>* f = new FIELD<float>(*fin,arena);	//Combine in and out-fields in a single distance field 'f'
    for(int i=0;i<f->dimX();i++)			
      for(int j=0;j<f->dimY();j++)
      {
@@ -103,7 +122,7 @@ const float S8 = S/8;
 const float SG = 3*S/4 - G;
 const float S4 = -4*S;
 
-float w[5][5] = {{S8, 0, SG, 0, S8},{0, 0, S4, 0, 0},
+const float w[5][5] = {{S8, 0, SG, 0, S8},{0, 0, S4, 0, 0},
 {SG, S4, 1+4*G+12.5f*S, S4, SG},{0, 0, S4, 0, 0},{S8, 0, SG, 0, S8}};
 
 void gradient_filter(FIELD<float>* f,int i,int j,float& gx,float& gy)	//compute gradient of f[i][j] in gx,gy
@@ -124,63 +143,217 @@ void gradient_filter(FIELD<float>* f,int i,int j,float& gx,float& gy)	//compute
   gx /= r; gy /= r;
 }
 
-void gradient(FIELD<float>* f,int i,int j,float& gx,float& gy)	//compute gradient of f[i][j] in gx,gy
-{
-  gx = gy = 0;  float ci = 0, cj = 0; float wsi = 0, wsj = 0;
-  
-  const int N=0;
-  for(int ii=0;ii<=N;ii++)
-      for(int jj=-N;jj<=N;jj++)
+void gradient_row(const float* f,const float* fd,int x0,int x1,Vec2* g)
+{								//unit forward-difference gradient of the row 'f' (fd: the row
+  int x = x0;							//below it) for x in [x0,x1), written to g[0..x1-x0) as (gx,gy) pairs
+#ifdef INPAINT_SSE
+  const __m128 tiny = _mm_set1_ps(1.0e-10f), one = _mm_set1_ps(1);
+  const __m128 half = _mm_set1_ps(0.5f), three = _mm_set1_ps(3);
+  for(;x+4<=x1;x+=4,g+=4)
+  {
+    __m128 c  = _mm_loadu_ps(f+x);
+    __m128 gx = _mm_sub_ps(_mm_loadu_ps(f+x+1),c);
+    __m128 gy = _mm_sub_ps(_mm_loadu_ps(fd+x),c);
+    __m128 r2 = _mm_add_ps(_mm_mul_ps(gx,gx),_mm_mul_ps(gy,gy));
+    __m128 y  = _mm_rsqrt_ps(r2);				//12 bits, one Newton step gives almost full precision
+    y = _mm_mul_ps(_mm_mul_ps(half,y),_mm_sub_ps(three,_mm_mul_ps(r2,_mm_mul_ps(y,y))));
+    __m128 m  = _mm_cmpgt_ps(r2,tiny);				//normalize only if |grad| > 0.00001
+    y = _mm_or_ps(_mm_and_ps(m,y),_mm_andnot_ps(m,one));
+    gx = _mm_mul_ps(gx,y); gy = _mm_mul_ps(gy,y);
+    _mm_storeu_ps(&g[0].x,_mm_unpacklo_ps(gx,gy));
+    _mm_storeu_ps(&g[2].x,_mm_unpackhi_ps(gx,gy));
+  }
+#endif
+  for(;x<x1;x++,g++)
+  {
+    float gx = f[x+1]-f[x], gy = fd[x]-f[x];
+    float r2 = gx*gx+gy*gy;
+    float y  = (r2>1.0e-10f)? 1/sqrt(r2) : 1;
+    g->x = gx*y; g->y = gy*y;
+  }
+}
+
+FIELD<Vec2>* compute_gradient(FIELD<float>* f,const FLAGS* flags,Coord& org,ARENA* arena = 0)
+{								//compute gradient of 'f', as (gx,gy) pairs, on the box of the
+  int nx = f->dimX(), ny = f->dimY();				//pixels 'flags' does not know: the inpainting needs no other.
+  int x0 = nx, y0 = ny, x1 = -1, y1 = -1;			//The box starts at 'org' in 'f'.
+  const int* fl = flags->data();
+  for(int j=0;j<ny;j++)
+    for(int i=0;i<nx;i++)
+      if (fl[j*nx+i]!=FLAGS::ALIVE)
       {
-        ci += f->value(i+ii+1,j+jj)-f->value(i+ii,j+jj);
-        cj += f->value(i+ii,j+jj+1)-f->value(i+ii,j+jj);
+        if (i<x0) x0 = i;
+        if (i>x1) x1 = i;
+        if (j<y0) y0 = j;
+        if (j>y1) y1 = j;
       }
-  const float SZ = 2*N+1;
 
-  gx = ci/SZ; gy = cj/SZ;                             //normalize gradient
-  float r = sqrt(gx*gx+gy*gy);
-  if (r>0.00001) { gx /= r; gy /= r; }
+  org = Coord(x0,y0);
+  if (x1<x0) return new FIELD<Vec2>(0,0,arena);		//nothing to inpaint
+
+  int w = x1-x0+1, h = y1-y0+1;
+  FIELD<Vec2>* g = new FIELD<Vec2>(w,h,arena);
+  const Vec2 zero = {0,0};
+  int a = (x0>N+1)? x0 : N+1, b = (x1<nx-N-2)? x1+1 : nx-N-1;	//columns [a,b) have all the neighbours needed,
+  for(int j=0;j<h;j++)						//the others are 0, as are the image's border rows
+  {
+     Vec2* row = g->data()+j*w; int y = y0+j, x;
+     if (y<N+1 || y>=ny-N-1 || a>=b)
+     {  for(x=0;x<w;x++) row[x] = zero; continue;  }
+     for(x=x0;x<a;x++) row[x-x0] = zero;
+     for(x=b;x<=x1;x++) row[x-x0] = zero;
+     if (N)							//N>0? Use gradient-computation by smoothing
+       for(x=a;x<b;x++)						//with a filter-size of N pixels
+         gradient_filter(f,x,y,row[x-x0].x,row[x-x0].y);
+     else							//N=0? Use no smoothing, compute gradient directly
+       gradient_row(f->data()+y*nx,f->data()+(y+1)*nx,a,b,row+a-x0);	//by forward differences, a whole row at once
+  }
+  return g;
 }
 
-void compute_gradient(FIELD<float>* f,FIELD<float>*& gx,FIELD<float>*& gy)
-{								//compute gradient of 'f' in 'gx','gy'
-  gx = new FIELD<float>(f->dimX(),f->dimY()); *gx = 0;			
-  gy = new FIELD<float>(f->dimX(),f->dimY()); *gy = 0;
-
-  int i,j;
-  if (N)							//N>0? Use gradient-computation by smoothing
-    for(i=N+1;i<f->dimX()-N-1;i++)				//with a filter-size of N pixels
-       for(j=N+1;j<f->dimY()-N-1;j++)
-          gradient_filter(f,i,j,gx->value(i,j),gy->value(i,j));
-  else								//N=0? Use no smoothing, compute gradient directly
-     for(i=N+1;i<f->dimX()-N-1;i++)				//by central differences.
-       for(j=N+1;j<f->dimY()-N-1;j++)
-          gradient(f,i,j,gx->value(i,j),gy->value(i,j));
+// The state of the marching kept in a checkpoint: the distance and the
+// gradient fields are made again from the mask when resuming
+enum FastMarchingSection
+{
+	FMM_F = 1,
+	FMM_FLAGS,
+	FMM_RED,
+	FMM_GREEN,
+	FMM_BLUE,
+	FMM_ROWS = 5,		// the sections above are images
+	FMM_NARROWBAND = 6
+};
+
+struct FastMarchingProgress
+{
+	CheckpointWriter* saver;
+	ModifiedFastMarchingMethod* mfmm;
+	volatile bool* stop;
+	bool stopped;
+	vector<FastMarchingMethod::NarrowbandPoint> band;
+
+	FastMarchingProgress(ModifiedFastMarchingMethod* mfmm, volatile bool* stop) :
+		saver(0), mfmm(mfmm), stop(stop), stopped(false) {}
+};
+
+static int fast_marching_progress(void* arg)
+{
+	FastMarchingProgress* p = (FastMarchingProgress*)arg;
+	p->stopped = p->stop && *p->stop;
+	if(p->saver && (p->stopped || p->saver->due()))
+	{
+		p->mfmm->narrowband(p->band);
+		const void* blob = p->band.empty() ? 0 : &p->band[0];
+		size_t size = p->band.size() * sizeof(p->band[0]);
+		p->saver->snapshot(&blob, &size);
+	}
+	return p->stopped;
 }
 
-Image* inpaint_fast_marching(const Image* image, const Image* mask)
+static bool resume_fast_marching(const char* path, unsigned long long key, int w, int h,
+	void* const* rows, ModifiedFastMarchingMethod& mfmm)
+{
+	CheckpointReader file;
+	if(!file.open(path, CHECKPOINT_FAST_MARCHING, key, w, h))
+		return false;
+	const void* saved[FMM_ROWS];
+	for(int k = 0; k < FMM_ROWS; k++)
+	{
+		size_t size;
+		saved[k] = file.section(FMM_F + k, &size);
+		if(!saved[k] || size != size_t(w) * h * 4)
+			return false;
+	}
+	size_t band_size;
+	const FastMarchingMethod::NarrowbandPoint* band =
+		(const FastMarchingMethod::NarrowbandPoint*)file.section(FMM_NARROWBAND, &band_size);
+	if(!band || band_size % sizeof(*band))
+		return false;
+	for(int k = 0; k < FMM_ROWS; k++)
+		memcpy(rows[k], saved[k], size_t(w) * h * 4);
+	mfmm.narrowband(band, int(band_size / sizeof(*band)));
+	return true;
+}
+
+Image* inpaint_fast_marching(const Image* image, const Image* mask, const InpaintConfig& config, ARENA* arena)
 {
 	assert(image->buffer_width() == mask->buffer_width());
 	assert(image->buffer_height() == mask->buffer_height());
 
-	FIELD<float>* f = image2field(mask);
-	IMAGE<float>* rgb_image = fltkimage2image(image);
+	ARENA job_arena;	// used when the caller has none to share
+	if(!arena)
+		arena = &job_arena;
+
+	FIELD<float>* f = image2field(mask, arena);
+	IMAGE<float>* rgb_image = fltkimage2image(image, arena);
 
 	float k = -1; //Threshold
 
-	FLAGS* flags = new FLAGS(*f,k);
-	FIELD<float> *grad_x, *grad_y;
-	FIELD<float>* dist    = compute_distance(f,k,2*B_radius);          //compute complete distance field in a band 2*B_radius around the inpainting zone
-	compute_gradient(dist,grad_x,grad_y);                //compute smooth gradient of distance field
+	FLAGS* flags = new FLAGS(*f,k,arena);
+	Coord grad_org;
+	FIELD<float>* dist    = compute_distance(f,k,2*config.B_radius,config.dist_method,config.quiet,arena);	//compute complete distance field in a band 2*B_radius around the inpainting zone
+	FIELD<Vec2>*  grad    = compute_gradient(dist,flags,grad_org,arena);	//compute smooth gradient of distance field, where it is used
+	if(config.dump)
+	{
+		string name = string(config.dump) + "-distance.pfm";
+		dist->writePFM(&name[0]);
+		name = string(config.dump) + "-gradient.raw";
+		grad->writeRaw(&name[0]);
+	}
 
 	// inpaint()
 	int nfail,nextr;
-	FLAGS* fl = new FLAGS(*flags); FIELD<float>* ff = new FIELD<float>(*f);
-	ModifiedFastMarchingMethod mfmm(ff,fl,rgb_image,grad_x,grad_y,dist,int(B_radius),dst_wt,lev_wt,1000000);
-	mfmm.execute(nfail,nextr); delete fl; delete ff; 
+	FLAGS* fl = new FLAGS(*flags,arena); FIELD<float>* ff = new FIELD<float>(*f,arena);
+	ModifiedFastMarchingMethod mfmm(ff,fl,rgb_image,grad,grad_org,dist,int(config.B_radius),config.dst_wt,config.lev_wt,1000000);
+
+	// Checkpoints: the fields the marching changes are saved every so often
+	const CheckpointConfig& checkpoint = config.checkpoint;
+	FastMarchingProgress progress(&mfmm, checkpoint.stop);
+	if(checkpoint.path)
+	{
+		int w = f->dimX(), h = f->dimY();
+		unsigned long long salt = (unsigned long long)(config.B_radius * 1000) ^
+			(config.dst_wt << 20) ^ (config.lev_wt << 21) ^ ((unsigned long long)config.dist_method << 22);
+		unsigned long long key = checkpoint_key(image, mask, salt);
+		void* rows[FMM_ROWS] = { ff->data(), fl->data(),
+			rgb_image->r.data(), rgb_image->g.data(), rgb_image->b.data() };
+		if(checkpoint.resume && resume_fast_marching(checkpoint.path, key, w, h, rows, mfmm) && !config.quiet)
+			printf("inpaint: resumed from %s\n", checkpoint.path);
+		progress.saver = new CheckpointWriter(checkpoint.path, CHECKPOINT_FAST_MARCHING, key, w, h,
+			checkpoint.every);
+		for(int k = 0; k < FMM_ROWS; k++)
+			progress.saver->add_rows(FMM_F + k, rows[k], w * 4);
+		progress.saver->add_blob(FMM_NARROWBAND);
+		mfmm.mark_rows(progress.saver->dirty_rows());
+	}
+	mfmm.quiet(config.quiet);
+	if(progress.saver || progress.stop)
+		mfmm.progress(fast_marching_progress, &progress);
+	mfmm.execute(nfail,nextr);
+	if(config.dump)
+	{
+		string name = string(config.dump) + "-arrival.pfm";
+		ff->writePFM(&name[0]);
+	}
+	if(progress.saver)
+	{
+		progress.saver->finish();
+		if(!config.quiet)
+			printf("inpaint: %d checkpoints, the marching stopped for %.1f ms at most\n",
+				progress.saver->written(), progress.saver->longest_stop() * 1000);
+		delete progress.saver;
+		if(!progress.stopped)
+			remove(checkpoint.path);
+	}
 	rgb_image->normalize();
 
-	return image2fltkimage(rgb_image);
+	Image* res = image2fltkimage(rgb_image);
+
+	// the fields keep only their headers on the heap, the values go away with the arena
+	delete fl; delete ff; delete flags; delete f;
+	delete dist; delete grad; delete rgb_image;
+	arena->reset();
+	return res;
 }
 
 //  :
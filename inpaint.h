@@ -0,0 +1,86 @@
+#ifndef INPAINT_H
+#define INPAINT_H
+
+#include <string>
+#include <vector>
+
+#include <fltk/Image.h>
+
+#include "checkpoint.h"
+#include "distance_method.h"
+#include "patch_index.h"
+
+// Settings of a fast marching inpaint. Each call works on its own copy, so
+// any number of inpaints can run in parallel threads.
+struct InpaintConfig
+{
+	float B_radius;		// the inpainting neighborhood radius
+	int dst_wt;		// use dist-weighting in inpainting (t/f)
+	int lev_wt;		// use level-weighting in inpainting (t/f)
+	int dist_method;	// how the distance field is built (see distance.h)
+	const char* dump;	// if set, the distance field and the arrival times are written to
+				// DUMP-distance.pfm and DUMP-arrival.pfm, the gradient of the
+				// distance to DUMP-gradient.raw (see binio.h)
+	CheckpointConfig checkpoint;
+	bool quiet;		// nothing on stdout: no marching iteration or checkpoint reports
+
+	InpaintConfig() : B_radius(5), dst_wt(1), lev_wt(1), dist_method(DISTANCE_FMM), dump(0), checkpoint(), quiet(false) {}
+};
+
+class ARENA;
+
+// All the intermediate fields of the inpaint live in 'arena' (or in a private
+// one, if none is given), which is reset before returning. Reusing the same
+// arena for jobs of the same size avoids any heap traffic after the first one;
+// an arena can't be shared by inpaints running at the same time.
+fltk::Image* inpaint_fast_marching(const fltk::Image* image, const fltk::Image* mask,
+	const InpaintConfig& config = InpaintConfig(), ARENA* arena = 0);
+// How inpaint_criminisi() looks for the patch to copy
+enum ExemplarSearch
+{
+	SEARCH_EXHAUSTIVE,	// every patch of the image (Criminisi's original)
+	SEARCH_PATCHMATCH,	// approximate, with a PatchMatch nearest neighbour field
+	SEARCH_LOCAL,		// every patch in a window around the one being filled
+	SEARCH_DESCRIPTORS	// nearest PCA descriptors in a kd-tree or VP-tree, then exact SSE
+};
+
+struct CriminisiConfig
+{
+	int search;		// see ExemplarSearch
+	int search_radius;	// SEARCH_LOCAL: half the size of the window
+	float grow_above;	// SEARCH_LOCAL: the window is doubled while the best match's
+				// SSE per known pixel is over this; < 0: it never grows
+	int index_kind;		// SEARCH_DESCRIPTORS: PointIndexKind of the descriptor index
+	int candidates;		// SEARCH_DESCRIPTORS: nearest descriptors compared exactly
+	int levels;		// multi-scale: levels of the pyramid under the image (0: none,
+				// -1: pyramid_depth() for a hole 32 pixels thick at the top)
+	int nnf_radius;		// multi-scale: window around the source inherited from the
+				// coarser level, searched first
+	int batch;		// patches filled per iteration, the ones of highest priority
+				// not overlapping each other; they are searched in parallel
+	CheckpointConfig checkpoint;	// of the full size fill only, in the multi-scale mode
+	bool quiet;		// nothing on stdout: no points left, checkpoint or descriptor index reports
+
+	CriminisiConfig() : search(SEARCH_EXHAUSTIVE), search_radius(64), grow_above(1000),
+		index_kind(INDEX_KDTREE), candidates(32), levels(0), nnf_radius(2), batch(1), checkpoint(),
+		quiet(false) {}
+};
+
+// With levels, every scale is filled from the coarsest up, and 'level_seconds'
+// gets the time each of them took in that order
+fltk::Image* inpaint_criminisi(const fltk::Image* image, const fltk::Image* mask,
+	const CriminisiConfig& config = CriminisiConfig(), std::vector<double>* level_seconds = 0);
+
+// The settings of an inpaint given as an operation, "fmm:..." or
+// "criminisi:..." (see run_operation()), with its mask file if the spec names
+// one
+struct InpaintSettings
+{
+	bool criminisi;
+	InpaintConfig fast_marching;
+	CriminisiConfig criminisi_config;
+	std::string mask;
+};
+bool parse_inpaint(const char* spec, InpaintSettings& settings, std::string& error);
+
+#endif
@@ -0,0 +1,476 @@
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fltk/Image.h>
+#include <fltk/filename.h>
+#include <fltk/run.h>
+#include <fltk/Threads.h>
+
+#include "inpaint_batch.h"
+#include "image_io.h"
+#include "inpaint.h"
+#include "operations.h"
+#include "parallel.h"
+#include "arena.h"
+
+using namespace std;
+using namespace fltk;
+
+
+struct InpaintJob
+{
+	int line;			// in the manifest
+	string image, mask, algorithm, output;
+	InpaintSettings settings;
+
+	Image* img;
+	Image* mask_img;
+	Image* result;
+	string error;			// empty while all is well
+
+	double start;			// when its reading began
+	double decode, inpaint, encode, latency;	// seconds
+	size_t image_bytes;		// image, mask and result
+	size_t scratch_bytes;		// peak of the arena, fast marching only
+	size_t peak_rss;		// of the process, once written
+};
+
+// A queue of jobs between two stages of the pipeline, holding 'capacity' of
+// them at most: push() waits for room, pop() for a job
+class JobQueue
+{
+public:
+	JobQueue(size_t capacity) : lock(), jobs(), capacity(capacity), closed(false) {}
+
+	void push(InpaintJob* job)
+	{
+		lock.lock();
+		while(jobs.size() >= capacity)
+			lock.wait();
+		jobs.push_back(job);
+		lock.signal();
+		lock.unlock();
+	}
+
+	// 0 once the queue is closed and empty
+	InpaintJob* pop()
+	{
+		lock.lock();
+		while(jobs.empty() && !closed)
+			lock.wait();
+		InpaintJob* job = 0;
+		if(!jobs.empty())
+		{
+			job = jobs.front();
+			jobs.pop_front();
+			lock.signal();
+		}
+		lock.unlock();
+		return job;
+	}
+
+	// No more jobs will come
+	void close()
+	{
+		lock.lock();
+		closed = true;
+		lock.signal();
+		lock.unlock();
+	}
+
+private:
+	SignalMutex lock;
+	deque<InpaintJob*> jobs;
+	size_t capacity;
+	bool closed;
+};
+
+struct Pipeline
+{
+	vector<InpaintJob>& jobs;
+	JobQueue decoded, inpainted;
+
+	SignalMutex lock;		// guards the counts below
+	int inpainters;			// inpaint threads still taking jobs
+	int running;			// threads not finished yet
+
+	Pipeline(vector<InpaintJob>& jobs, int n) :
+		jobs(jobs), decoded(n), inpainted(n), inpainters(n), running(0) {}
+};
+
+static size_t image_bytes(const Image* img)
+{
+	return img ? size_t(img->buffer_width()) * img->buffer_height() * 4 : 0;
+}
+
+static void thread_done(Pipeline* p)
+{
+	p->lock.lock();
+	p->running--;
+	p->lock.signal();
+	p->lock.unlock();
+}
+
+static void* decode_thread(void* arg)
+{
+	Pipeline* p = (Pipeline*)arg;
+	for(size_t k = 0; k < p->jobs.size(); k++)
+	{
+		InpaintJob& job = p->jobs[k];
+		job.start = get_time_secs();
+		job.img = load_image(job.image.c_str(), job.error);
+		if(job.img)
+			job.mask_img = load_image(job.mask.c_str(), job.error);
+		if(job.mask_img && (job.mask_img->buffer_width() != job.img->buffer_width() ||
+		 job.mask_img->buffer_height() != job.img->buffer_height()))
+			job.error = job.mask + ": not the size of the image";
+		job.decode = get_time_secs() - job.start;
+		p->decoded.push(&job);
+	}
+	p->decoded.close();
+	thread_done(p);
+	return 0;
+}
+
+static void* inpaint_thread(void* arg)
+{
+	Pipeline* p = (Pipeline*)arg;
+	ARENA arena;	// this thread's jobs, one after another
+	while(InpaintJob* job = p->decoded.pop())
+	{
+		if(job->error.empty())
+		{
+			double t = get_time_secs();
+			if(job->settings.criminisi)
+				job->result = inpaint_criminisi(job->img, job->mask_img, job->settings.criminisi_config);
+			else
+			{
+				job->result = inpaint_fast_marching(job->img, job->mask_img, job->settings.fast_marching,
+					&arena);
+				job->scratch_bytes = arena.job_peak();
+			}
+			job->inpaint = get_time_secs() - t;
+			if(!job->result)
+				job->error = "the inpaint failed";
+		}
+		job->image_bytes = image_bytes(job->img) + image_bytes(job->mask_img) + image_bytes(job->result);
+		delete job->img;
+		delete job->mask_img;
+		job->img = job->mask_img = 0;
+		p->inpainted.push(job);
+	}
+
+	p->lock.lock();
+	bool last = --p->inpainters == 0;
+	p->lock.unlock();
+	if(last)
+		p->inpainted.close();
+	thread_done(p);
+	return 0;
+}
+
+static bool start_thread(void* (*f)(void*), Pipeline* p)
+{
+	p->lock.lock();
+	p->running++;
+	p->lock.unlock();
+	Thread t;
+	int rc = create_thread(t, f, p);
+#ifdef _WIN32
+	bool ok = rc != -1;
+#else
+	bool ok = rc == 0;
+	if(ok)
+		pthread_detach(t);
+#endif
+	if(!ok)
+		thread_done(p);
+	return ok;
+}
+
+
+// The fields of a manifest line: blanks separate them, double quotes keep
+// blanks in one, '#' outside quotes ends the line
+static void split_fields(const string& line, vector<string>& fields)
+{
+	fields.clear();
+	size_t k = 0;
+	for(;;)
+	{
+		while(k < line.size() && isspace((unsigned char)line[k]))
+			k++;
+		if(k == line.size() || line[k] == '#')
+			return;
+		string field;
+		bool quoted = false;
+		for(; k < line.size() && (quoted || !isspace((unsigned char)line[k])); k++)
+		{
+			if(line[k] == '"')
+				quoted = !quoted;
+			else
+				field += line[k];
+		}
+		fields.push_back(field);
+	}
+}
+
+static bool read_manifest(const char* path, const char* output_dir, vector<InpaintJob>& jobs)
+{
+	FILE* f = fopen(path, "r");
+	if(!f)
+	{
+		fprintf(stderr, "%s: can't open\n", path);
+		return false;
+	}
+	bool ok = true;
+	string line;
+	vector<string> fields;
+	char chunk[1024];
+	int number = 0;
+	while(fgets(chunk, sizeof(chunk), f))
+	{
+		line += chunk;
+		if(line[line.size() - 1] != '\n' && !feof(f))
+			continue;
+		number++;
+		split_fields(line, fields);
+		line.clear();
+		if(fields.empty())
+			continue;
+
+		InpaintJob job;
+		job.line = number;
+		string error;
+		if(fields.size() < 3 || fields.size() > 4)
+			error = "expected IMAGE MASK ALGORITHM [OUTPUT]";
+		else if(!parse_inpaint(fields[2].c_str(), job.settings, error))
+			;
+		else if(!job.settings.mask.empty())
+			error = "the mask goes in the second field, not in the algorithm";
+		else if(fields.size() < 4 && !output_dir)
+			error = "no OUTPUT, and no --output directory";
+		if(!error.empty())
+		{
+			fprintf(stderr, "%s:%d: %s\n", path, number, error.c_str());
+			ok = false;
+			continue;
+		}
+		job.image = fields[0];
+		job.mask = fields[1];
+		job.algorithm = fields[2];
+		if(fields.size() == 4)
+			job.output = fields[3];
+		else
+		{
+			job.output = output_dir;
+			char last = job.output[job.output.size() - 1];
+			if(last != '/' && last != '\\')
+				job.output += '/';
+			job.output += filename_name(job.image.c_str());
+		}
+		// the report of the jobs is the batch's
+		job.settings.fast_marching.quiet = job.settings.criminisi_config.quiet = true;
+		job.img = job.mask_img = job.result = 0;
+		job.start = job.decode = job.inpaint = job.encode = job.latency = 0;
+		job.image_bytes = job.scratch_bytes = job.peak_rss = 0;
+		jobs.push_back(job);
+	}
+	fclose(f);
+	return ok;
+}
+
+// A CSV field, quoted if it has to be
+static void put_csv(FILE* f, const string& s)
+{
+	if(s.find_first_of(",\"\r\n") == string::npos)
+	{
+		fputs(s.c_str(), f);
+		return;
+	}
+	fputc('"', f);
+	for(size_t k = 0; k < s.size(); k++)
+	{
+		if(s[k] == '"')
+			fputc('"', f);
+		fputc(s[k], f);
+	}
+	fputc('"', f);
+}
+
+static void report_job(FILE* csv, const InpaintJob& job, int w, int h)
+{
+	if(job.error.empty())
+		printf("%s -> %s: %dx%d, read %.1f ms, inpaint %.1f ms, write %.1f ms, latency %.1f ms\n",
+			job.image.c_str(), job.output.c_str(), w, h, job.decode * 1000, job.inpaint * 1000,
+			job.encode * 1000, job.latency * 1000);
+	else
+		fprintf(stderr, "line %d: %s\n", job.line, job.error.c_str());
+	fflush(stdout);
+	if(!csv)
+		return;
+
+	fprintf(csv, "%d,", job.line);
+	put_csv(csv, job.image);
+	fputc(',', csv);
+	put_csv(csv, job.mask);
+	fputc(',', csv);
+	put_csv(csv, job.algorithm);
+	fputc(',', csv);
+	put_csv(csv, job.output);
+	fprintf(csv, ",%d,%d,%s,%.3f,%.3f,%.3f,%.3f,%lu,%lu,%lu,", w, h, job.error.empty() ? "ok" : "failed",
+		job.decode * 1000, job.inpaint * 1000, job.encode * 1000, job.latency * 1000,
+		(unsigned long)(job.image_bytes >> 10), (unsigned long)(job.scratch_bytes >> 10),
+		(unsigned long)(job.peak_rss >> 10));
+	put_csv(csv, job.error);
+	fputc('\n', csv);
+	fflush(csv);
+}
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: image-editor --manifest FILE [--jobs N] [--output DIR] [--report CSV]\n"
+		"  FILE: one job per line, IMAGE MASK ALGORITHM [OUTPUT], ALGORITHM one of\n"
+		"    fmm:radius=5,distance=fmm|edt|sweep\n"
+		"    criminisi:search=exhaustive|patchmatch|local|kdtree|vptree,batch=1,levels=0\n"
+		"  --jobs N      inpaints running at a time (default: one per processor)\n"
+		"  --output DIR  where the results go when the line has no OUTPUT\n"
+		"  --report CSV  times and memory of every job\n");
+}
+
+int inpaint_batch_main(int argc, char** argv)
+{
+	const char* manifest = 0;
+	const char* output_dir = 0;
+	const char* report = 0;
+	int n = 0;
+	for(int k = 1; k < argc; k++)
+	{
+		const char* a = argv[k];
+		if(strcmp(a, "--help") == 0 || strcmp(a, "-h") == 0)
+		{
+			usage();
+			return 0;
+		}
+		if(k + 1 == argc || (strcmp(a, "--manifest") != 0 && strcmp(a, "--jobs") != 0 &&
+		 strcmp(a, "--output") != 0 && strcmp(a, "--report") != 0))
+		{
+			fprintf(stderr, "%s: unknown option or missing value\n", a);
+			usage();
+			return 2;
+		}
+		const char* value = argv[++k];
+		if(strcmp(a, "--manifest") == 0)
+			manifest = value;
+		else if(strcmp(a, "--output") == 0)
+			output_dir = value;
+		else if(strcmp(a, "--report") == 0)
+			report = value;
+		else if((n = atoi(value)) <= 0)
+		{
+			fprintf(stderr, "--jobs: not a positive number: %s\n", value);
+			return 2;
+		}
+	}
+	if(!manifest)
+	{
+		usage();
+		return 2;
+	}
+
+	vector<InpaintJob> jobs;
+	if(!read_manifest(manifest, output_dir, jobs))
+		return 2;
+	if(jobs.empty())
+		return 0;
+	FILE* csv = 0;
+	if(report)
+	{
+		csv = fopen(report, "w");
+		if(!csv)
+		{
+			fprintf(stderr, "%s: can't create\n", report);
+			return 1;
+		}
+		fprintf(csv, "line,image,mask,algorithm,output,width,height,status,read_ms,inpaint_ms,write_ms,"
+			"latency_ms,images_kb,scratch_kb,process_peak_rss_kb,error\n");
+	}
+
+	// The processors are shared out between the inpaints; each of them
+	// spreads its parallel_for()s over its share
+	int cores = worker_count();
+	if(n == 0)
+		n = cores;
+	if(n > int(jobs.size()))
+		n = int(jobs.size());
+	set_worker_count(cores / n > 1 ? cores / n : 1);
+
+	double t = get_time_secs();
+	Pipeline p(jobs, n);
+	bool started = start_thread(decode_thread, &p);
+	int inpainters = 0;
+	for(int k = 0; started && k < n; k++)
+		if(start_thread(inpaint_thread, &p))
+			inpainters++;
+	if(!started || inpainters == 0)
+	{
+		fprintf(stderr, "can't start the threads\n");
+		exit(1);	// the pipeline can't be taken apart with a job in it
+	}
+	if(inpainters < n)
+	{
+		p.lock.lock();
+		p.inpainters -= n - inpainters;
+		p.lock.unlock();
+	}
+
+	int failed = 0;
+	double pixels = 0;
+	while(InpaintJob* job = p.inpainted.pop())
+	{
+		int w = 0, h = 0;
+		if(job->result)
+		{
+			w = job->result->buffer_width();
+			h = job->result->buffer_height();
+			double e = get_time_secs();
+			save_image(job->output.c_str(), job->result, job->error);
+			job->encode = get_time_secs() - e;
+			delete job->result;
+			job->result = 0;
+		}
+		job->latency = get_time_secs() - job->start;
+		job->peak_rss = peak_rss();
+		if(job->error.empty())
+			pixels += double(w) * h;
+		else
+			failed++;
+		report_job(csv, *job, w, h);
+	}
+
+	p.lock.lock();
+	while(p.running)
+		p.lock.wait();
+	p.lock.unlock();
+	t = get_time_secs() - t;
+	set_worker_count(0);
+	if(csv)
+		fclose(csv);
+
+	int done = int(jobs.size()) - failed;
+	printf("%d jobs in %.3f s, %d at a time: %.2f jobs/s, %.2f Mpixel/s, peak RSS %lu KB", done, t, n,
+		t > 0 ? done / t : 0, t > 0 ? pixels / t / 1e6 : 0, (unsigned long)(peak_rss() >> 10));
+	if(failed)
+		printf(", %d failed", failed);
+	DecodeCacheStats cache = decode_cache_stats();
+	if(cache.hits)
+		printf(", decode cache: %lu hits, %lu misses", cache.hits, cache.misses);
+	printf("\n");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef INPAINT_BATCH_H
+#define INPAINT_BATCH_H
+
+// Inpaints a list of images, each with its own mask and settings:
+//
+//   image-editor --manifest FILE [--jobs N] [--output DIR] [--report CSV]
+//
+// FILE has one job per line, "IMAGE MASK ALGORITHM [OUTPUT]", ALGORITHM being
+// an inpaint operation without its mask ("fmm:radius=3", "criminisi:search=
+// kdtree,levels=-1", see run_operation()). Fields holding spaces go in double
+// quotes, and '#' starts a comment. Without OUTPUT the result goes to DIR,
+// under the name of the image.
+//
+// The jobs go through a pipeline: one thread reads the images and masks, N
+// threads inpaint them and the calling thread writes the results, with a
+// queue of at most N jobs between the stages. Reading and writing overlap the
+// inpaints, and no more than 3N + 2 jobs are in memory at a time. The threads
+// of the machine are shared out between the N inpaints.
+//
+// Every job is printed as it is done and, with --report, written to a CSV
+// file: its times, the memory its images and scratch fields took and the
+// peak memory of the process by then.
+//
+// Returns the exit status: 0 if every job succeeded.
+int inpaint_batch_main(int argc, char** argv);
+
+#endif
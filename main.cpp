@@ -5,6 +5,7 @@
 #include <cstring>
 #include <cmath>
 #include <cassert>
+#include <string>
 #include <vector>
 
 #include <fltk/FL_API.h>
@@ -18,16 +19,26 @@
 #include <fltk/ReturnButton.h>
 #include <fltk/ProgressBar.h>
 #include <fltk/MenuBuild.h>
+#include <fltk/RadioItem.h>
+#include <fltk/ToggleItem.h>
+#include <fltk/Threads.h>
 #include <fltk/Window.h>
+#include <fltk/draw.h>
 #include <fltk/run.h>
 
+#include "batch.h"
+#include "image_io.h"
+#include "inpaint.h"
+#include "operations.h"
+#include "arena.h"
+#include "pyramid.h"
+#include "row_stream.h"
+#include "tile_store.h"
+
 using namespace std;
 using namespace fltk;
 
 
-extern Image* inpaint_fast_marching(const Image*, const Image*);
-extern Image* inpaint_criminisi(const Image*, const Image*);
-
 static ProgressBar* bar = NULL;
 class DisplayWidget;
 static DisplayWidget* image_box = NULL;
@@ -36,25 +47,62 @@ static Image* oldimg = NULL;
 static Image* mask = NULL;
 static vector<Image*> images;
 static const int brush_size = 10;
+static const size_t decode_cache_limit = size_t(256) << 20;  // for switching between working files
+static InpaintConfig inpaint_config;
+static CriminisiConfig criminisi_config;
+static ARENA inpaint_arena; // kept between inpaints, so that repeating one allocates nothing
+static bool coarse_to_fine = false;
+static bool show_statistics = false;  // of the inpaints, the decode cache and the saves, in a message
+static bool working = false;  // an operation runs, letting events through: they leave the image be
+static volatile bool stop_requested = false;  // by Stop inpaint, for the inpaint's thread
+static string current_file;  // opened or saved last
+static TileStore* tiles = NULL;  // open instead of img, for images too large for memory
+static vector<TileStore*> tile_undo;  // the stores before the operations on them
 
 class DisplayWidget : public InvisibleBox
 {
 public:
 	DisplayWidget(int x, int y, int w, int h) : InvisibleBox(x, y, w, h) { };
+
+	// A tile store is drawn centred as image() would be, reading only the
+	// tiles in the window
+	void draw()
+	{
+		InvisibleBox::draw();
+		if(!tiles)
+			return;
+		tiles_left = (w() - tiles->width()) / 2;
+		tiles_top = (h() - tiles->height()) / 2;
+		Rectangle r(tiles_left, tiles_top, tiles->width(), tiles->height());
+		r.intersect(Rectangle(w(), h()));
+		tiles_left = r.x() - tiles_left;
+		tiles_top = r.y() - tiles_top;
+		if(!r.empty())
+			drawimage(tile_row, this, RGB32, r);
+	}
+
+	static const uchar* tile_row(void* data, int x, int y, int w, uchar* buffer)
+	{
+		DisplayWidget* box = (DisplayWidget*)data;
+		if(!tiles->read_rgb32(box->tiles_left + x, box->tiles_top + y, w, buffer))
+			memset(buffer, 0, size_t(w) * 4);
+		return buffer;
+	}
+
 	int handle(int ev)
 	{
 		if(ev == ENTER)
 			return 1;
 		if(ev == DRAG)
 		{
-			if(!img)
+			if(!img || working)
 				return 0;
 			draw_pix(event_x() - (w() - img->buffer_width())/2, event_y() - (h() - img->buffer_height())/2);
 			return 1;
 		}
 		if(ev == PUSH)
 		{
-			if(!img)
+			if(!img || working)
 				return 0;
 			if(!oldimg)
 			{
@@ -107,357 +155,427 @@ public:
 				image_box->redraw();
 			}
 	}
+
+private:
+	int tiles_left, tiles_top;	// the pixel of the store at the corner drawn
 };
 
+// The store open goes, and the ones the operations made are removed
+static void close_tiles()
+{
+	while(!tile_undo.empty())
+	{
+		string made = tiles->filename();
+		delete tiles;
+		remove(made.c_str());
+		tiles = tile_undo.back();
+		tile_undo.pop_back();
+	}
+	delete tiles;
+	tiles = NULL;
+}
+
 void open_cb(Widget*, void*)
 {
+	if(working)
+		return;
 	const char* filename = file_chooser("Select image file to open",
-		"Image Files (*.{bmp,jpg,png})",
+		"Image Files (*.{bmp,jpg,png,tiles})",
 		".");
 
 	if(!filename)
 		return;
-	if(img)
-		images.push_back(img);
-	img = NULL;
-	const char* extension = filename_ext(filename);
-	if(strcmp(extension, ".bmp") == 0)
-		img = bmpImage::get(filename);
-	if(strcmp(extension, ".jpg") == 0)
-		img = jpegImage::get(filename);
-	if(strcmp(extension, ".png") == 0)
-		img = pngImage::get(filename);
-
-	if(!img)
+	string error;
+	if(file_extension(filename) == "tiles")
 	{
-		message("%s: wrong format", filename);
+		TileStore* store = TileStore::open(filename, false, error);
+		if(!store)
+		{
+			message("%s", error.c_str());
+			return;
+		}
+		close_tiles();
+		if(img)
+			images.push_back(img);
+		img = NULL;
+		tiles = store;
+		current_file = filename;
+		image_box->image(NULL);
+		image_box->redraw();
 		return;
 	}
+	Image* opened = load_image(filename, error);
+	if(!opened)
+	{
+		message("%s", error.c_str());
+		return;
+	}
+	close_tiles();
+	if(img)
+		images.push_back(img);
+	img = opened;
+	current_file = filename;
 	image_box->image(img);
 	image_box->redraw();
+	if(show_statistics)
+	{
+		DecodeCacheStats cache = decode_cache_stats();
+		message("Decode cache: %lu hits, %lu misses, %lu evictions\n%d images, %lu KB", cache.hits,
+			cache.misses, cache.evictions, cache.images, (unsigned long)(cache.bytes >> 10));
+	}
 }
 
-void quit_cb(Widget*, void*)
+// A save running on a thread of its own, from a copy of the image, so that
+// the window goes on working while a large file is written. A tile store is
+// streamed from its file instead.
+struct BackgroundSave
 {
-	exit(0);
+	string filename;
+	Image* copy;
+	string source;	// the tile store, if it's one
+	string error;
+	bool ok;
+	bool done;	// guarded by save_lock
+};
+
+static Mutex save_lock;
+static vector<BackgroundSave*> saves;	// still being written
+
+static void* save_thread(void* arg)
+{
+	BackgroundSave* s = (BackgroundSave*)arg;
+	if(s->copy)
+		s->ok = save_image(s->filename.c_str(), s->copy, s->error);
+	else
+		s->ok = stream_image(s->source.c_str(), s->filename.c_str(), vector<const char*>(), s->error);
+	save_lock.lock();
+	s->done = true;
+	save_lock.unlock();
+	return 0;
 }
 
-void undo_cb(Widget*, void*)
+// Reports the saves that are over, every 0.2 s while there are any
+static void check_saves(void*)
 {
-	if(images.size() != 0)
+	vector<BackgroundSave*> over;
+	save_lock.lock();
+	for(size_t k = 0; k < saves.size(); )
+		if(saves[k]->done)
+		{
+			over.push_back(saves[k]);
+			saves.erase(saves.begin() + k);
+		}
+		else
+			k++;
+	save_lock.unlock();
+	if(!saves.empty())
+		repeat_timeout(0.2f, check_saves);
+	for(size_t k = 0; k < over.size(); k++)
 	{
-		delete img;
-		img = images.back();
-		images.pop_back();
-		image_box->image(img);
-		image_box->redraw();
+		if(!over[k]->ok)
+			alert("%s", over[k]->error.c_str());
+		else if(show_statistics)
+			message("Saved %s", over[k]->filename.c_str());
+		delete over[k]->copy;
+		delete over[k];
 	}
+}
+
+static void start_save(const string& filename)
+{
+	// the stores are mapped: written over, they would go from under us
+	if(tiles)
+	{
+		bool open = filename == tiles->filename();
+		for(size_t k = 0; k < tile_undo.size(); k++)
+			open = open || filename == tile_undo[k]->filename();
+		if(open)
+		{
+			alert("%s is open; save under another name", filename.c_str());
+			return;
+		}
+	}
+	BackgroundSave* s = new BackgroundSave;
+	s->filename = filename;
+	s->copy = NULL;
+	if(tiles)
+		s->source = tiles->filename();
 	else
 	{
-		alert("Nothing to undo");
+		s->copy = new Image;
+		s->copy->setimage(img->buffer(), RGB32, img->buffer_width(), img->buffer_height());
 	}
+	s->ok = s->done = false;
+	if(saves.empty())
+		add_timeout(0.2f, check_saves);
+	saves.push_back(s);
+
+	Thread t;
+	int rc = create_thread(t, save_thread, s);
+#ifdef _WIN32
+	if(rc == -1)
+		save_thread(s);
+#else
+	if(rc != 0)
+		save_thread(s);
+	else
+		pthread_detach(t);
+#endif
 }
 
-static bool working = false;
+// An inpaint running on a thread of its own, so that the window goes on
+// handling events and Stop inpaint can reach it
+struct BackgroundInpaint
+{
+	bool criminisi;
+	InpaintConfig fast_marching;	// copies: the menus may change the settings meanwhile
+	CriminisiConfig exemplar;
+	bool coarse_to_fine;
+	const Image* image;
+	Image* mask;	// a copy, made by run_inpaint(): the thread leaves the window's alone
+	Image* result;
+	vector<double> seconds;	// of the Criminisi levels
+	bool done;	// guarded by inpaint_lock
+};
 
-void sliding_avg_cb(Widget*, void*)
+static Mutex inpaint_lock;
+static BackgroundInpaint* inpainting = NULL;
+
+static bool inpaint_running()
 {
-	if(!img)
-		return;
-	if(working)
-		return;
+	inpaint_lock.lock();
+	bool running = inpainting && !inpainting->done;
+	inpaint_lock.unlock();
+	return running;
+}
 
-	const char* Nstr = input("Input window size", "10");
-	if(!Nstr)
+void saveas_cb(Widget*, void*)
+{
+	if(!img && !tiles)
 		return;
-	for(int i = 0; i < strlen(Nstr); i++)
-		if(!isdigit(Nstr[i]))
-			return;
-	int N = atoi(Nstr);
-	if(N == 0)
+	const char* filename = file_chooser("Save image as",
+		"Image Files (*.{bmp,jpg,png,tiles})",
+		current_file.c_str());
+	if(!filename)
 		return;
+	current_file = filename;
+	if(file_extension(filename).empty())
+		current_file += ".png";
+	start_save(current_file);
+}
 
-	working = true;
+void save_cb(Widget* w, void* v)
+{
+	if(!img && !tiles)
+		return;
+	if(current_file.empty())
+		saveas_cb(w, v);
+	else
+		start_save(current_file);
+}
 
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setimage( img->buffer(),
-		RGB32,
-		img->buffer_width(),
-		img->buffer_height() );
+void quit_cb(Widget*, void*)
+{
+	// an inpaint stops, saving its checkpoint
+	stop_requested = true;
+	while(inpaint_running())
+		fltk::wait(0.1);
+	// a save cut short would leave half a file
+	while(!saves.empty())
+		fltk::wait(0.1);
+	close_tiles();
+	exit(0);
+}
 
-	for(int y = 0; y < img->buffer_height(); y++)
+void undo_cb(Widget*, void*)
+{
+	if(working)
+		return;
+	if(!tile_undo.empty())
 	{
-		bar->position(100.0 * (double) y / img->buffer_height());
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
+		string made = tiles->filename();
+		delete tiles;
+		remove(made.c_str());
+		tiles = tile_undo.back();
+		tile_undo.pop_back();
+		image_box->redraw();
+	}
+	else if(tiles)
+	{
+		// back to the image open before the store
+		close_tiles();
+		if(images.size() != 0)
 		{
-			unsigned long int rsum = 0, gsum = 0, bsum = 0;
-			for(int j = -N/2; j <= N/2; j++)
-				for(int i = -N/2; i <= N/2; i++)
-				{
-					int y_idx = y + j >= img->buffer_height() ?
-						N - j:
-						y + j;
-					if(y_idx < 0)
-						y_idx += img->buffer_height();
-					int x_idx = x + i >= img->buffer_width() ?
-						N - i:
-						x + i;
-					if(x_idx < 0)
-						x_idx += img->buffer_width();
-
-					size_t index = y_idx * img->buffer_width() * 4
-						+ x_idx * 4;
-					uchar r = img->buffer()[index + 0];
-					rsum += r;
-					uchar g = img->buffer()[index + 1];
-					gsum += g;
-					uchar b = img->buffer()[index + 2];
-					bsum += b;
-				}
-			uchar newpixel[4];
-			newpixel[0] = (rsum / (N * N)) > 255 ? 255 : uchar(rsum / (N * N));
-			newpixel[1] = (gsum / (N * N)) > 255 ? 255 : uchar(gsum / (N * N));
-			newpixel[2] = (bsum / (N * N)) > 255 ? 255 : uchar(bsum / (N * N));
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
+			img = images.back();
+			images.pop_back();
 		}
+		image_box->image(img);
+		image_box->redraw();
+	}
+	else if(images.size() != 0)
+	{
+		delete img;
+		img = images.back();
+		images.pop_back();
+		image_box->image(img);
+		image_box->redraw();
+	}
+	else
+	{
+		alert("Nothing to undo");
 	}
+}
+
+static void bar_progress(double percent, void*)
+{
+	bar->position(percent);
+	bar->redraw();
+	fltk::wait(0);
+}
+
+static const Progress bar_updates = { bar_progress, 0 };
 
+// The result of an operation replaces the image, the old one going on the
+// undo stack
+static void show_result(Image* newimage)
+{
 	images.push_back(img);
-	newimage->buffer_changed();
 	img = newimage;
 	image_box->image(img);
 	bar->position(0);
 	image_box->redraw();
-
-	working = false;
 }
 
-void upscale_nn_cb(Widget*, void*)
+// With a tile store open, the operation runs on it by tiles into a new store
+// next to it (see run_tiles()), or a row at a time if it can't run by tiles
+// (see stream_image()); the old store goes on the undo stack. false if
+// there's no store open
+static bool tiles_result(const char* spec)
 {
-	if(!img)
-		return;
+	if(!tiles)
+		return false;
 	if(working)
-		return;
-
-	const char* Nstr = input("Scale factor", "2");
-	if(!Nstr)
-		return;
-	for(int i = 0; i < strlen(Nstr); i++)
-		if(!isdigit(Nstr[i]))
-			return;
-	int N = atoi(Nstr);
-	if(N == 0)
-		return;
+		return true;
 
+	const char* first = tile_undo.empty() ? tiles->filename() : tile_undo[0]->filename();
+	char suffix[32];
+	sprintf(suffix, ".%d.tiles", int(tile_undo.size() + 1));
+	string output = string(first) + suffix;
+	string error;
 	working = true;
-
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setsize(img->buffer_width() * N, img->buffer_height() * N);
-	newimage->setpixeltype(RGB32);
-
-	for(int y = 0; y < img->buffer_height() * N; y++)
+	TileOp op;
+	TileStore* res;
+	if(tile_operation(spec, op, error))
+		res = run_tiles(spec, tiles, output.c_str(), error, &bar_updates);
+	else
 	{
-		bar->position(100.0 * (double) y / (img->buffer_height() * N));
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width() * N; x++)
-		{
-			size_t index = (y / N) * img->buffer_width() * 4
-				+ (x / N) * 4;
-			char r = img->buffer()[index + 0];
-			char g = img->buffer()[index + 1];
-			char b = img->buffer()[index + 2];
-
-			uchar newpixel[4];
-			newpixel[0] = r;
-			newpixel[1] = g;
-			newpixel[2] = b;
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
+		error.clear();
+		vector<const char*> ops(1, spec);
+		res = stream_image(tiles->filename(), output.c_str(), ops, error, NULL, &bar_updates) ?
+			TileStore::open(output.c_str(), false, error) : NULL;
 	}
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
+	working = false;
 	bar->position(0);
+	if(!res)
+	{
+		alert("%s", error.c_str());
+		return true;
+	}
+	tile_undo.push_back(tiles);
+	tiles = res;
 	image_box->redraw();
+	return true;
+}
 
-	working = false;
+// A positive whole number from the user, or 0
+static int input_count(const char* label, const char* deflt)
+{
+	const char* Nstr = input(label, deflt);
+	if(!Nstr)
+		return 0;
+	for(int i = 0; i < strlen(Nstr); i++)
+		if(!isdigit(Nstr[i]))
+			return 0;
+	return atoi(Nstr);
 }
 
-void upscale_bl_cb(Widget*, void*)
+void sliding_avg_cb(Widget*, void*)
 {
-	if(!img)
+	if(!img && !tiles)
 		return;
 	if(working)
 		return;
 
-	const char* Nstr = input("Scale factor", "2");
-	if(!Nstr)
-		return;
-	for(int i = 0; i < strlen(Nstr); i++)
-		if(!isdigit(Nstr[i]))
-			return;
-	int N = atoi(Nstr);
+	int N = input_count("Input window size", "10");
 	if(N == 0)
 		return;
+	char spec[64];
+	sprintf(spec, "sliding-average:size=%d", N);
+	if(tiles_result(spec))
+		return;
 
 	working = true;
+	show_result(sliding_average(img, N, &bar_updates));
+	working = false;
+}
 
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setsize(img->buffer_width() * N, img->buffer_height() * N);
-	newimage->setpixeltype(RGB32);
-
-	for(int y = 0; y < img->buffer_height() * N; y++)
-	{
-		bar->position(100.0 * (double) y / (img->buffer_height() * N));
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width() * N; x++)
-		{
-			int floor_x = x / N,
-				floor_y = y / N;
-			int ceil_x = floor_x + 1;
-			if(ceil_x >= img->buffer_width())
-				ceil_x = floor_x;
-			int ceil_y = floor_y + 1;
-			if(ceil_y >= img->buffer_height())
-				ceil_y = floor_y;
-			double fraction_x = double(x) / N - floor_x,
-				fraction_y = double(y) / N - floor_y;
-			double one_minus_x = 1.0 - fraction_x,
-				one_minus_y = 1.0 - fraction_y;
-
-			uchar* f1 = &img->buffer()[floor_y * img->buffer_width() * 4 +
-				floor_x * 4];
-			uchar* f2 = &img->buffer()[floor_y * img->buffer_width() * 4 +
-				ceil_x * 4];
-			uchar* f3 = &img->buffer()[ceil_y  * img->buffer_width() * 4 +
-				floor_x * 4];
-			uchar* f4 = &img->buffer()[ceil_y  * img->buffer_width() * 4 +
-				ceil_x * 4];
-
-			uchar newpixel[4], p1, p2;
-			p1 = uchar(one_minus_x * f1[0] + fraction_x * f2[0]);
-			p2 = uchar(one_minus_x * f3[0] + fraction_x * f4[0]);
-			newpixel[0] = uchar(one_minus_y * p1 + fraction_y * p2);
-			p1 = uchar(one_minus_x * f1[1] + fraction_x * f2[1]);
-			p2 = uchar(one_minus_x * f3[1] + fraction_x * f4[1]);
-			newpixel[1] = uchar(one_minus_y * p1 + fraction_y * p2);
-			p1 = uchar(one_minus_x * f1[2] + fraction_x * f2[2]);
-			p2 = uchar(one_minus_x * f3[2] + fraction_x * f4[2]);
-			newpixel[2] = uchar(one_minus_y * p1 + fraction_y * p2);
-
-			// Список литературы
-			// [1] http://www.codeproject.com/KB/GDI-plus/imageprocessing4.aspx
-
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
-	}
+void upscale_nn_cb(Widget*, void*)
+{
+	if(!img && !tiles)
+		return;
+	if(working)
+		return;
 
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
+	int N = input_count("Scale factor", "2");
+	if(N == 0)
+		return;
+	char spec[64];
+	sprintf(spec, "upscale-nn:factor=%d", N);
+	if(tiles_result(spec))
+		return;
 
+	working = true;
+	show_result(upscale_nn(img, N, &bar_updates));
 	working = false;
 }
 
-Image* filter(double* kernel, int kern_height, int kern_width, const Image* img)
+void upscale_bl_cb(Widget*, void*)
 {
-	assert(kern_height % 2);
-	assert(kern_width % 2);  // должен быть средний элемент
+	if(!img && !tiles)
+		return;
+	if(working)
+		return;
 
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setsize(img->buffer_width(), img->buffer_height());
-	newimage->setpixeltype(RGB32);
+	int N = input_count("Scale factor", "2");
+	if(N == 0)
+		return;
+	char spec[64];
+	sprintf(spec, "upscale-bilinear:factor=%d", N);
+	if(tiles_result(spec))
+		return;
 
-	for(int y = 0; y < img->buffer_height(); y++)
-	{
-		bar->position(100.0 * (double) y / (img->buffer_height()));
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
-		{
-			double newpix[3];
-			memset(newpix, 0, sizeof(newpix));
-			for(int j = -int(kern_height / 2); j <= kern_height / 2; j++)
-			{
-				int y_idx = j + y;
-				if(y_idx < 0)
-					y_idx += img->buffer_height();
-				if(y_idx >= img->buffer_height())
-					y_idx -= img->buffer_height();
-				for(int i = -int(kern_width / 2); i <= kern_width / 2; i++)
-				{
-					int x_idx = i + x;
-					if(x_idx < 0)
-						x_idx += img->buffer_width();
-					if(x_idx >= img->buffer_width())
-						x_idx -= img->buffer_width();
-					size_t index = y_idx * img->buffer_width() * 4
-						+ x_idx * 4;
-					size_t kern_index = (j+kern_height/2) * kern_width + (i+kern_width/2);
-					uchar r = img->buffer()[index + 0];
-					newpix[0] += kernel[kern_index] * r;
-					uchar g = img->buffer()[index + 1];
-					newpix[1] += kernel[kern_index] * g;
-					uchar b = img->buffer()[index + 2];
-					newpix[2] += kernel[kern_index] * b;
-				}
-			}
-			uchar newpixel[4];
-			newpixel[0] = (newpix[0] < 255) ? (newpix[0] > 0 ? uchar(newpix[0]) : 0) : 255;
-			newpixel[1] = (newpix[1] < 255) ? (newpix[1] > 0 ? uchar(newpix[1]) : 0) : 255;
-			newpixel[2] = (newpix[2] < 255) ? (newpix[2] > 0 ? uchar(newpix[2]) : 0) : 255;
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
-	}
-	return newimage;
+	working = true;
+	show_result(upscale_bilinear(img, N, &bar_updates));
+	working = false;
 }
 
 void sharpen_cb(Widget*, void*)
 {
+	if(tiles_result("sharpen"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-
-	double sharpen_kernel[9] = {
-		0.1*(-1), 0.1*(-2), 0.1*(-1),
-		0.1*(-2), 0.1*(22), 0.1*(-2),
-		0.1*(-1), 0.1*(-2), 0.1*(-1)
-	};
-	Image* newimage = filter(sharpen_kernel, 3, 3, img);
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
-
+	show_result(sharpen(img, &bar_updates));
 	working = false;
 }
 
 void blur_cb(Widget*, void*)
 {
-	if(!img)
+	if(!img && !tiles)
 		return;
 	if(working)
 		return;
@@ -471,132 +589,58 @@ void blur_cb(Widget*, void*)
 	double sigma = atof(sigma_str);
 	if(sigma == 0)
 		return;
-
-	double sigma2 = sigma * sigma;
-
-	working = true;
-
-	double blur_kernel[9];
-	double sum = 0;
-	for(int k = 0; k < 3; k++)
-		for(int p = 0; p < 3; p++)
-		{
-			blur_kernel[k*3+p] = exp(double(k*k+p*p)/(-2*sigma2));
-			sum += blur_kernel[k*3+p];
-		}
-	for(int i = 0; i < 9; i++)
-		blur_kernel[i] /= sum;
-
-	Image* newimage = filter(blur_kernel, 3, 3, img);
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
-
-	working = false;
-}
-
-void do_simple_grayscale()
-{
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setsize(img->buffer_width(), img->buffer_height());
-	newimage->setpixeltype(RGB32);
-
-	for(int y = 0; y < img->buffer_height(); y++)
+	if(tiles)
 	{
-		bar->position(100.0 * (double) y / (img->buffer_height()));
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
-		{
-			size_t index = (y * img->buffer_width() + x) * 4;
-			uchar r = img->buffer()[index + 0];
-			uchar g = img->buffer()[index + 1];
-			uchar b = img->buffer()[index + 2];
-
-			double val = 0.299 * r + 0.587 * g + 0.114 * b;
-			if(val > 255)
-				val = 255;
-			uchar newpixel[4];
-			newpixel[0] = uchar(val);
-			newpixel[1] = uchar(val);
-			newpixel[2] = uchar(val);
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
+		char spec[64];
+		sprintf(spec, "blur:sigma=%.17g", sigma);
+		tiles_result(spec);
+		return;
 	}
 
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
+	working = true;
+	show_result(blur(img, sigma, &bar_updates));
+	working = false;
 }
 
 void edge_detection_cb(Widget*, void*)
 {
+	if(tiles_result("edges"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-
-	double edgedet_kernel[9] = {
-		0, -1, 0,
-		-1, 4, -1,
-		0, -1, 0
-	};
-	Image* newimage = filter(edgedet_kernel, 3, 3, img);
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-
-	do_simple_grayscale();
-
+	show_result(edge_detection(img, &bar_updates));
 	working = false;
 }
 
 void emboss_cb(Widget*, void*)
 {
+	if(tiles_result("emboss"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-
-	double emboss_kernel[9] = {
-		0, 1, 0,
-		1, 0, -1,
-		0, -1, 0
-	};
-	Image* newimage = filter(emboss_kernel, 3, 3, img);
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-
-	do_simple_grayscale();
-
+	show_result(emboss(img, &bar_updates));
 	working = false;
 }
 
 void simple_grayscale_cb(Widget*, void*)
 {
+	if(tiles_result("grayscale"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-	do_simple_grayscale();
+	show_result(grayscale(img, &bar_updates));
 	working = false;
 }
 
@@ -619,21 +663,24 @@ void do_custom_cb(Widget*, void*)
 	kernel[7] = a21->value() * factor->value();
 	kernel[8] = a22->value() * factor->value();
 
-	Image* newimage = filter(kernel, 3, 3, img);
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
+	if(tiles)
+	{
+		char spec[512];
+		int n = sprintf(spec, "custom:kernel=%.17g", kernel[0]);
+		for(int k = 1; k < 9; k++)
+			n += sprintf(spec + n, "/%.17g", kernel[k]);
+		working = false;
+		tiles_result(spec);
+		return;
+	}
+	show_result(filter(kernel, 3, 3, img, &bar_updates));
 
 	working = false;
 }
 
 void custom_cb(Widget*, void*)
 {
-	if(!img)
+	if(!img && !tiles)
 		return;
 	if(working)
 		return;
@@ -663,195 +710,213 @@ void custom_cb(Widget*, void*)
 
 void binarization_cb(Widget*, void*)
 {
+	if(tiles_result("binarize"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setimage( img->buffer(),
-		RGB32,
-		img->buffer_width(),
-		img->buffer_height() );
-
-	for(int y = 0; y < img->buffer_height(); y++)
-	{
-		bar->position(100.0 * (double) y / img->buffer_height());
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
-		{
-			size_t index = y * img->buffer_width() * 4 + x * 4;
-			uchar r = img->buffer()[index + 0];
-			uchar g = img->buffer()[index + 1];
-			uchar b = img->buffer()[index + 2];
-
-			unsigned long sum = r + g + b;
-			uchar newpixel[4], tag;
-			if(sum > 255 * 3 / 2)
-				tag = 255;
-			else
-				tag = 0;
-
-			newpixel[0] = tag;
-			newpixel[1] = tag;
-			newpixel[2] = tag;
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
-	}
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
-
+	show_result(binarization(img, &bar_updates));
 	working = false;
 }
 
 void random_cb(Widget*, void*)
 {
+	if(tiles_result("random-dither"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
-
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setimage( img->buffer(),
-		RGB32,
-		img->buffer_width(),
-		img->buffer_height() );
-
-	for(int y = 0; y < img->buffer_height(); y++)
-	{
-		bar->position(100.0 * (double) y / img->buffer_height());
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
-		{
-			size_t index = y * img->buffer_width() * 4 + x * 4;
-			uchar r = img->buffer()[index + 0];
-			uchar g = img->buffer()[index + 1];
-			uchar b = img->buffer()[index + 2];
-
-			unsigned long sum = r + g + b;
-			uchar newpixel[4], tag;
-			if(sum > unsigned(rand() % (255 * 3)))
-				tag = 255;
-			else
-				tag = 0;
-
-			newpixel[0] = tag;
-			newpixel[1] = tag;
-			newpixel[2] = tag;
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
-	}
-
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
-
+	show_result(random_dithering(img, &bar_updates));
 	working = false;
 }
 
 void bayer_cb(Widget*, void*)
 {
+	if(tiles_result("bayer-dither"))
+		return;
 	if(!img)
 		return;
 	if(working)
 		return;
 
 	working = true;
+	show_result(bayer_dithering(img, &bar_updates));
+	working = false;
+}
 
-	double map[4][4] = {{1, 9, 3, 11}, {13, 5, 15, 7}, {4, 12, 2, 10}, {16, 8, 14, 6}};
-	for(int i = 0; i < 4; i++)
-		for(int j = 0; j < 4; j++)
-			map[i][j] *= (255 / 17);
-
-	Image* newimage = new Image;
-	img->forceARGB32();
-	newimage->setimage( img->buffer(),
-		RGB32,
-		img->buffer_width(),
-		img->buffer_height() );
-
-	for(int y = 0; y < img->buffer_height(); y++)
-	{
-		bar->position(100.0 * (double) y / img->buffer_height());
-		bar->redraw();
-		fltk::wait(0);
-		for(int x = 0; x < img->buffer_width(); x++)
-		{
-			size_t index = y * img->buffer_width() * 4 + x * 4;
-			uchar r = img->buffer()[index + 0];
-			uchar g = img->buffer()[index + 1];
-			uchar b = img->buffer()[index + 2];
-
-			unsigned long sum = (r + g + b) / 3;
-			uchar newpixel[4], tag;
-			if((sum + map[x % 4][y % 4]) > 255 * 2 / 2)
-				tag = 255;
-			else
-				tag = 0;
-
-			newpixel[0] = tag;
-			newpixel[1] = tag;
-			newpixel[2] = tag;
-			newpixel[3] = 0;
-			newimage->setpixels(&newpixel[0], Rectangle(x, y, 1, 1));
-		}
-	}
+static Image* fast_marching_level(const Image* image, const Image* mask, void* arg)
+{
+	return inpaint_fast_marching(image, mask, *(const InpaintConfig*)arg, &inpaint_arena);
+}
 
-	images.push_back(img);
-	newimage->buffer_changed();
-	img = newimage;
-	image_box->image(img);
-	bar->position(0);
-	image_box->redraw();
+static void* inpaint_thread(void* arg)
+{
+	BackgroundInpaint* b = (BackgroundInpaint*)arg;
+	if(b->criminisi)
+		b->result = inpaint_criminisi(b->image, b->mask, b->exemplar, &b->seconds);
+	else if(b->coarse_to_fine)
+		b->result = inpaint_pyramid(b->image, b->mask, fast_marching_level, &b->fast_marching,
+			int(2 * b->fast_marching.B_radius));
+	else
+		b->result = inpaint_fast_marching(b->image, b->mask, b->fast_marching, &inpaint_arena);
+	inpaint_lock.lock();
+	b->done = true;
+	inpaint_lock.unlock();
+	return 0;
+}
 
+// Runs the inpaint and waits for it, handling the events meanwhile. Stopped,
+// it leaves the image and the mask as they were, to be taken up again from
+// the checkpoint, if there's one; false then.
+static bool run_inpaint(BackgroundInpaint& b)
+{
+	b.fast_marching.checkpoint.stop = &stop_requested;
+	b.exemplar.checkpoint.stop = &stop_requested;
+	b.mask = new Image;
+	b.mask->setimage(mask->buffer(), mask->buffer_pixeltype(), mask->buffer_width(),
+		mask->buffer_height(), mask->buffer_linedelta());
+	b.result = NULL;
+	b.done = false;
+	stop_requested = false;
+	working = true;
+	inpainting = &b;
+	Thread t;
+	int rc = create_thread(t, inpaint_thread, &b);
+#ifdef _WIN32
+	if(rc == -1)
+		inpaint_thread(&b);
+#else
+	if(rc != 0)
+		inpaint_thread(&b);
+	else
+		pthread_detach(t);
+#endif
+	while(inpaint_running())
+		fltk::wait(0.1);
+	inpainting = NULL;
 	working = false;
+	delete b.mask;
+	b.mask = NULL;
+	if(!stop_requested)
+		return true;
+	delete b.result;
+	return false;
 }
 
 void fast_marching_cb(Widget*, void*)
 {
-	if(!img || !oldimg)
+	if(!img || !oldimg || working)
 		return;
 
+	BackgroundInpaint b;
+	b.criminisi = false;
+	b.fast_marching = inpaint_config;
+	b.coarse_to_fine = coarse_to_fine;
+	b.image = oldimg;
+	if(!run_inpaint(b))
+		return;
 	images.push_back(oldimg);
-	Image* i = inpaint_fast_marching(oldimg, mask);
 	oldimg = NULL;
 	images.push_back(img);
-	img = i;
+	img = b.result;
 	image_box->image(img);
 	image_box->redraw();
+	if(show_statistics)
+		message("Arena peak %lu KB, %d heap blocks (%.3f ms)\nProcess peak RSS %lu KB",
+			(unsigned long)(inpaint_arena.peak() >> 10), inpaint_arena.heap_calls(),
+			inpaint_arena.heap_time() * 1000, (unsigned long)(peak_rss() >> 10));
 }
 
 void criminisi_cb(Widget*, void*)
 {
-	if(!img || !oldimg)
+	if(!img || !oldimg || working)
 		return;
 
+	// Coarse-to-fine: the nearest neighbour field of every level seeds the
+	// search at the next one
+	BackgroundInpaint b;
+	b.criminisi = true;
+	b.exemplar = criminisi_config;
+	b.exemplar.levels = coarse_to_fine ? -1 : 0;
+	b.image = img;
+	if(!run_inpaint(b))
+		return;
 	images.push_back(oldimg);
-	Image* i = inpaint_criminisi(img, mask);
 	oldimg = NULL;
 	images.push_back(img);
-	img = i;
+	img = b.result;
 	image_box->image(img);
 	image_box->redraw();
+	vector<double>& seconds = b.seconds;
+	if(show_statistics && !seconds.empty())
+	{
+		// The coarsest level first
+		string times;
+		for(size_t l = 0; l < seconds.size(); l++)
+		{
+			char line[64];
+			sprintf(line, "%sLevel %d: %.3f s", l ? "\n" : "", int(seconds.size() - 1 - l), seconds[l]);
+			times += line;
+		}
+		message("%s", times.c_str());
+	}
+}
 
+// Stops the inpaint running; with checkpoints on, its state is saved first
+void stop_inpaint_cb(Widget*, void*)
+{
+	stop_requested = true;
+}
+
+void distance_method_cb(Widget*, void* method)
+{
+	inpaint_config.dist_method = (int)(long)method;
+}
+
+void exemplar_search_cb(Widget*, void* method)
+{
+	criminisi_config.search = (int)(long)method;
+}
+
+void descriptor_search_cb(Widget*, void* kind)
+{
+	criminisi_config.search = SEARCH_DESCRIPTORS;
+	criminisi_config.index_kind = (int)(long)kind;
+}
+
+void fill_batch_cb(Widget*, void* n)
+{
+	criminisi_config.batch = (int)(long)n;
+}
+
+void coarse_to_fine_cb(Widget* w, void*)
+{
+	coarse_to_fine = w->state();
+}
+
+void show_statistics_cb(Widget* w, void*)
+{
+	show_statistics = w->state();
+}
+
+// Both inpaints save their state to the same file every 10 seconds and take
+// it up from there when run again on the same image and mask
+void checkpoint_cb(Widget* w, void*)
+{
+	CheckpointConfig c;
+	if(w->state())
+	{
+		c.path = "inpaint.checkpoint";
+		c.resume = true;
+	}
+	inpaint_config.checkpoint = c;
+	criminisi_config.checkpoint = c;
 }
 
 static void build_menus(MenuBar* menu, Widget* w)
@@ -864,8 +929,8 @@ static void build_menus(MenuBar* menu, Widget* w)
 //	new Item( "&New File",        0, (Callback *)new_cb );
 	new Item( "&Open File...",    COMMAND + 'o', (Callback*)open_cb );
 	new Divider;
-//	new Item( "&Save File",       COMMAND + 's', (Callback*)save_cb);
-//	new Item( "Save File &As...", COMMAND + SHIFT + 's', (Callback *)saveas_cb);
+	new Item( "&Save File",       COMMAND + 's', (Callback*)save_cb);
+	new Item( "Save File &As...", COMMAND + SHIFT + 's', (Callback *)saveas_cb);
 	new Divider;
 	new Item( "&Quit", COMMAND + 'q', (Callback*)quit_cb, 0 );
 	g->end();
@@ -873,7 +938,7 @@ static void build_menus(MenuBar* menu, Widget* w)
 	g->begin();
 	new Item( "Undo", COMMAND + 'z', (Callback*)undo_cb );
 	new Divider;
-	new Item( "&Sliding average",  COMMAND + 's', (Callback*)sliding_avg_cb);
+	new Item( "S&liding average",  COMMAND + 'l', (Callback*)sliding_avg_cb);
 	new Divider;
 	new Item( "Upscale &NN",      COMMAND + 'n', (Callback*)upscale_nn_cb);
 	new Item( "Upscale &bilinear",COMMAND + 'b', (Callback*)upscale_bl_cb);
@@ -892,6 +957,31 @@ static void build_menus(MenuBar* menu, Widget* w)
 	new Divider;
 	new Item( "&Fast marching inpaint", COMMAND + 'f', (Callback*)fast_marching_cb );
 	new Item( "Cri&minisi inpaint", COMMAND + 'm', (Callback*)criminisi_cb );
+	new Item( "S&top inpaint", EscapeKey, (Callback*)stop_inpaint_cb );
+	new ToggleItem( "Coarse-to-fine inpaint", 0, (Callback*)coarse_to_fine_cb );
+	new ToggleItem( "Inpaint checkpoints", 0, (Callback*)checkpoint_cb );
+	new ToggleItem( "Show statistics", 0, (Callback*)show_statistics_cb );
+	ItemGroup* d = new ItemGroup( "Distance field" );
+	d->begin();
+	(new RadioItem( "Fast marching", 0, (Callback*)distance_method_cb, (void*)DISTANCE_FMM ))->set();
+	new RadioItem( "Exact transform", 0, (Callback*)distance_method_cb, (void*)DISTANCE_EDT );
+	new RadioItem( "Fast sweeping", 0, (Callback*)distance_method_cb, (void*)DISTANCE_SWEEP );
+	d->end();
+	ItemGroup* e = new ItemGroup( "Exemplar search" );
+	e->begin();
+	(new RadioItem( "Exhaustive", 0, (Callback*)exemplar_search_cb, (void*)SEARCH_EXHAUSTIVE ))->set();
+	new RadioItem( "PatchMatch", 0, (Callback*)exemplar_search_cb, (void*)SEARCH_PATCHMATCH );
+	new RadioItem( "Local window", 0, (Callback*)exemplar_search_cb, (void*)SEARCH_LOCAL );
+	new RadioItem( "PCA kd-tree", 0, (Callback*)descriptor_search_cb, (void*)INDEX_KDTREE );
+	new RadioItem( "PCA VP-tree", 0, (Callback*)descriptor_search_cb, (void*)INDEX_VPTREE );
+	e->end();
+	ItemGroup* b = new ItemGroup( "Patches per iteration" );
+	b->begin();
+	(new RadioItem( "1", 0, (Callback*)fill_batch_cb, (void*)1 ))->set();
+	new RadioItem( "4", 0, (Callback*)fill_batch_cb, (void*)4 );
+	new RadioItem( "16", 0, (Callback*)fill_batch_cb, (void*)16 );
+	new RadioItem( "64", 0, (Callback*)fill_batch_cb, (void*)64 );
+	b->end();
 	g->end();
 	menu->end();
 }
@@ -900,6 +990,9 @@ static void build_menus(MenuBar* menu, Widget* w)
 int main(int argc, char **argv)
 {
 	register_images();
+	if(argc > 1 && strncmp(argv[1], "--", 2) == 0)
+		return batch_main(argc, argv);
+	set_decode_cache_limit(decode_cache_limit);
 
 	Window window(800, 650);
 	window.begin();
@@ -0,0 +1,1010 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fltk/Image.h>
+
+#include "operations.h"
+#include "image_io.h"
+#include "inpaint.h"
+#include "row_stream.h"
+
+using namespace std;
+using namespace fltk;
+
+
+static Image* new_rgb32(int w, int h)
+{
+	Image* res = new Image;
+	res->setsize(w, h);
+	res->setpixeltype(RGB32);
+	return res;
+}
+
+static void report(const Progress* progress, int y, int h)
+{
+	if(progress && progress->report)
+		progress->report(100.0 * (double) y / h, progress->arg);
+}
+
+// Row y of the sliding average comes from input rows
+// sliding_average_row_index(y, j, N, h), j = -N/2 ... N/2
+int sliding_average_row_index(int y, int j, int N, int h)
+{
+	int y_idx = y + j >= h ?
+		N - j:
+		y + j;
+	if(y_idx < 0)
+		y_idx += h;
+	return y_idx;
+}
+
+void sliding_average_row(const uchar* const* rows, int w, int N, uchar* out)
+{
+	for(int x = 0; x < w; x++)
+	{
+		unsigned long int rsum = 0, gsum = 0, bsum = 0;
+		for(int j = 0; j <= N/2 * 2; j++)
+			for(int i = -N/2; i <= N/2; i++)
+			{
+				int x_idx = x + i >= w ?
+					N - i:
+					x + i;
+				if(x_idx < 0)
+					x_idx += w;
+
+				const uchar* pixel = &rows[j][x_idx * 4];
+				rsum += pixel[0];
+				gsum += pixel[1];
+				bsum += pixel[2];
+			}
+		uchar* newpixel = &out[x * 4];
+		newpixel[0] = (rsum / (N * N)) > 255 ? 255 : uchar(rsum / (N * N));
+		newpixel[1] = (gsum / (N * N)) > 255 ? 255 : uchar(gsum / (N * N));
+		newpixel[2] = (bsum / (N * N)) > 255 ? 255 : uchar(bsum / (N * N));
+		newpixel[3] = 0;
+	}
+}
+
+Image* sliding_average(const Image* img, int N, const Progress* progress)
+{
+	assert(N > 0);
+	int w = img->buffer_width(), h = img->buffer_height();
+	const uchar* src = img->buffer();
+	Image* newimage = new_rgb32(w, h);
+	uchar* dst = newimage->buffer();
+
+	vector<const uchar*> rows(N/2 * 2 + 1);
+	for(int y = 0; y < h; y++)
+	{
+		report(progress, y, h);
+		for(int j = -N/2; j <= N/2; j++)
+			rows[j + N/2] = &src[size_t(sliding_average_row_index(y, j, N, h)) * w * 4];
+		sliding_average_row(&rows[0], w, N, &dst[size_t(y) * w * 4]);
+	}
+	newimage->buffer_changed();
+	return newimage;
+}
+
+void upscale_nn_row(const uchar* row, int w, int N, uchar* out)
+{
+	for(int x = 0; x < w * N; x++)
+	{
+		const uchar* pixel = &row[(x / N) * 4];
+		uchar* newpixel = &out[x * 4];
+		newpixel[0] = pixel[0];
+		newpixel[1] = pixel[1];
+		newpixel[2] = pixel[2];
+		newpixel[3] = 0;
+	}
+}
+
+Image* upscale_nn(const Image* img, int N, const Progress* progress)
+{
+	assert(N > 0);
+	int w = img->buffer_width(), h = img->buffer_height();
+	const uchar* src = img->buffer();
+	Image* newimage = new_rgb32(w * N, h * N);
+	uchar* dst = newimage->buffer();
+
+	for(int y = 0; y < h * N; y++)
+	{
+		report(progress, y, h * N);
+		upscale_nn_row(&src[size_t(y / N) * w * 4], w, N, &dst[size_t(y) * w * N * 4]);
+	}
+	newimage->buffer_changed();
+	return newimage;
+}
+
+void upscale_bilinear_row(const uchar* floor_row, const uchar* ceil_row, int w, int N, int y, uchar* out)
+{
+	for(int x = 0; x < w * N; x++)
+	{
+		int floor_x = x / N,
+			floor_y = y / N;
+		int ceil_x = floor_x + 1;
+		if(ceil_x >= w)
+			ceil_x = floor_x;
+		double fraction_x = double(x) / N - floor_x,
+			fraction_y = double(y) / N - floor_y;
+		double one_minus_x = 1.0 - fraction_x,
+			one_minus_y = 1.0 - fraction_y;
+
+		const uchar* f1 = &floor_row[floor_x * 4];
+		const uchar* f2 = &floor_row[ceil_x * 4];
+		const uchar* f3 = &ceil_row[floor_x * 4];
+		const uchar* f4 = &ceil_row[ceil_x * 4];
+
+		uchar* newpixel = &out[x * 4];
+		for(int c = 0; c < 3; c++)
+		{
+			uchar p1 = uchar(one_minus_x * f1[c] + fraction_x * f2[c]);
+			uchar p2 = uchar(one_minus_x * f3[c] + fraction_x * f4[c]);
+			newpixel[c] = uchar(one_minus_y * p1 + fraction_y * p2);
+		}
+		newpixel[3] = 0;
+	}
+}
+
+Image* upscale_bilinear(const Image* img, int N, const Progress* progress)
+{
+	assert(N > 0);
+	int w = img->buffer_width(), h = img->buffer_height();
+	const uchar* src = img->buffer();
+	Image* newimage = new_rgb32(w * N, h * N);
+	uchar* dst = newimage->buffer();
+
+	for(int y = 0; y < h * N; y++)
+	{
+		report(progress, y, h * N);
+		int floor_y = y / N;
+		int ceil_y = floor_y + 1;
+		if(ceil_y >= h)
+			ceil_y = floor_y;
+		upscale_bilinear_row(&src[size_t(floor_y) * w * 4], &src[size_t(ceil_y) * w * 4], w, N, y,
+			&dst[size_t(y) * w * N * 4]);
+	}
+	newimage->buffer_changed();
+	return newimage;
+}
+
+void filter_row(const double* kernel, int kern_height, int kern_width, const uchar* const* rows, int w,
+	uchar* out)
+{
+	for(int x = 0; x < w; x++)
+	{
+		double newpix[3];
+		memset(newpix, 0, sizeof(newpix));
+		for(int j = 0; j < kern_height; j++)
+		{
+			for(int i = -int(kern_width / 2); i <= kern_width / 2; i++)
+			{
+				int x_idx = i + x;
+				if(x_idx < 0)
+					x_idx += w;
+				if(x_idx >= w)
+					x_idx -= w;
+				const uchar* pixel = &rows[j][x_idx * 4];
+				size_t kern_index = j * kern_width + (i+kern_width/2);
+				newpix[0] += kernel[kern_index] * pixel[0];
+				newpix[1] += kernel[kern_index] * pixel[1];
+				newpix[2] += kernel[kern_index] * pixel[2];
+			}
+		}
+		uchar* newpixel = &out[x * 4];
+		newpixel[0] = (newpix[0] < 255) ? (newpix[0] > 0 ? uchar(newpix[0]) : 0) : 255;
+		newpixel[1] = (newpix[1] < 255) ? (newpix[1] > 0 ? uchar(newpix[1]) : 0) : 255;
+		newpixel[2] = (newpix[2] < 255) ? (newpix[2] > 0 ? uchar(newpix[2]) : 0) : 255;
+		newpixel[3] = 0;
+	}
+}
+
+Image* filter(const double* kernel, int kern_height, int kern_width, const Image* img, const Progress* progress)
+{
+	assert(kern_height % 2);
+	assert(kern_width % 2);  // должен быть средний элемент
+
+	int w = img->buffer_width(), h = img->buffer_height();
+	const uchar* src = img->buffer();
+	Image* newimage = new_rgb32(w, h);
+	uchar* dst = newimage->buffer();
+
+	vector<const uchar*> rows(kern_height);
+	for(int y = 0; y < h; y++)
+	{
+		report(progress, y, h);
+		for(int j = -int(kern_height / 2); j <= kern_height / 2; j++)
+		{
+			int y_idx = j + y;
+			if(y_idx < 0)
+				y_idx += h;
+			if(y_idx >= h)
+				y_idx -= h;
+			rows[j + kern_height / 2] = &src[size_t(y_idx) * w * 4];
+		}
+		filter_row(kernel, kern_height, kern_width, &rows[0], w, &dst[size_t(y) * w * 4]);
+	}
+	newimage->buffer_changed();
+	return newimage;
+}
+
+const double sharpen_kernel[9] = {
+	0.1*(-1), 0.1*(-2), 0.1*(-1),
+	0.1*(-2), 0.1*(22), 0.1*(-2),
+	0.1*(-1), 0.1*(-2), 0.1*(-1)
+};
+
+const double edgedet_kernel[9] = {
+	0, -1, 0,
+	-1, 4, -1,
+	0, -1, 0
+};
+
+const double emboss_kernel[9] = {
+	0, 1, 0,
+	1, 0, -1,
+	0, -1, 0
+};
+
+void blur_kernel(double sigma, double kernel[9])
+{
+	double sigma2 = sigma * sigma;
+	double sum = 0;
+	for(int k = 0; k < 3; k++)
+		for(int p = 0; p < 3; p++)
+		{
+			kernel[k*3+p] = exp(double(k*k+p*p)/(-2*sigma2));
+			sum += kernel[k*3+p];
+		}
+	for(int i = 0; i < 9; i++)
+		kernel[i] /= sum;
+}
+
+Image* sharpen(const Image* img, const Progress* progress)
+{
+	return filter(sharpen_kernel, 3, 3, img, progress);
+}
+
+Image* blur(const Image* img, double sigma, const Progress* progress)
+{
+	double kernel[9];
+	blur_kernel(sigma, kernel);
+	return filter(kernel, 3, 3, img, progress);
+}
+
+// The filter, then grayscale, each with its half of the progress
+struct HalfProgress
+{
+	const Progress* progress;
+	double base;
+};
+
+static void half_progress(double percent, void* arg)
+{
+	HalfProgress* half = (HalfProgress*)arg;
+	half->progress->report(half->base + percent / 2, half->progress->arg);
+}
+
+static Image* filter_grayscale(const double* kernel, const Image* img, const Progress* progress)
+{
+	HalfProgress half = { progress, 0 };
+	Progress p = { half_progress, &half };
+	Image* filtered = filter(kernel, 3, 3, img, progress ? &p : 0);
+	half.base = 50;
+	Image* res = grayscale(filtered, progress ? &p : 0);
+	delete filtered;
+	return res;
+}
+
+Image* edge_detection(const Image* img, const Progress* progress)
+{
+	return filter_grayscale(edgedet_kernel, img, progress);
+}
+
+Image* emboss(const Image* img, const Progress* progress)
+{
+	return filter_grayscale(emboss_kernel, img, progress);
+}
+
+// An operation made of row_op() on every row
+static Image* point_operation(const Image* img, void (*row_op)(const uchar*, int, int, int, uchar*),
+	const Progress* progress)
+{
+	int w = img->buffer_width(), h = img->buffer_height();
+	const uchar* src = img->buffer();
+	Image* newimage = new_rgb32(w, h);
+	uchar* dst = newimage->buffer();
+
+	for(int y = 0; y < h; y++)
+	{
+		report(progress, y, h);
+		row_op(&src[size_t(y) * w * 4], 0, w, y, &dst[size_t(y) * w * 4]);
+	}
+	newimage->buffer_changed();
+	return newimage;
+}
+
+void grayscale_row(const uchar* row, int, int w, int, uchar* out)
+{
+	for(int x = 0; x < w; x++)
+	{
+		size_t index = x * 4;
+		uchar r = row[index + 0];
+		uchar g = row[index + 1];
+		uchar b = row[index + 2];
+
+		double val = 0.299 * r + 0.587 * g + 0.114 * b;
+		if(val > 255)
+			val = 255;
+		out[index + 0] = uchar(val);
+		out[index + 1] = uchar(val);
+		out[index + 2] = uchar(val);
+		out[index + 3] = 0;
+	}
+}
+
+Image* grayscale(const Image* img, const Progress* progress)
+{
+	return point_operation(img, grayscale_row, progress);
+}
+
+// Every pixel black or white, by comparing r + g + b to a threshold from
+// threshold(x, y, arg), x counted from the start of the image row
+static void dither_row(const uchar* row, int x0, int w, int y,
+	unsigned long (*threshold)(int x, int y, void* arg), void* arg, bool average, uchar* out)
+{
+	for(int x = 0; x < w; x++)
+	{
+		size_t index = x * 4;
+		unsigned long sum = row[index + 0] + row[index + 1] + row[index + 2];
+		if(average)
+			sum /= 3;
+		uchar tag = sum > threshold(x0 + x, y, arg) ? 255 : 0;
+		out[index + 0] = tag;
+		out[index + 1] = tag;
+		out[index + 2] = tag;
+		out[index + 3] = 0;
+	}
+}
+
+static unsigned long half_threshold(int, int, void*)
+{
+	return 255 * 3 / 2;
+}
+
+// The generator of rand() in the C standard, its state in arg
+static const unsigned long RANDOM_MUL = 1103515245, RANDOM_ADD = 12345;
+
+static unsigned long random_threshold(int, int, void* arg)
+{
+	unsigned long& state = *(unsigned long*)arg;
+	state = (state * RANDOM_MUL + RANDOM_ADD) & 0xffffffff;
+	return (state >> 16) % (255 * 3);
+}
+
+// The state n steps on, in log n steps: the steps make a linear function
+// mul * state + add, squared for every bit of n
+static unsigned long random_skip(unsigned long state, unsigned long n)
+{
+	unsigned long mul = RANDOM_MUL, add = RANDOM_ADD;
+	unsigned long skip_mul = 1, skip_add = 0;
+	for(; n; n >>= 1)
+	{
+		if(n & 1)
+		{
+			skip_mul = (skip_mul * mul) & 0xffffffff;
+			skip_add = (skip_add * mul + add) & 0xffffffff;
+		}
+		add = ((mul + 1) * add) & 0xffffffff;
+		mul = (mul * mul) & 0xffffffff;
+	}
+	return (skip_mul * state + skip_add) & 0xffffffff;
+}
+
+// sum + map[x % 4][y % 4] > 255, that is sum > 255 - map[x % 4][y % 4]
+static unsigned long bayer_threshold(int x, int y, void* arg)
+{
+	const double (*map)[4] = (const double (*)[4])arg;
+	return (unsigned long)(255 - map[x % 4][y % 4]);
+}
+
+void binarization_row(const uchar* row, int x, int w, int y, uchar* out)
+{
+	dither_row(row, x, w, y, half_threshold, 0, false, out);
+}
+
+void random_dithering_row(const uchar* row, int x, int w, int y, uchar* out)
+{
+	// the rows apart by a large odd multiplier, before the first step mixes them
+	unsigned long state = random_skip(((unsigned long)y * 2654435761UL) & 0xffffffff, x);
+	dither_row(row, x, w, y, random_threshold, &state, false, out);
+}
+
+void bayer_dithering_row(const uchar* row, int x, int w, int y, uchar* out)
+{
+	double map[4][4] = {{1, 9, 3, 11}, {13, 5, 15, 7}, {4, 12, 2, 10}, {16, 8, 14, 6}};
+	for(int i = 0; i < 4; i++)
+		for(int j = 0; j < 4; j++)
+			map[i][j] *= (255 / 17);
+	dither_row(row, x, w, y, bayer_threshold, map, true, out);
+}
+
+Image* binarization(const Image* img, const Progress* progress)
+{
+	return point_operation(img, binarization_row, progress);
+}
+
+Image* random_dithering(const Image* img, const Progress* progress)
+{
+	return point_operation(img, random_dithering_row, progress);
+}
+
+Image* bayer_dithering(const Image* img, const Progress* progress)
+{
+	return point_operation(img, bayer_dithering_row, progress);
+}
+
+
+
+// The operations by name, for the command line
+
+typedef map<string, string> Params;
+
+static bool get_number(const Params& params, const char* key, double fallback, double& value, string& error)
+{
+	Params::const_iterator p = params.find(key);
+	if(p == params.end())
+	{
+		value = fallback;
+		return true;
+	}
+	char* end;
+	value = strtod(p->second.c_str(), &end);
+	if(p->second.empty() || *end)
+	{
+		error = string(key) + ": not a number: " + p->second;
+		return false;
+	}
+	return true;
+}
+
+static bool get_int(const Params& params, const char* key, int fallback, int low, int& value, string& error)
+{
+	double v;
+	if(!get_number(params, key, fallback, v, error))
+		return false;
+	if(v != floor(v) || v < low || v > 1 << 20)
+	{
+		error = string(key) + ": out of range: " + params.find(key)->second;
+		return false;
+	}
+	value = int(v);
+	return true;
+}
+
+// One of the names, as its index, or -1
+static int get_choice(const Params& params, const char* key, const char* const* names, int fallback,
+	string& error)
+{
+	Params::const_iterator p = params.find(key);
+	if(p == params.end())
+		return fallback;
+	for(int k = 0; names[k]; k++)
+		if(p->second == names[k])
+			return k;
+	error = string(key) + ": unknown value: " + p->second;
+	return -1;
+}
+
+static Image* load_mask(const Params& params, const Image* img, string& error)
+{
+	Params::const_iterator p = params.find("mask");
+	if(p == params.end())
+	{
+		error = "mask: missing";
+		return 0;
+	}
+	string why;
+	Image* mask = load_image(p->second.c_str(), why);
+	if(!mask)
+	{
+		error = "mask: " + why;
+		return 0;
+	}
+	if(mask->buffer_width() != img->buffer_width() || mask->buffer_height() != img->buffer_height())
+	{
+		error = "mask: not the size of the image: " + p->second;
+		delete mask;
+		return 0;
+	}
+	return mask;
+}
+
+static bool sliding_average_size(const Params& params, int w, int h, int& N, string& error)
+{
+	if(!get_int(params, "size", 10, 1, N, error))
+		return false;
+	// past the right and bottom edges it reads N - i, N - j
+	if(N + N/2 >= w || N + N/2 >= h)
+	{
+		error = "size: too big for the image";
+		return false;
+	}
+	return true;
+}
+
+static Image* run_sliding_average(const Image* img, const Params& params, string& error)
+{
+	int N;
+	if(!sliding_average_size(params, img->buffer_width(), img->buffer_height(), N, error))
+		return 0;
+	return sliding_average(img, N);
+}
+
+static RowStage* stream_sliding_average(RowStage* input, const Params& params, string& error)
+{
+	int N;
+	if(!sliding_average_size(params, input->width(), input->height(), N, error))
+		return 0;
+	return sliding_average_stage(input, N);
+}
+
+static Image* run_upscale_nn(const Image* img, const Params& params, string& error)
+{
+	int N;
+	return get_int(params, "factor", 2, 1, N, error) ? upscale_nn(img, N) : 0;
+}
+
+static RowStage* stream_upscale_nn(RowStage* input, const Params& params, string& error)
+{
+	int N;
+	return get_int(params, "factor", 2, 1, N, error) ? upscale_stage(input, N, false) : 0;
+}
+
+static Image* run_upscale_bilinear(const Image* img, const Params& params, string& error)
+{
+	int N;
+	return get_int(params, "factor", 2, 1, N, error) ? upscale_bilinear(img, N) : 0;
+}
+
+static RowStage* stream_upscale_bilinear(RowStage* input, const Params& params, string& error)
+{
+	int N;
+	return get_int(params, "factor", 2, 1, N, error) ? upscale_stage(input, N, true) : 0;
+}
+
+static Image* run_sharpen(const Image* img, const Params&, string&)
+{
+	return sharpen(img);
+}
+
+static RowStage* stream_sharpen(RowStage* input, const Params&, string&)
+{
+	return filter_stage(input, sharpen_kernel, 3, 3);
+}
+
+static bool blur_sigma(const Params& params, double& sigma, string& error)
+{
+	if(!get_number(params, "sigma", 5.0, sigma, error))
+		return false;
+	if(sigma <= 0)
+	{
+		error = "sigma: has to be positive";
+		return false;
+	}
+	return true;
+}
+
+static bool tile_sharpen(const Params&, TileOp& op, string&)
+{
+	op.filter = true;
+	memcpy(op.kernel, sharpen_kernel, sizeof(op.kernel));
+	return true;
+}
+
+static Image* run_blur(const Image* img, const Params& params, string& error)
+{
+	double sigma;
+	return blur_sigma(params, sigma, error) ? blur(img, sigma) : 0;
+}
+
+static RowStage* stream_blur(RowStage* input, const Params& params, string& error)
+{
+	double sigma, kernel[9];
+	if(!blur_sigma(params, sigma, error))
+		return 0;
+	blur_kernel(sigma, kernel);
+	return filter_stage(input, kernel, 3, 3);
+}
+
+static bool tile_blur(const Params& params, TileOp& op, string& error)
+{
+	double sigma;
+	if(!blur_sigma(params, sigma, error))
+		return false;
+	op.filter = true;
+	blur_kernel(sigma, op.kernel);
+	return true;
+}
+
+static Image* run_edges(const Image* img, const Params&, string&)
+{
+	return edge_detection(img);
+}
+
+static RowStage* stream_edges(RowStage* input, const Params&, string&)
+{
+	return point_stage(filter_stage(input, edgedet_kernel, 3, 3), grayscale_row);
+}
+
+static bool tile_edges(const Params&, TileOp& op, string&)
+{
+	op.filter = true;
+	memcpy(op.kernel, edgedet_kernel, sizeof(op.kernel));
+	op.row_op = grayscale_row;
+	return true;
+}
+
+static Image* run_emboss(const Image* img, const Params&, string&)
+{
+	return emboss(img);
+}
+
+static RowStage* stream_emboss(RowStage* input, const Params&, string&)
+{
+	return point_stage(filter_stage(input, emboss_kernel, 3, 3), grayscale_row);
+}
+
+static bool tile_emboss(const Params&, TileOp& op, string&)
+{
+	op.filter = true;
+	memcpy(op.kernel, emboss_kernel, sizeof(op.kernel));
+	op.row_op = grayscale_row;
+	return true;
+}
+
+// kernel=a00/a01/.../a22, times factor, as in the custom filter dialog
+static bool custom_kernel(const Params& params, double* kernel, string& error)
+{
+	double factor;
+	if(!get_number(params, "factor", 1.0, factor, error))
+		return false;
+	Params::const_iterator p = params.find("kernel");
+	if(p == params.end())
+	{
+		error = "kernel: missing";
+		return false;
+	}
+	const char* s = p->second.c_str();
+	for(int k = 0; k < 9; k++)
+	{
+		char* end;
+		kernel[k] = strtod(s, &end) * factor;
+		if(end == s || (k < 8 ? *end != '/' : *end != 0))
+		{
+			error = "kernel: expected 9 numbers separated by '/': " + p->second;
+			return false;
+		}
+		s = end + 1;
+	}
+	return true;
+}
+
+static Image* run_custom(const Image* img, const Params& params, string& error)
+{
+	double kernel[9];
+	return custom_kernel(params, kernel, error) ? filter(kernel, 3, 3, img) : 0;
+}
+
+static RowStage* stream_custom(RowStage* input, const Params& params, string& error)
+{
+	double kernel[9];
+	return custom_kernel(params, kernel, error) ? filter_stage(input, kernel, 3, 3) : 0;
+}
+
+static bool tile_custom(const Params& params, TileOp& op, string& error)
+{
+	op.filter = true;
+	return custom_kernel(params, op.kernel, error);
+}
+
+static Image* run_grayscale(const Image* img, const Params&, string&)
+{
+	return grayscale(img);
+}
+
+static RowStage* stream_grayscale(RowStage* input, const Params&, string&)
+{
+	return point_stage(input, grayscale_row);
+}
+
+static bool tile_grayscale(const Params&, TileOp& op, string&)
+{
+	op.row_op = grayscale_row;
+	return true;
+}
+
+static Image* run_binarize(const Image* img, const Params&, string&)
+{
+	return binarization(img);
+}
+
+static RowStage* stream_binarize(RowStage* input, const Params&, string&)
+{
+	return point_stage(input, binarization_row);
+}
+
+static bool tile_binarize(const Params&, TileOp& op, string&)
+{
+	op.row_op = binarization_row;
+	return true;
+}
+
+static Image* run_random_dither(const Image* img, const Params&, string&)
+{
+	return random_dithering(img);
+}
+
+static RowStage* stream_random_dither(RowStage* input, const Params&, string&)
+{
+	return point_stage(input, random_dithering_row);
+}
+
+static bool tile_random_dither(const Params&, TileOp& op, string&)
+{
+	op.row_op = random_dithering_row;
+	return true;
+}
+
+static Image* run_bayer_dither(const Image* img, const Params&, string&)
+{
+	return bayer_dithering(img);
+}
+
+static RowStage* stream_bayer_dither(RowStage* input, const Params&, string&)
+{
+	return point_stage(input, bayer_dithering_row);
+}
+
+static bool tile_bayer_dither(const Params&, TileOp& op, string&)
+{
+	op.row_op = bayer_dithering_row;
+	return true;
+}
+
+static const char* const distance_names[] = { "fmm", "edt", "sweep", 0 };
+// SEARCH_DESCRIPTORS by the kind of index
+static const char* const search_names[] = { "exhaustive", "patchmatch", "local", "kdtree", "vptree", 0 };
+
+static bool fast_marching_settings(const Params& params, InpaintConfig& config, string& error)
+{
+	double radius;
+	if(!get_number(params, "radius", config.B_radius, radius, error))
+		return false;
+	config.B_radius = float(radius);
+	config.dist_method = get_choice(params, "distance", distance_names, DISTANCE_FMM, error);
+	Params::const_iterator dump = params.find("dump");
+	if(dump != params.end())
+		config.dump = dump->second.c_str();
+	return config.dist_method >= 0;
+}
+
+static bool criminisi_settings(const Params& params, CriminisiConfig& config, string& error)
+{
+	int search = get_choice(params, "search", search_names, SEARCH_EXHAUSTIVE, error);
+	if(search < 0)
+		return false;
+	if(search >= SEARCH_DESCRIPTORS)
+	{
+		config.index_kind = search == SEARCH_DESCRIPTORS ? INDEX_KDTREE : INDEX_VPTREE;
+		search = SEARCH_DESCRIPTORS;
+	}
+	config.search = search;
+	return get_int(params, "batch", config.batch, 1, config.batch, error) &&
+		get_int(params, "levels", config.levels, -1, config.levels, error);
+}
+
+static Image* run_fast_marching(const Image* img, const Params& params, string& error)
+{
+	InpaintConfig config;
+	config.quiet = true;  // the batch reports the jobs itself
+	if(!fast_marching_settings(params, config, error))
+		return 0;
+	Image* mask = load_mask(params, img, error);
+	if(!mask)
+		return 0;
+	Image* res = inpaint_fast_marching(img, mask, config);
+	delete mask;
+	return res;
+}
+
+static Image* run_criminisi(const Image* img, const Params& params, string& error)
+{
+	CriminisiConfig config;
+	config.quiet = true;
+	if(!criminisi_settings(params, config, error))
+		return 0;
+	Image* mask = load_mask(params, img, error);
+	if(!mask)
+		return 0;
+	Image* res = inpaint_criminisi(img, mask, config);
+	delete mask;
+	return res;
+}
+
+struct Operation
+{
+	const char* name;
+	const char* keys;	// the parameters it takes, with their defaults
+	Image* (*run)(const Image*, const Params&, string&);
+	// Its stage after the input given, for streaming (0 if it can't be)
+	RowStage* (*stream)(RowStage*, const Params&, string&);
+	// How it runs on tiles (0 if it can't)
+	bool (*tiled)(const Params&, TileOp&, string&);
+};
+
+static const Operation operations[] = {
+	{ "sliding-average", "size=10", run_sliding_average, stream_sliding_average, 0 },
+	{ "upscale-nn", "factor=2", run_upscale_nn, stream_upscale_nn, 0 },
+	{ "upscale-bilinear", "factor=2", run_upscale_bilinear, stream_upscale_bilinear, 0 },
+	{ "sharpen", "", run_sharpen, stream_sharpen, tile_sharpen },
+	{ "blur", "sigma=5", run_blur, stream_blur, tile_blur },
+	{ "edges", "", run_edges, stream_edges, tile_edges },
+	{ "emboss", "", run_emboss, stream_emboss, tile_emboss },
+	{ "custom", "kernel=a00/a01/a02/a10/a11/a12/a20/a21/a22,factor=1", run_custom, stream_custom, tile_custom },
+	{ "grayscale", "", run_grayscale, stream_grayscale, tile_grayscale },
+	{ "binarize", "", run_binarize, stream_binarize, tile_binarize },
+	{ "random-dither", "", run_random_dither, stream_random_dither, tile_random_dither },
+	{ "bayer-dither", "", run_bayer_dither, stream_bayer_dither, tile_bayer_dither },
+	{ "fmm", "mask=FILE,radius=5,distance=fmm|edt|sweep,dump=PREFIX", run_fast_marching, 0, 0 },
+	{ "criminisi", "mask=FILE,search=exhaustive|patchmatch|local|kdtree|vptree,batch=1,levels=0", run_criminisi,
+		0, 0 },
+	{ 0, 0, 0, 0, 0 }
+};
+
+// Splits "name:key=value,..." and checks the keys against the operation's
+static const Operation* parse_operation(const char* spec, Params& params, string& error)
+{
+	const char* colon = strchr(spec, ':');
+	string name = colon ? string(spec, colon) : string(spec);
+	const Operation* op = operations;
+	while(op->name && name != op->name)
+		op++;
+	if(!op->name)
+	{
+		error = "unknown operation: " + name;
+		return 0;
+	}
+	params.clear();
+	if(!colon)
+		return op;
+	string rest = colon + 1;
+	size_t start = 0;
+	while(start <= rest.size())
+	{
+		size_t end = rest.find(',', start);
+		if(end == string::npos)
+			end = rest.size();
+		string item = rest.substr(start, end - start);
+		size_t eq = item.find('=');
+		string key = item.substr(0, eq);
+		// the key must be one of the "key=" in op->keys
+		string keys = string(",") + op->keys;
+		if(eq == string::npos || key.empty() || keys.find("," + key + "=") == string::npos)
+		{
+			error = name + ": unknown parameter: " + item;
+			return 0;
+		}
+		params[key] = item.substr(eq + 1);
+		start = end + 1;
+	}
+	return op;
+}
+
+Image* run_operation(const char* spec, const Image* img, string& error)
+{
+	Params params;
+	const Operation* op = parse_operation(spec, params, error);
+	if(!op)
+		return 0;
+	Image* res = op->run(img, params, error);
+	if(!res && error.empty())
+		error = string(op->name) + ": failed";
+	else if(!res)
+		error = string(op->name) + ": " + error;
+	return res;
+}
+
+bool parse_inpaint(const char* spec, InpaintSettings& settings, string& error)
+{
+	Params params;
+	const Operation* op = parse_operation(spec, params, error);
+	if(!op)
+		return false;
+	settings = InpaintSettings();
+	settings.criminisi = op->run == run_criminisi;
+	if(op->run != run_fast_marching && !settings.criminisi)
+	{
+		error = string(op->name) + ": not an inpaint";
+		return false;
+	}
+	Params::const_iterator mask = params.find("mask");
+	if(mask != params.end())
+		settings.mask = mask->second;
+	bool ok = settings.criminisi ? criminisi_settings(params, settings.criminisi_config, error) :
+		fast_marching_settings(params, settings.fast_marching, error);
+	// the jobs of a manifest would write their dumps over each other's
+	settings.fast_marching.dump = 0;
+	if(!ok)
+		error = string(op->name) + ": " + error;
+	return ok;
+}
+
+RowStage* stream_operation(const char* spec, RowStage* input, string& error)
+{
+	Params params;
+	const Operation* op = parse_operation(spec, params, error);
+	if(op && !op->stream)
+		error = string(op->name) + ": can't be streamed";
+	RowStage* res = op && op->stream ? op->stream(input, params, error) : 0;
+	if(!res)
+	{
+		delete input;
+		if(op && op->stream)
+			error = string(op->name) + ": " + error;
+	}
+	return res;
+}
+
+bool tile_operation(const char* spec, TileOp& op, string& error)
+{
+	Params params;
+	const Operation* operation = parse_operation(spec, params, error);
+	if(!operation)
+		return false;
+	if(!operation->tiled)
+	{
+		error = string(operation->name) + ": can't be run by tiles";
+		return false;
+	}
+	op.filter = false;
+	op.row_op = 0;
+	if(!operation->tiled(params, op, error))
+	{
+		error = string(operation->name) + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+bool check_operation(const char* spec, string& error, bool stream)
+{
+	Params params;
+	const Operation* op = parse_operation(spec, params, error);
+	if(op && stream && !op->stream)
+	{
+		error = string(op->name) + ": can't be streamed";
+		return false;
+	}
+	return op != 0;
+}
+
+const char* operation_help()
+{
+	static string help;
+	if(help.empty())
+		for(const Operation* op = operations; op->name; op++)
+		{
+			help += string("  ") + op->name;
+			if(*op->keys)
+				help += string(":") + op->keys;
+			help += "\n";
+		}
+	return help.c_str();
+}
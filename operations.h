@@ -0,0 +1,77 @@
+#ifndef OPERATIONS_H
+#define OPERATIONS_H
+
+#include <string>
+
+#include <fltk/Image.h>
+
+#include "tile_op.h"
+
+// The editing operations, apart from any window: they read RGB32 images and
+// return new ones, leaving the input as it is. The same functions serve the
+// menu commands and the command line batch mode.
+
+fltk::Image* sliding_average(const fltk::Image* img, int N, const Progress* progress = 0);
+fltk::Image* upscale_nn(const fltk::Image* img, int N, const Progress* progress = 0);
+fltk::Image* upscale_bilinear(const fltk::Image* img, int N, const Progress* progress = 0);
+
+// Convolution with a kern_width x kern_height kernel (odd sizes); the image
+// wraps around at the borders
+fltk::Image* filter(const double* kernel, int kern_height, int kern_width, const fltk::Image* img,
+	const Progress* progress = 0);
+fltk::Image* sharpen(const fltk::Image* img, const Progress* progress = 0);
+fltk::Image* blur(const fltk::Image* img, double sigma, const Progress* progress = 0);
+fltk::Image* edge_detection(const fltk::Image* img, const Progress* progress = 0);
+fltk::Image* emboss(const fltk::Image* img, const Progress* progress = 0);
+
+fltk::Image* grayscale(const fltk::Image* img, const Progress* progress = 0);
+fltk::Image* binarization(const fltk::Image* img, const Progress* progress = 0);
+fltk::Image* random_dithering(const fltk::Image* img, const Progress* progress = 0);
+fltk::Image* bayer_dithering(const fltk::Image* img, const Progress* progress = 0);
+
+extern const double sharpen_kernel[9], edgedet_kernel[9], emboss_kernel[9];
+void blur_kernel(double sigma, double kernel[9]);
+
+// Row kernels: row y of a result, from the rows of the input w pixels wide it
+// is made of. The operations above run them on every row, and so do their
+// streaming versions (see row_stream.h), which keep only those rows.
+
+// rows[j] is input row sliding_average_row_index(y, j - N/2, N, h)
+int sliding_average_row_index(int y, int j, int N, int h);
+void sliding_average_row(const uchar* const* rows, int w, int N, uchar* out);
+// row is input row y / N
+void upscale_nn_row(const uchar* row, int w, int N, uchar* out);
+// floor_row is input row y / N, ceil_row the next one (or the same on the last row)
+void upscale_bilinear_row(const uchar* floor_row, const uchar* ceil_row, int w, int N, int y, uchar* out);
+// rows[j] is input row y + j - kern_height/2, wrapped around
+void filter_row(const double* kernel, int kern_height, int kern_width, const uchar* const* rows, int w,
+	uchar* out);
+// row is input row y from column x, 0 but on the tiles past the first (see
+// tile_store.h)
+void grayscale_row(const uchar* row, int x, int w, int y, uchar* out);
+void binarization_row(const uchar* row, int x, int w, int y, uchar* out);
+// The noise from a generator of the row's own, started from y and taken on to
+// x, so that it's the same whichever thread or pass makes the row
+void random_dithering_row(const uchar* row, int x, int w, int y, uchar* out);
+void bayer_dithering_row(const uchar* row, int x, int w, int y, uchar* out);
+
+// An operation by name with its parameters, as given on the command line:
+// "name" or "name:key=value,key=value". Returns the new image, or 0 with the
+// reason in 'error'.
+fltk::Image* run_operation(const char* spec, const fltk::Image* img, std::string& error);
+
+// The operation as a stage after 'input' (see row_stream.h), which it takes
+// over; 0, with the reason in 'error' and 'input' deleted, if it fails or
+// can't be streamed
+class RowStage;
+RowStage* stream_operation(const char* spec, RowStage* input, std::string& error);
+
+// false, with the reason in 'error', if the operation can't be run by tiles
+bool tile_operation(const char* spec, TileOp& op, std::string& error);
+
+// Checks the spec without running it, and that it can be streamed if asked
+bool check_operation(const char* spec, std::string& error, bool stream = false);
+// One line per operation with its parameters and their defaults
+const char* operation_help();
+
+#endif
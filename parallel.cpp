@@ -0,0 +1,227 @@
+
+#include <algorithm>
+#include <vector>
+
+#include <fltk/Threads.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+using namespace std;
+using namespace fltk;
+
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Set on the threads running chunks: a parallel_for() called from a chunk
+// runs on its own thread, the others being busy already
+static THREAD_LOCAL int in_parallel_for = 0;
+
+
+// The worker threads are started as the first parallel_for() calls need
+// them and then wait for jobs for as long as the program runs. Several
+// threads may run parallel_for() at once; the workers help with whichever
+// job still has chunks and room for them.
+struct ParallelJob
+{
+	void (*body)(int, int, void*);
+	void* arg;
+	int next, end, grain;
+	int helpers, max_helpers;  // workers attached to the job, and how many may be
+};
+
+struct WorkerPool
+{
+	SignalMutex lock;  // guards the rest and the jobs' counters
+	vector<ParallelJob*> jobs;
+	int threads, idle;
+	WorkerPool() : lock(), jobs(), threads(0), idle(0) {}
+};
+
+// Never destroyed: the workers still wait on it when the program exits
+static WorkerPool& pool = *new WorkerPool;
+
+// SignalMutex::wait() only yields on Windows, which would keep the idle
+// workers spinning between jobs, so they sleep on a semaphore there
+#ifdef _WIN32
+static HANDLE work_posted = CreateSemaphore(0, 0, 0x7fffffff, 0);
+
+static void wait_for_work()
+{
+	pool.lock.unlock();
+	WaitForSingleObject(work_posted, INFINITE);
+	pool.lock.lock();
+}
+
+static void post_work()
+{
+	if(pool.idle)
+		ReleaseSemaphore(work_posted, pool.idle, 0);
+}
+#else
+static void wait_for_work()
+{
+	pool.lock.wait();
+}
+
+static void post_work()
+{
+	pool.lock.signal();
+}
+#endif
+
+// Takes chunks off the job until none are left. Called with the pool locked.
+static void run_chunks(ParallelJob* job)
+{
+	while(job->next < job->end)
+	{
+		int lo = job->next;
+		int hi = job->end - lo > job->grain ? lo + job->grain : job->end;
+		job->next = hi;
+		pool.lock.unlock();
+		in_parallel_for = 1;
+		job->body(lo, hi, job->arg);
+		in_parallel_for = 0;
+		pool.lock.lock();
+	}
+}
+
+static void* worker_thread(void*)
+{
+	pool.lock.lock();
+	for(;;)
+	{
+		ParallelJob* job = 0;
+		for(size_t k = 0; k < pool.jobs.size() && !job; k++)
+		{
+			ParallelJob* j = pool.jobs[k];
+			if(j->next < j->end && j->helpers < j->max_helpers)
+				job = j;
+		}
+		if(!job)
+		{
+			pool.idle++;
+			wait_for_work();
+			pool.idle--;
+			continue;
+		}
+		job->helpers++;
+		run_chunks(job);
+		job->helpers--;
+		if(job->helpers == 0)
+			pool.lock.signal();
+	}
+	return 0;
+}
+
+static int forced_workers = 0;
+
+void set_worker_count(int n)
+{
+	forced_workers = n > 0 ? n : 0;
+}
+
+int worker_count()
+{
+	if(forced_workers)
+		return forced_workers;
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int n = int(si.dwNumberOfProcessors);
+#else
+	int n = int(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	return n > 0 ? n : 1;
+}
+
+void parallel_for(int begin, int end, int grain, void (*body)(int, int, void*), void* arg)
+{
+	if(grain < 1)
+		grain = 1;
+	int chunks = (end - begin + grain - 1) / grain;
+	int threads = in_parallel_for ? 1 : worker_count();
+	if(threads > chunks)
+		threads = chunks;
+	if(threads <= 1)
+	{
+		if(end > begin)
+			body(begin, end, arg);
+		return;
+	}
+
+	ParallelJob job;
+	job.body = body;
+	job.arg = arg;
+	job.next = begin;
+	job.end = end;
+	job.grain = grain;
+	job.helpers = 0;
+	job.max_helpers = threads - 1;
+
+	pool.lock.lock();
+	while(pool.threads < threads - 1)
+	{
+		Thread t;
+		int rc = create_thread(t, worker_thread, 0);
+#ifdef _WIN32
+		if(rc == -1)
+			break;
+#else
+		if(rc != 0)
+			break;
+		pthread_detach(t);
+#endif
+		pool.threads++;
+	}
+	pool.jobs.push_back(&job);
+	post_work();
+	run_chunks(&job);
+	while(job.helpers)
+		pool.lock.wait();
+	pool.jobs.erase(find(pool.jobs.begin(), pool.jobs.end(), &job));
+	pool.lock.unlock();
+}
+
+#ifdef _WIN32
+unsigned int atomic_read(unsigned int* p)
+{
+	return (unsigned int)InterlockedCompareExchange((volatile LONG*)p, 0, 0);
+}
+
+void atomic_min(unsigned int* p, unsigned int v)
+{
+	unsigned int seen = atomic_read(p);
+	while(v < seen)
+	{
+		unsigned int was = (unsigned int)InterlockedCompareExchange((volatile LONG*)p, LONG(v), LONG(seen));
+		if(was == seen)
+			break;
+		seen = was;
+	}
+}
+#else
+unsigned int atomic_read(unsigned int* p)
+{
+	return __sync_val_compare_and_swap(p, 0u, 0u);
+}
+
+void atomic_min(unsigned int* p, unsigned int v)
+{
+	unsigned int seen = atomic_read(p);
+	while(v < seen)
+	{
+		unsigned int was = __sync_val_compare_and_swap(p, seen, v);
+		if(was == seen)
+			break;
+		seen = was;
+	}
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Splits the index range [begin, end) into chunks of 'grain' indices and runs
+// body(lo, hi, arg) for every chunk on a set of worker threads. The calling
+// thread takes part in the work; the function returns when all chunks are done.
+// Chunks may run in any order, so body() must only write to data owned by its
+// [lo, hi) range. A parallel_for() inside body() runs on the calling thread.
+void parallel_for(int begin, int end, int grain, void (*body)(int, int, void*), void* arg);
+
+// Number of threads parallel_for() spreads the work over: one per processor,
+// unless set_worker_count() asked for some other number (0 goes back to that)
+int worker_count();
+void set_worker_count(int n);
+
+// A value the chunks of a parallel_for() share, such as the least cost found
+// so far: read, and lowered to v unless it's less already, atomically
+unsigned int atomic_read(unsigned int* p);
+void atomic_min(unsigned int* p, unsigned int v);
+
+#endif
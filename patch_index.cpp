@@ -0,0 +1,389 @@
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "patch_index.h"
+
+using namespace std;
+
+
+static const int PCA_ITERATIONS = 40;  // of the subspace iteration
+static const int LEAF_SIZE = 8;        // points in a kd-tree leaf
+
+// The basis is found by subspace iteration on the covariance matrix [1]:
+// multiplying by it and orthonormalizing again turns any starting basis
+// towards the directions of largest variance.
+void PCA::fit(const float* samples, int n, int dims_, int components_)
+{
+	dims = dims_;
+	components = min(components_, dims);
+	mean.assign(dims, 0);
+	basis.assign(components * dims, 0);
+	if(n <= 0)
+		return;
+
+	vector<double> m(dims, 0);
+	for(int s = 0; s < n; s++)
+		for(int i = 0; i < dims; i++)
+			m[i] += samples[s*dims + i];
+	for(int i = 0; i < dims; i++)
+		mean[i] = float(m[i] /= n);
+
+	vector<double> cov(dims * dims, 0), d(dims);
+	for(int s = 0; s < n; s++)
+	{
+		for(int i = 0; i < dims; i++)
+			d[i] = samples[s*dims + i] - m[i];
+		for(int i = 0; i < dims; i++)
+			for(int j = i; j < dims; j++)
+				cov[i*dims + j] += d[i] * d[j];
+	}
+	for(int i = 0; i < dims; i++)
+		for(int j = 0; j < i; j++)
+			cov[i*dims + j] = cov[j*dims + i];
+
+	vector<double> q(components * dims), z(components * dims);
+	for(int k = 0; k < components; k++)
+		for(int i = 0; i < dims; i++)
+			q[k*dims + i] = i == k ? 1 : 1.0 / (1 + (i*7 + k*13) % 17);
+	for(int it = 0; it < PCA_ITERATIONS; it++)
+	{
+		for(int k = 0; k < components; k++)
+			for(int i = 0; i < dims; i++)
+			{
+				double sum = 0;
+				for(int j = 0; j < dims; j++)
+					sum += cov[i*dims + j] * q[k*dims + j];
+				z[k*dims + i] = sum;
+			}
+		// Gram-Schmidt; a direction with no variance left stays 0
+		for(int k = 0; k < components; k++)
+		{
+			double* v = &z[k*dims];
+			for(int l = 0; l < k; l++)
+			{
+				double dot = 0;
+				for(int i = 0; i < dims; i++)
+					dot += v[i] * z[l*dims + i];
+				for(int i = 0; i < dims; i++)
+					v[i] -= dot * z[l*dims + i];
+			}
+			double norm = 0;
+			for(int i = 0; i < dims; i++)
+				norm += v[i] * v[i];
+			norm = sqrt(norm);
+			for(int i = 0; i < dims; i++)
+				v[i] = norm > 1e-9 ? v[i] / norm : 0;
+		}
+		q.swap(z);
+	}
+	for(int i = 0; i < components * dims; i++)
+		basis[i] = float(q[i]);
+}
+
+void PCA::restore(const float* mean_, const float* basis_, int dims_, int components_)
+{
+	dims = dims_;
+	components = components_;
+	mean.assign(mean_, mean_ + dims);
+	basis.assign(basis_, basis_ + components * dims);
+}
+
+void PCA::project(const float* v, float* out) const
+{
+	for(int k = 0; k < components; k++)
+	{
+		const float* b = &basis[k*dims];
+		float sum = 0;
+		for(int i = 0; i < dims; i++)
+			sum += (v[i] - mean[i]) * b[i];
+		out[k] = sum;
+	}
+}
+
+
+static float distance2(const float* a, const float* b, int dims)
+{
+	float sum = 0;
+	for(int i = 0; i < dims; i++)
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
+	return sum;
+}
+
+// The k best candidates seen so far, as a max-heap on (distance, index):
+// of equal distances the lower index wins, whatever order they come in
+class Nearest
+{
+public:
+	Nearest(int k) : k(k), best() {}
+
+	bool full() const	{ return int(best.size()) == k; }
+	float worst() const	{ return best.front().first; }
+
+	void offer(float d, int i)
+	{
+		pair<float, int> c(d, i);
+		if(!full())
+		{
+			best.push_back(c);
+			push_heap(best.begin(), best.end());
+		}
+		else if(c < best.front())
+		{
+			pop_heap(best.begin(), best.end());
+			best.back() = c;
+			push_heap(best.begin(), best.end());
+		}
+	}
+
+	void result(vector<int>& r)
+	{
+		sort_heap(best.begin(), best.end());
+		r.resize(best.size());
+		for(size_t i = 0; i < best.size(); i++)
+			r[i] = best[i].second;
+	}
+
+private:
+	int k;
+	vector<pair<float, int> > best;
+};
+
+// Sorts point indices by one of their coordinates
+struct CoordinateLess
+{
+	const float* points;
+	int dims, dim;
+
+	bool operator()(int a, int b) const
+	{
+		return points[a*dims + dim] < points[b*dims + dim];
+	}
+};
+
+
+// kd-tree [2]. The points of a node are a range of 'order'; inner nodes
+// split it at the median of the coordinate with the widest spread.
+class KdTree : public PointIndex
+{
+public:
+	KdTree() : points(0), dims(0), order(), nodes() {}
+
+	void build(const float* points_, int n, int dims_)
+	{
+		points = points_;
+		dims = dims_;
+		order.resize(n);
+		for(int i = 0; i < n; i++)
+			order[i] = i;
+		nodes.clear();
+		if(n > 0)
+			build_node(0, n);
+	}
+
+	void nearest(const float* q, int k, vector<int>& result) const
+	{
+		result.clear();
+		if(nodes.empty() || k <= 0)
+			return;
+		Nearest best(k);
+		search(0, q, best);
+		best.result(result);
+	}
+
+private:
+	struct Node
+	{
+		int begin, end;    // range of 'order'
+		int dim;           // split coordinate, -1 for a leaf
+		float split;
+		int left, right;   // children
+	};
+
+	int build_node(int begin, int end)
+	{
+		int id = int(nodes.size());
+		Node node = { begin, end, -1, 0, -1, -1 };
+		nodes.push_back(node);
+		if(end - begin <= LEAF_SIZE)
+			return id;
+
+		int dim = 0;
+		float widest = -1;
+		for(int d = 0; d < dims; d++)
+		{
+			float lo = points[order[begin]*dims + d], hi = lo;
+			for(int i = begin + 1; i < end; i++)
+			{
+				float v = points[order[i]*dims + d];
+				lo = min(lo, v);
+				hi = max(hi, v);
+			}
+			if(hi - lo > widest)
+			{
+				widest = hi - lo;
+				dim = d;
+			}
+		}
+		if(widest <= 0)
+			return id;  // all the same point
+
+		int mid = (begin + end) / 2;
+		CoordinateLess less = { points, dims, dim };
+		nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, less);
+		nodes[id].dim = dim;
+		nodes[id].split = points[order[mid]*dims + dim];
+		int left = build_node(begin, mid);
+		int right = build_node(mid, end);
+		nodes[id].left = left;
+		nodes[id].right = right;
+		return id;
+	}
+
+	void search(int id, const float* q, Nearest& best) const
+	{
+		const Node& node = nodes[id];
+		if(node.dim < 0)
+		{
+			for(int i = node.begin; i < node.end; i++)
+				best.offer(distance2(q, &points[order[i]*dims], dims), order[i]);
+			return;
+		}
+		float diff = q[node.dim] - node.split;
+		int near = diff < 0 ? node.left : node.right, far = diff < 0 ? node.right : node.left;
+		search(near, q, best);
+		if(!best.full() || diff*diff <= best.worst())
+			search(far, q, best);
+	}
+
+	const float* points;
+	int dims;
+	vector<int> order;
+	vector<Node> nodes;
+
+	KdTree(const KdTree&);
+	KdTree& operator=(const KdTree&);
+};
+
+
+// Vantage point tree [3]. Every node holds a point and the median distance of
+// the others to it; the nearer half goes inside, the rest outside.
+class VpTree : public PointIndex
+{
+public:
+	VpTree() : points(0), dims(0), nodes() {}
+
+	void build(const float* points_, int n, int dims_)
+	{
+		points = points_;
+		dims = dims_;
+		nodes.clear();
+		nodes.reserve(n);
+		vector<int> items(n);
+		for(int i = 0; i < n; i++)
+			items[i] = i;
+		vector<float> dist(n);
+		if(n > 0)
+			build_node(items, dist, 0, n);
+	}
+
+	void nearest(const float* q, int k, vector<int>& result) const
+	{
+		result.clear();
+		if(nodes.empty() || k <= 0)
+			return;
+		Nearest best(k);
+		search(0, q, best);
+		best.result(result);
+	}
+
+private:
+	struct Node
+	{
+		int point;
+		float radius;        // median distance of the others to the point
+		int inside, outside; // children, -1 if none
+	};
+
+	// Distance of every item to the vantage point, for sorting them
+	struct DistanceLess
+	{
+		const vector<float>* dist;
+
+		bool operator()(int a, int b) const
+		{
+			return (*dist)[a] < (*dist)[b];
+		}
+	};
+
+	// Takes the first item of [begin, end) as the vantage point
+	int build_node(vector<int>& items, vector<float>& dist, int begin, int end)
+	{
+		int id = int(nodes.size());
+		Node node = { items[begin], 0, -1, -1 };
+		nodes.push_back(node);
+		begin++;
+		if(begin == end)
+			return id;
+
+		const float* vp = &points[node.point*dims];
+		for(int i = begin; i < end; i++)
+			dist[items[i]] = sqrt(distance2(vp, &points[items[i]*dims], dims));
+		int mid = (begin + end) / 2;
+		DistanceLess less = { &dist };
+		nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, less);
+		nodes[id].radius = dist[items[mid]];
+		int inside = begin < mid ? build_node(items, dist, begin, mid) : -1;
+		int outside = build_node(items, dist, mid, end);
+		nodes[id].inside = inside;
+		nodes[id].outside = outside;
+		return id;
+	}
+
+	void search(int id, const float* q, Nearest& best) const
+	{
+		const Node& node = nodes[id];
+		float d2 = distance2(q, &points[node.point*dims], dims);
+		best.offer(d2, node.point);
+		float d = sqrt(d2);
+		// points inside are no farther than 'radius' from the vantage point,
+		// the ones outside no nearer
+		if(d < node.radius)
+		{
+			if(node.inside >= 0)
+				search(node.inside, q, best);
+			if(node.outside >= 0 && (!best.full() || d + sqrt(best.worst()) >= node.radius))
+				search(node.outside, q, best);
+		}
+		else
+		{
+			if(node.outside >= 0)
+				search(node.outside, q, best);
+			if(node.inside >= 0 && (!best.full() || d - sqrt(best.worst()) <= node.radius))
+				search(node.inside, q, best);
+		}
+	}
+
+	const float* points;
+	int dims;
+	vector<Node> nodes;
+
+	VpTree(const VpTree&);
+	VpTree& operator=(const VpTree&);
+};
+
+
+PointIndex* make_point_index(int kind)
+{
+	if(kind == INDEX_VPTREE)
+		return new VpTree;
+	return new KdTree;
+}
+
+// Список литературы:
+//  [1] G. Golub, C. Van Loan, "Matrix Computations", 3rd ed., 1996, 7.3
+//  [2] J. Friedman, J. Bentley, R. Finkel, "An Algorithm for Finding Best Matches
+//      in Logarithmic Expected Time", 1977
+//  [3] P. Yianilos, "Data Structures and Algorithms for Nearest Neighbor Search
+//      in General Metric Spaces", 1993
@@ -0,0 +1,53 @@
+#ifndef PATCH_INDEX_H
+#define PATCH_INDEX_H
+
+#include <vector>
+
+// Principal component analysis of a set of vectors: the mean and the
+// 'components' directions of largest variance, the basis of the low
+// dimensional descriptors of the patches
+class PCA
+{
+public:
+	PCA() : dims(0), components(0), mean(), basis() {}
+
+	// 'samples' holds n vectors of 'dims' floats one after another
+	void fit(const float* samples, int n, int dims, int components);
+	// The coordinates of v - mean in the basis, 'components' floats
+	void project(const float* v, float* out) const;
+
+	int size() const	{ return components; }
+	int dimensions() const	{ return dims; }
+	const float* average() const	{ return &mean[0]; }
+	const float* vectors() const	{ return &basis[0]; }	// size() x dimensions() floats
+
+	// The same PCA again, from the average() and vectors() of a fitted one
+	void restore(const float* mean, const float* basis, int dims, int components);
+
+private:
+	int dims, components;
+	std::vector<float> mean;
+	std::vector<float> basis;  // 'components' unit vectors of 'dims' floats
+};
+
+// Exact k nearest neighbours by Euclidean distance among n points of 'dims'
+// floats. The points stay the caller's and must not move while indexed.
+class PointIndex
+{
+public:
+	virtual ~PointIndex() {}
+
+	virtual void build(const float* points, int n, int dims) = 0;
+	// Indices of the (up to) k points nearest to q, the nearest first
+	virtual void nearest(const float* q, int k, std::vector<int>& result) const = 0;
+};
+
+enum PointIndexKind
+{
+	INDEX_KDTREE,	// splits on the median of the widest coordinate
+	INDEX_VPTREE	// splits on the median distance to a vantage point
+};
+
+PointIndex* make_point_index(int kind);
+
+#endif
@@ -0,0 +1,70 @@
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PATCH_SSD_SSE2
+#endif
+
+#include <fltk/Image.h>
+
+#include "patch_ssd.h"
+
+using namespace fltk;
+
+
+static inline unsigned int pixel_ssd(const uchar* p, const uchar* q)
+{
+	int r = p[0] - q[0], g = p[1] - q[1], b = p[2] - q[2];
+	return r*r + g*g + b*b;
+}
+
+// Four pixels at a time: the bytes are widened to 16 bits, subtracted and
+// squared with madd, which also adds them pairwise into 32 bit lanes. The
+// fourth byte of every pixel and the pixels masked out are zeroed in both
+// blocks beforehand, so they add nothing.
+unsigned int patch_ssd(const uchar* a, int a_stride, const uchar* b, int b_stride,
+	const uchar* mask, int mask_stride, int w, int h, unsigned int limit)
+{
+	unsigned int sum = 0;
+#ifdef PATCH_SSD_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+#endif
+	for(int y = 0; y < h; y++)
+	{
+		const uchar* pa = a + y*a_stride;
+		const uchar* pb = b + y*b_stride;
+		const uchar* pm = mask ? mask + y*mask_stride : 0;
+		int x = 0;
+#ifdef PATCH_SSD_SSE2
+		__m128i acc = zero;
+		for(; x + 4 <= w; x += 4)
+		{
+			__m128i lanes = rgb;
+			if(pm)
+			{
+				int m;
+				memcpy(&m, pm + x, 4);
+				__m128i mm = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m), zero);
+				mm = _mm_unpacklo_epi16(mm, zero);  // a 32 bit lane per pixel
+				lanes = _mm_andnot_si128(_mm_cmpeq_epi32(mm, zero), rgb);
+			}
+			__m128i va = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pa + 4*x)), lanes);
+			__m128i vb = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pb + 4*x)), lanes);
+			__m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+			__m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+			acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		sum += (unsigned int)_mm_cvtsi128_si32(acc);
+#endif
+		for(; x < w; x++)
+			if(!pm || pm[x])
+				sum += pixel_ssd(pa + 4*x, pb + 4*x);
+		if(sum > limit)
+			break;
+	}
+	return sum;
+}
@@ -0,0 +1,15 @@
+#ifndef PATCH_SSD_H
+#define PATCH_SSD_H
+
+#include <fltk/Image.h>
+
+// Sum of squared differences of the R, G and B channels of two w x h blocks of
+// RGB32 pixels, 'a' and 'b' pointing at their top left pixels and the strides
+// given in bytes. Pixels whose byte in 'mask' (w x h, one byte per pixel) is 0
+// are skipped; with no mask all the pixels count. The sum is checked after
+// every row, and as soon as it gets over 'limit' the rest is skipped and that
+// partial sum, still over the limit, returned. Blocks up to 104 x 104 pixels.
+unsigned int patch_ssd(const unsigned char* a, int a_stride, const unsigned char* b, int b_stride,
+	const unsigned char* mask, int mask_stride, int w, int h, unsigned int limit);
+
+#endif
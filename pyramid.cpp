@@ -0,0 +1,232 @@
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include <fltk/Image.h>
+
+#include "pyramid.h"
+
+using namespace std;
+using namespace fltk;
+
+
+static const int PYRAMID_MIN_SIZE = 32;   // no level is halved below this
+static const int PYRAMID_MAX_LEVELS = 8;
+
+static void read_level(const Image* image, const Image* mask, PyramidLevel& p)
+{
+	p.w = image->buffer_width();
+	p.h = image->buffer_height();
+	p.rgb.assign(image->buffer(), image->buffer() + p.w*p.h*4);
+	p.hole.resize(p.w*p.h);
+	const uchar* m = mask->buffer();
+	for(int i = 0; i < p.w*p.h; i++)
+		p.hole[i] = m[i*4 + 0] == 0 && m[i*4 + 1] == 0 && m[i*4 + 2] == 0;
+}
+
+// The level half as large
+static void halve(const PyramidLevel& a, PyramidLevel& b)
+{
+	b.w = (a.w + 1) / 2;
+	b.h = (a.h + 1) / 2;
+	b.rgb.assign(b.w*b.h*4, 0);
+	b.hole.resize(b.w*b.h);
+	for(int y = 0; y < b.h; y++)
+		for(int x = 0; x < b.w; x++)
+		{
+			int xs[2] = { 2*x, 2*x + 1 < a.w ? 2*x + 1 : 2*x };
+			int ys[2] = { 2*y, 2*y + 1 < a.h ? 2*y + 1 : 2*y };
+			int sum[3] = { 0, 0, 0 };
+			bool hole = false;
+			for(int j = 0; j < 2; j++)
+				for(int i = 0; i < 2; i++)
+				{
+					int idx = ys[j]*a.w + xs[i];
+					hole = hole || a.hole[idx];
+					for(int c = 0; c < 3; c++)
+						sum[c] += a.rgb[idx*4 + c];
+				}
+			b.hole[y*b.w + x] = hole;
+			if(!hole)
+				for(int c = 0; c < 3; c++)
+					b.rgb[(y*b.w + x)*4 + c] = uchar((sum[c] + 2) / 4);
+		}
+}
+
+// Fills the unknown pixels of 'p' by bilinear upsampling of the coarser
+// level's result 'src' (sw x sh pixels)
+static void upsample_hole(const vector<uchar>& src, int sw, int sh, PyramidLevel& p)
+{
+	for(int y = 0; y < p.h; y++)
+		for(int x = 0; x < p.w; x++)
+		{
+			if(!p.hole[y*p.w + x])
+				continue;
+			float sx = (x + 0.5f) / 2 - 0.5f, sy = (y + 0.5f) / 2 - 0.5f;
+			if(sx < 0) sx = 0;
+			if(sy < 0) sy = 0;
+			int x0 = int(sx), y0 = int(sy);
+			int x1 = x0 + 1 < sw ? x0 + 1 : x0, y1 = y0 + 1 < sh ? y0 + 1 : y0;
+			float fx = sx - x0, fy = sy - y0;
+			for(int c = 0; c < 3; c++)
+			{
+				float top = src[(y0*sw + x0)*4 + c]*(1 - fx) + src[(y0*sw + x1)*4 + c]*fx;
+				float bottom = src[(y1*sw + x0)*4 + c]*(1 - fx) + src[(y1*sw + x1)*4 + c]*fx;
+				p.rgb[(y*p.w + x)*4 + c] = uchar(top*(1 - fy) + bottom*fy + 0.5f);
+			}
+		}
+}
+
+// Chessboard distance of every unknown pixel to the nearest known one (0 for
+// the known pixels), by the two pass chamfer transform. Returns the largest.
+static int hole_distance(const vector<char>& hole, int w, int h, vector<int>& d)
+{
+	const int far = w + h;
+	d.resize(w*h);
+	for(int y = 0; y < h; y++)
+		for(int x = 0; x < w; x++)
+		{
+			int& v = d[y*w + x];
+			if(!hole[y*w + x])
+			{
+				v = 0;
+				continue;
+			}
+			v = far;
+			if(x > 0 && d[y*w + x - 1] + 1 < v) v = d[y*w + x - 1] + 1;
+			if(y > 0)
+				for(int i = x > 0 ? x - 1 : x; i <= x + 1 && i < w; i++)
+					if(d[(y - 1)*w + i] + 1 < v) v = d[(y - 1)*w + i] + 1;
+		}
+	int dmax = 0;
+	for(int y = h - 1; y >= 0; y--)
+		for(int x = w - 1; x >= 0; x--)
+		{
+			int& v = d[y*w + x];
+			if(x < w - 1 && d[y*w + x + 1] + 1 < v) v = d[y*w + x + 1] + 1;
+			if(y < h - 1)
+				for(int i = x > 0 ? x - 1 : x; i <= x + 1 && i < w; i++)
+					if(d[(y + 1)*w + i] + 1 < v) v = d[(y + 1)*w + i] + 1;
+			if(v > dmax)
+				dmax = v;
+		}
+	return dmax;
+}
+
+void build_pyramid(const Image* image, const Image* mask, int levels, vector<PyramidLevel>& pyr)
+{
+	pyr.resize(levels + 1);
+	read_level(image, mask, pyr[0]);
+	for(int l = 1; l <= levels; l++)
+		halve(pyr[l - 1], pyr[l]);
+}
+
+static Image* make_image(int w, int h, const uchar* rgb)
+{
+	Image* res = new Image;
+	res->setsize(w, h);
+	res->setpixeltype(RGB32);
+	memcpy(res->buffer(), rgb, w*h*4);
+	res->buffer_changed();
+	return res;
+}
+
+static Image* make_mask(int w, int h, const vector<char>& todo)
+{
+	Image* res = new Image;
+	res->setsize(w, h);
+	res->setpixeltype(RGB32);
+	uchar* m = res->buffer();
+	for(int i = 0; i < w*h; i++)
+	{
+		uchar v = todo[i] ? 0 : 255;
+		m[i*4 + 0] = m[i*4 + 1] = m[i*4 + 2] = v;
+		m[i*4 + 3] = 0;
+	}
+	return res;
+}
+
+Image* pyramid_image(const PyramidLevel& p)
+{
+	return make_image(p.w, p.h, &p.rgb[0]);
+}
+
+Image* pyramid_mask(const PyramidLevel& p)
+{
+	return make_mask(p.w, p.h, p.hole);
+}
+
+int pyramid_depth(const Image* mask, int band)
+{
+	PyramidLevel p;
+	p.w = mask->buffer_width();
+	p.h = mask->buffer_height();
+	p.hole.resize(p.w*p.h);
+	const uchar* m = mask->buffer();
+	for(int i = 0; i < p.w*p.h; i++)
+		p.hole[i] = m[i*4 + 0] == 0 && m[i*4 + 1] == 0 && m[i*4 + 2] == 0;
+	vector<int> d;
+	int radius = hole_distance(p.hole, p.w, p.h, d);
+
+	int levels = 0, w = p.w, h = p.h;
+	while(2*radius > band && levels < PYRAMID_MAX_LEVELS &&
+		w / 2 >= PYRAMID_MIN_SIZE && h / 2 >= PYRAMID_MIN_SIZE)
+	{
+		radius = (radius + 1) / 2;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+		levels++;
+	}
+	return levels;
+}
+
+Image* inpaint_pyramid(const Image* image, const Image* mask,
+	InpaintFunction inpaint, void* arg, int band, int levels)
+{
+	assert(image->buffer_width() == mask->buffer_width());
+	assert(image->buffer_height() == mask->buffer_height());
+
+	if(levels < 0)
+		levels = pyramid_depth(mask, band);
+
+	vector<PyramidLevel> pyr;
+	build_pyramid(image, mask, levels, pyr);
+
+	vector<uchar> result;  // inpainted pixels of the coarser level
+	for(int l = levels; l >= 0; l--)
+	{
+		PyramidLevel& p = pyr[l];
+		vector<char> todo(p.hole);
+		if(l < levels)
+		{
+			upsample_hole(result, pyr[l + 1].w, pyr[l + 1].h, p);
+			vector<int> d;
+			hole_distance(p.hole, p.w, p.h, d);
+			for(int i = 0; i < p.w*p.h; i++)
+				todo[i] = p.hole[i] && d[i] <= band;
+		}
+
+		bool any = false;
+		for(int i = 0; i < p.w*p.h && !any; i++)
+			any = todo[i] != 0;
+		if(any)
+		{
+			Image* im = make_image(p.w, p.h, &p.rgb[0]);
+			Image* m = make_mask(p.w, p.h, todo);
+			Image* r = inpaint(im, m, arg);
+			const uchar* rb = r->buffer();
+			for(int i = 0; i < p.w*p.h; i++)
+				if(todo[i])
+					memcpy(&p.rgb[i*4], &rb[i*4], 3);
+			delete r; delete m; delete im;
+		}
+		result.swap(p.rgb);
+	}
+
+	return make_image(pyr[0].w, pyr[0].h, &result[0]);
+}
+
+// Список литературы:
+//  [1] P. Burt, E. Adelson, "The Laplacian Pyramid as a Compact Image Code", 1983
+//  [2] Y. Wexler, E. Shechtman, M. Irani, "Space-Time Completion of Video", 2007
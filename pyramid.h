@@ -0,0 +1,45 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <vector>
+
+#include <fltk/Image.h>
+
+// Any of the inpainting algorithms, as seen by inpaint_pyramid(). The mask is
+// black where the image is unknown, like for inpaint_fast_marching().
+typedef fltk::Image* (*InpaintFunction)(const fltk::Image* image, const fltk::Image* mask, void* arg);
+
+// One level of an image pyramid
+struct PyramidLevel
+{
+	int w, h;
+	std::vector<unsigned char> rgb;  // RGB32 pixels
+	std::vector<char> hole;           // 1 where the pixel is unknown
+
+	PyramidLevel() : w(0), h(0), rgb(), hole() {}
+};
+
+// The image with its mask (black where unknown), followed by 'levels' levels
+// each half as large as the one before. A pixel of a level is unknown if any
+// of its four pixels in the finer one is, so the known ones never mix with
+// the hole.
+void build_pyramid(const fltk::Image* image, const fltk::Image* mask, int levels,
+	std::vector<PyramidLevel>& pyr);
+
+// A level as an image and a mask for the inpainting functions
+fltk::Image* pyramid_image(const PyramidLevel& p);
+fltk::Image* pyramid_mask(const PyramidLevel& p);
+
+// Number of times the image has to be halved for the thickest part of the hole
+// to be no more than 'band' pixels across (0 for holes that thin already)
+int pyramid_depth(const fltk::Image* mask, int band);
+
+// Coarse-to-fine inpainting. The image and the mask are halved 'levels' times
+// (-1: pyramid_depth()), the coarsest level is inpainted whole, and each finer
+// level gets the upsampled result of the coarser one as a guess for the hole.
+// At the finer levels only a band 'band' pixels wide along the hole's border is
+// inpainted again, with the guessed pixels deeper in the hole taken as known.
+fltk::Image* inpaint_pyramid(const fltk::Image* image, const fltk::Image* mask,
+	InpaintFunction inpaint, void* arg, int band, int levels = -1);
+
+#endif
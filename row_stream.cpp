@@ -0,0 +1,346 @@
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "row_stream.h"
+#include "image_io.h"
+#include "operations.h"
+
+using namespace std;
+
+
+RowStage::RowStage(RowStage* input, int w, int h) : input(input), w(w), h(h), row(size_t(w) * 4),
+	y(0), ring_rows(0), top(0), bottom(0), next_input(0), have_bottom(false)
+{
+}
+
+RowStage::~RowStage()
+{
+	delete input;
+}
+
+void RowStage::keep_rows(int behind, int ahead, int top, int bottom)
+{
+	size_t stride = size_t(input->width()) * 4;
+	ring_rows = behind + 1 + ahead;
+	this->top = top < input->height() ? top : input->height();
+	this->bottom = bottom < input->height() ? bottom : input->height();
+	ring.resize(ring_rows * stride);
+	top_rows.resize(this->top * stride);
+	bottom_rows.resize(this->bottom * stride);
+}
+
+const uchar* RowStage::input_row(int y)
+{
+	size_t stride = size_t(input->width()) * 4;
+	int in_h = input->height();
+	if(have_bottom && y >= in_h - bottom)
+		return &bottom_rows[(y - (in_h - bottom)) * stride];
+	if(y < top && y < next_input)
+		return &top_rows[y * stride];
+	for(; next_input <= y; next_input++)
+	{
+		const uchar* r = input->next();
+		if(!r)
+			return 0;
+		memcpy(&ring[(next_input % ring_rows) * stride], r, stride);
+		if(next_input < top)
+			memcpy(&top_rows[next_input * stride], r, stride);
+	}
+	assert(y > next_input - 1 - ring_rows);
+	return &ring[(y % ring_rows) * stride];
+}
+
+bool RowStage::prepare()
+{
+	if(!input->prepare())
+		return false;
+	if(bottom == 0 || have_bottom)
+		return true;
+	if(!input->rewind())
+		return false;
+	size_t stride = size_t(input->width()) * 4;
+	int in_h = input->height();
+	for(int k = 0; k < in_h; k++)
+	{
+		const uchar* r = input->next();
+		if(!r)
+			return false;
+		if(k >= in_h - bottom)
+			memcpy(&bottom_rows[(k - (in_h - bottom)) * stride], r, stride);
+	}
+	have_bottom = true;
+	return true;
+}
+
+bool RowStage::rewind()
+{
+	y = 0;
+	next_input = 0;
+	return !input || input->rewind();
+}
+
+const uchar* RowStage::next()
+{
+	if(y == h || !make_row(y))
+		return 0;
+	y++;
+	return &row[0];
+}
+
+size_t RowStage::memory() const
+{
+	return row.size() + ring.size() + top_rows.size() + bottom_rows.size() + input->memory();
+}
+
+int RowStage::passes() const
+{
+	return input->passes();
+}
+
+
+// The decoder, opened again for every pass after the first
+class SourceStage : public RowStage
+{
+public:
+	SourceStage(const char* filename, RowReader* reader) :
+		RowStage(0, reader->width(), reader->height()), filename(filename), reader(reader), opened(1),
+		read(false) {}
+	~SourceStage()
+	{
+		delete reader;
+	}
+
+	bool prepare()
+	{
+		return true;
+	}
+
+	bool rewind()
+	{
+		RowStage::rewind();
+		if(!read)
+			return true;
+		delete reader;
+		string error;
+		reader = open_row_reader(filename.c_str(), error);
+		opened++;
+		read = false;
+		return reader && reader->width() == w && reader->height() == h;
+	}
+
+	size_t memory() const
+	{
+		return row.size();
+	}
+
+	int passes() const
+	{
+		return opened;
+	}
+
+protected:
+	bool make_row(int)
+	{
+		read = true;
+		return reader && reader->read(&row[0]);
+	}
+
+private:
+	string filename;
+	RowReader* reader;
+	int opened;
+	bool read;		// any rows since the reader was opened
+};
+
+RowStage* source_stage(const char* filename, string& error)
+{
+	RowReader* reader = open_row_reader(filename, error);
+	return reader ? new SourceStage(filename, reader) : 0;
+}
+
+// Needs no window: the input row is used where it is
+class PointStage : public RowStage
+{
+public:
+	PointStage(RowStage* input, void (*row_op)(const uchar*, int, int, int, uchar*)) :
+		RowStage(input, input->width(), input->height()), row_op(row_op) {}
+
+protected:
+	bool make_row(int y)
+	{
+		const uchar* r = input->next();
+		if(!r)
+			return false;
+		row_op(r, 0, w, y, &row[0]);
+		return true;
+	}
+
+private:
+	void (*row_op)(const uchar*, int, int, int, uchar*);
+};
+
+RowStage* point_stage(RowStage* input, void (*row_op)(const uchar*, int, int, int, uchar*))
+{
+	return new PointStage(input, row_op);
+}
+
+class FilterStage : public RowStage
+{
+public:
+	FilterStage(RowStage* input, const double* kernel, int kern_height, int kern_width) :
+		RowStage(input, input->width(), input->height()), kernel(kernel, kernel + kern_height * kern_width),
+		kern_height(kern_height), kern_width(kern_width), rows(kern_height)
+	{
+		assert(kern_height % 2);
+		assert(kern_width % 2);
+		keep_rows(kern_height / 2, kern_height / 2, kern_height / 2, kern_height / 2);
+	}
+
+protected:
+	bool make_row(int y)
+	{
+		for(int j = -int(kern_height / 2); j <= kern_height / 2; j++)
+		{
+			int y_idx = j + y;
+			if(y_idx < 0)
+				y_idx += h;
+			if(y_idx >= h)
+				y_idx -= h;
+			rows[j + kern_height / 2] = input_row(y_idx);
+			if(!rows[j + kern_height / 2])
+				return false;
+		}
+		filter_row(&kernel[0], kern_height, kern_width, &rows[0], w, &row[0]);
+		return true;
+	}
+
+private:
+	vector<double> kernel;
+	int kern_height, kern_width;
+	vector<const uchar*> rows;
+};
+
+RowStage* filter_stage(RowStage* input, const double* kernel, int kern_height, int kern_width)
+{
+	return new FilterStage(input, kernel, kern_height, kern_width);
+}
+
+// Past the bottom edge it reads rows N - j, among the first N + N/2 + 1
+class SlidingAverageStage : public RowStage
+{
+public:
+	SlidingAverageStage(RowStage* input, int N) :
+		RowStage(input, input->width(), input->height()), N(N), rows(N/2 * 2 + 1)
+	{
+		assert(N > 0);
+		keep_rows(N/2, N/2, N + N/2 + 1, N/2);
+	}
+
+protected:
+	bool make_row(int y)
+	{
+		for(int j = -N/2; j <= N/2; j++)
+		{
+			rows[j + N/2] = input_row(sliding_average_row_index(y, j, N, h));
+			if(!rows[j + N/2])
+				return false;
+		}
+		sliding_average_row(&rows[0], w, N, &row[0]);
+		return true;
+	}
+
+private:
+	int N;
+	vector<const uchar*> rows;
+};
+
+RowStage* sliding_average_stage(RowStage* input, int N)
+{
+	return new SlidingAverageStage(input, N);
+}
+
+class UpscaleStage : public RowStage
+{
+public:
+	UpscaleStage(RowStage* input, int N, bool bilinear) :
+		RowStage(input, input->width() * N, input->height() * N), N(N), bilinear(bilinear)
+	{
+		assert(N > 0);
+		keep_rows(0, 1, 0, 0);
+	}
+
+protected:
+	bool make_row(int y)
+	{
+		int in_w = input->width(), in_h = input->height();
+		int floor_y = y / N;
+		const uchar* floor_row = input_row(floor_y);
+		if(!floor_row)
+			return false;
+		if(!bilinear)
+		{
+			upscale_nn_row(floor_row, in_w, N, &row[0]);
+			return true;
+		}
+		const uchar* ceil_row = floor_y + 1 < in_h ? input_row(floor_y + 1) : floor_row;
+		if(!ceil_row)
+			return false;
+		upscale_bilinear_row(floor_row, ceil_row, in_w, N, y, &row[0]);
+		return true;
+	}
+
+private:
+	int N;
+	bool bilinear;
+};
+
+RowStage* upscale_stage(RowStage* input, int N, bool bilinear)
+{
+	return new UpscaleStage(input, N, bilinear);
+}
+
+
+bool stream_image(const char* input, const char* output, const vector<const char*>& ops, string& error,
+	StreamStats* stats, const Progress* progress)
+{
+	RowStage* stage = source_stage(input, error);
+	for(size_t k = 0; stage && k < ops.size(); k++)
+		stage = stream_operation(ops[k], stage, error);
+	if(!stage)
+		return false;
+
+	bool ok = stage->prepare() && stage->rewind();
+	if(!ok)
+		error = string(input) + ": read error";
+	RowWriter* writer = ok ? open_row_writer(output, stage->width(), stage->height(), error) : 0;
+	ok = writer != 0;
+	for(int y = 0; ok && y < stage->height(); y++)
+	{
+		if(progress && progress->report)
+			progress->report(100.0 * y / stage->height(), progress->arg);
+		const uchar* r = stage->next();
+		if(!r)
+			error = string(input) + ": read error";
+		else if(!writer->write(r))
+			error = string(output) + ": write error";
+		ok = r && error.empty();
+	}
+	if(ok && !writer->finish())
+	{
+		error = string(output) + ": write error";
+		ok = false;
+	}
+	delete writer;
+	if(stats)
+	{
+		stats->w = stage->width();
+		stats->h = stage->height();
+		stats->memory = stage->memory();
+		stats->passes = stage->passes();
+	}
+	delete stage;
+	return ok;
+}
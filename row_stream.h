@@ -0,0 +1,90 @@
+#ifndef ROW_STREAM_H
+#define ROW_STREAM_H
+
+#include <string>
+#include <vector>
+
+#include <fltk/FL_API.h>
+
+#include "tile_op.h"
+
+// Streaming: the operations that make a row of their result from a few rows
+// of their input (grayscale, the dithers, the filters, the sliding average,
+// the upscales) run on a file a row at a time, from the decoder through a
+// chain of stages to the encoder. Every stage keeps a window of the input
+// rows it needs, so the memory taken depends on the width of the image and
+// the operations, not on its height.
+//
+// The filters wrap around at the borders, so the first rows of their result
+// need the last rows of their input: these are got beforehand by a pass over
+// the input, which reads the file once more for every such stage.
+
+class RowStage
+{
+public:
+	// The stage owns its input
+	virtual ~RowStage();
+	int width() const { return w; }
+	int height() const { return h; }
+	// The passes over the input the stage needs before its rows can be had;
+	// false on a read error
+	virtual bool prepare();
+	// Starts over from row 0
+	virtual bool rewind();
+	// The next row of the result, valid until the next call; 0 on a read error
+	const uchar* next();
+	// Bytes held by this stage and the ones before it
+	virtual size_t memory() const;
+	// Times the file has been opened
+	virtual int passes() const;
+
+protected:
+	RowStage(RowStage* input, int w, int h);
+	// Keeps the input rows from 'behind' above the current one to 'ahead'
+	// below it, the first 'top' rows and the last 'bottom' ones
+	void keep_rows(int behind, int ahead, int top, int bottom);
+	// Input row y, in the window kept; 0 on a read error. The rows asked for
+	// have to move down the image, as for a kernel over it.
+	const uchar* input_row(int y);
+	// Row y of the result into 'row'; false on a read error
+	virtual bool make_row(int y) = 0;
+
+	RowStage* input;
+	int w, h;
+	std::vector<uchar> row;
+
+private:
+	int y;			// the next row of the result
+	int ring_rows, top, bottom;
+	int next_input;		// the next row to read from the input
+	bool have_bottom;
+	std::vector<uchar> ring, top_rows, bottom_rows;
+
+	RowStage(const RowStage&);
+	RowStage& operator=(const RowStage&);
+};
+
+// The rows of an image file; 0, with the reason in 'error', if it can't be
+// read by rows (see open_row_reader())
+RowStage* source_stage(const char* filename, std::string& error);
+// row_op() on every row of the input
+RowStage* point_stage(RowStage* input, void (*row_op)(const uchar* row, int x, int w, int y, uchar* out));
+RowStage* filter_stage(RowStage* input, const double* kernel, int kern_height, int kern_width);
+RowStage* sliding_average_stage(RowStage* input, int N);
+RowStage* upscale_stage(RowStage* input, int N, bool bilinear);
+
+struct StreamStats
+{
+	int w, h;		// of the result
+	size_t memory;		// held by the stages, apart from the codecs
+	int passes;
+};
+
+// Runs the operations (see run_operation()) on the image in 'input' and
+// writes the result to 'output', a row at a time; false, with the reason in
+// 'error', if one of them can't be streamed or the files can't be read or
+// written
+bool stream_image(const char* input, const char* output, const std::vector<const char*>& ops,
+	std::string& error, StreamStats* stats = 0, const Progress* progress = 0);
+
+#endif
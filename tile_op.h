@@ -0,0 +1,23 @@
+#ifndef TILE_OP_H
+#define TILE_OP_H
+
+#include <fltk/FL_API.h>
+
+// Told how far an operation has got, in percent, after every row of the result
+struct Progress
+{
+	void (*report)(double percent, void* arg);
+	void* arg;
+};
+
+// An operation as it runs on tiles (see tile_store.h): the 3x3 kernel if
+// it's a filter, wrapping around at the borders, then row_op() on every row
+// if it has one, given the column the tile starts at
+struct TileOp
+{
+	bool filter;
+	double kernel[9];
+	void (*row_op)(const uchar* row, int x, int w, int y, uchar* out);
+};
+
+#endif
@@ -0,0 +1,527 @@
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fltk/Threads.h>
+
+#include "tile_store.h"
+#include "image_io.h"
+#include "operations.h"
+#include "parallel.h"
+
+using namespace std;
+using namespace fltk;
+
+
+static const char TILES_MAGIC[8] = { 'I', 'M', 'G', 'T', 'I', 'L', 'E', '1' };
+static const unsigned BYTE_ORDER_MARK = 0x01020304;
+
+struct TileHeader
+{
+	char magic[8];
+	unsigned byte_order;	// BYTE_ORDER_MARK as written by the machine
+	unsigned type;
+	int w, h;
+	int tile;
+	unsigned reserved;
+};
+
+static bool good_tile_size(int tile)
+{
+	return tile >= 128 && tile <= 4096 && (tile & (tile - 1)) == 0;
+}
+
+TileStore::TileStore(const char* filename, bool writable) : name(filename), writable(writable), w(0), h(0),
+	pixel_type(TILES_RGB32), tile(0), tiles(), recent(), budget(size_t(256) << 20), counts(), mutex(new Mutex),
+	file()
+{
+}
+
+TileStore::~TileStore()
+{
+	for(size_t k = 0; k < tiles.size(); k++)
+		if(tiles[k].data)
+			unmap_view(tiles[k].data, tile_bytes());
+	delete mutex;
+}
+
+// The file, opened or created 'length' bytes long, to be mapped
+bool TileStore::open_file(bool create, unsigned long long length, string& error)
+{
+	bool opened = create ? file.create(name.c_str()) :
+		file.open(name.c_str(), writable ? FILE_MAPPING::WRITE : FILE_MAPPING::READ);
+	if(!opened)
+	{
+		error = name + (create ? ": can't create the file" : ": no such file");
+		return false;
+	}
+	if(create && !file.resize(length))
+	{
+		error = name + ": no room for the file";
+		return false;
+	}
+	if(file.size() < TILE_HEADER_BYTES)
+	{
+		error = name + ": not a tile store";
+		return false;
+	}
+	return true;
+}
+
+TileStore* TileStore::create(const char* filename, int w, int h, int type, string& error, int tile)
+{
+	if(w <= 0 || h <= 0 || (type != TILES_RGB32 && type != TILES_FLOAT) || !good_tile_size(tile))
+	{
+		error = string(filename) + ": bad size or type for a tile store";
+		return 0;
+	}
+	TileStore* store = new TileStore(filename, true);
+	store->w = w;
+	store->h = h;
+	store->pixel_type = type;
+	store->tile = tile;
+	store->tiles.resize(size_t(store->tiles_x()) * store->tiles_y());
+	unsigned long long length = TILE_HEADER_BYTES +
+		(unsigned long long)store->tiles.size() * store->tile_bytes();
+	uchar* view = 0;
+	if(store->open_file(true, length, error))
+		view = store->map_view(0, TILE_HEADER_BYTES);
+	if(!view)
+	{
+		if(error.empty())
+			error = string(filename) + ": can't map the file";
+		delete store;
+		remove(filename);
+		return 0;
+	}
+
+	// The tiles are the file growing, all zeros, until written
+	TileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TILES_MAGIC, sizeof(header.magic));
+	header.byte_order = BYTE_ORDER_MARK;
+	header.type = type;
+	header.w = w;
+	header.h = h;
+	header.tile = tile;
+	memcpy(view, &header, sizeof(header));
+	unmap_view(view, TILE_HEADER_BYTES);
+	return store;
+}
+
+TileStore* TileStore::open(const char* filename, bool writable, string& error)
+{
+	TileStore* store = new TileStore(filename, writable);
+	uchar* view = 0;
+	if(store->open_file(false, 0, error))
+		view = store->map_view(0, TILE_HEADER_BYTES);
+	if(!view)
+	{
+		if(error.empty())
+			error = string(filename) + ": can't map the file";
+		delete store;
+		return 0;
+	}
+	TileHeader header;
+	memcpy(&header, view, sizeof(header));
+	unmap_view(view, TILE_HEADER_BYTES);
+	bool ok = memcmp(header.magic, TILES_MAGIC, sizeof(header.magic)) == 0 &&
+		header.byte_order == BYTE_ORDER_MARK && (header.type == TILES_RGB32 || header.type == TILES_FLOAT) &&
+		header.w > 0 && header.h > 0 && good_tile_size(header.tile);
+	if(ok)
+	{
+		store->w = header.w;
+		store->h = header.h;
+		store->pixel_type = header.type;
+		store->tile = header.tile;
+		store->tiles.assign(size_t(store->tiles_x()) * store->tiles_y(), Tile());
+		ok = store->file.size() >= TILE_HEADER_BYTES +
+			(unsigned long long)store->tiles.size() * store->tile_bytes();
+	}
+	if(!ok)
+	{
+		error = string(filename) + ": not a tile store";
+		delete store;
+		return 0;
+	}
+	return store;
+}
+
+void TileStore::unmap(int k)
+{
+	unmap_view(tiles[k].data, tile_bytes());
+	tiles[k].data = 0;
+	counts.resident -= tile_bytes();
+	counts.evictions++;
+}
+
+uchar* TileStore::lock(int tx, int ty)
+{
+	int k = ty * tiles_x() + tx;
+	mutex->lock();
+	Tile& t = tiles[k];
+	if(t.data)
+	{
+		counts.hits++;
+		recent.splice(recent.begin(), recent, t.lru);
+	}
+	else
+	{
+		counts.misses++;
+		// Room for it: the least recently used tiles go, unless locked
+		for(list<int>::iterator i = recent.end(); counts.resident + tile_bytes() > budget && i != recent.begin(); )
+		{
+			--i;
+			if(tiles[*i].locks > 0)
+				continue;
+			int victim = *i;
+			i = recent.erase(i);
+			unmap(victim);
+		}
+		t.data = map_view(TILE_HEADER_BYTES + (unsigned long long)k * tile_bytes(), tile_bytes());
+		if(!t.data)
+		{
+			mutex->unlock();
+			return 0;
+		}
+		recent.push_front(k);
+		t.lru = recent.begin();
+		counts.resident += tile_bytes();
+		if(counts.resident > counts.peak)
+			counts.peak = counts.resident;
+	}
+	t.locks++;
+	uchar* data = t.data;
+	mutex->unlock();
+	return data;
+}
+
+void TileStore::unlock(int tx, int ty)
+{
+	mutex->lock();
+	tiles[ty * tiles_x() + tx].locks--;
+	mutex->unlock();
+}
+
+bool TileStore::read_pixels(int x, int y, int n, uchar* out)
+{
+	while(n > 0)
+	{
+		int col = x % tile;
+		int m = tile - col < n ? tile - col : n;
+		const uchar* data = lock(x / tile, y / tile);
+		if(!data)
+			return false;
+		memcpy(out, data + (size_t(y % tile) * tile + col) * 4, size_t(m) * 4);
+		unlock(x / tile, y / tile);
+		x += m;
+		out += size_t(m) * 4;
+		n -= m;
+	}
+	return true;
+}
+
+bool TileStore::read_rgb32(int x, int y, int n, uchar* out)
+{
+	if(!read_pixels(x, y, n, out))
+		return false;
+	if(pixel_type == TILES_FLOAT)
+		for(int k = 0; k < n; k++)
+		{
+			float v;
+			memcpy(&v, out + k * 4, 4);
+			unsigned gray = v > 255 ? 255 : v > 0 ? unsigned(v) : 0;
+			unsigned pixel = 0xff000000u | (gray << 16) | (gray << 8) | gray;
+			memcpy(out + k * 4, &pixel, 4);
+		}
+	return true;
+}
+
+void TileStore::set_budget(size_t bytes)
+{
+	mutex->lock();
+	budget = bytes;
+	mutex->unlock();
+}
+
+TileStats TileStore::stats()
+{
+	mutex->lock();
+	TileStats s = counts;
+	mutex->unlock();
+	return s;
+}
+
+bool TileStore::flush()
+{
+	bool ok = true;
+	mutex->lock();
+	for(size_t k = 0; writable && k < tiles.size(); k++)
+		if(tiles[k].data)
+			ok = FILE_MAPPING::flush((char*)tiles[k].data, tile_bytes()) && ok;
+	mutex->unlock();
+	return ok;
+}
+
+
+// Reading and writing by rows
+
+class TileRowReader : public RowReader
+{
+public:
+	TileRowReader(TileStore* store) : store(store), y(0)
+	{
+		w = store->width();
+		h = store->height();
+	}
+	~TileRowReader()
+	{
+		delete store;
+	}
+
+	bool read(uchar* row)
+	{
+		if(y == h || !store->read_rgb32(0, y, w, row))
+			return false;
+		y++;
+		return true;
+	}
+
+private:
+	TileStore* store;
+	int y;
+};
+
+RowReader* open_tile_rows(const char* filename, string& error)
+{
+	TileStore* store = TileStore::open(filename, false, error);
+	return store ? new TileRowReader(store) : 0;
+}
+
+// The file is removed unless finish() is called
+class TileRowWriter : public RowWriter
+{
+public:
+	TileRowWriter(TileStore* store) : store(store), y(0) {}
+	~TileRowWriter()
+	{
+		if(store)
+		{
+			string filename = store->filename();
+			delete store;
+			remove(filename.c_str());
+		}
+	}
+
+	bool write(const uchar* row)
+	{
+		int w = store->width(), tile = store->tile_size();
+		if(y == store->height())
+			return false;
+		for(int tx = 0; tx * tile < w; tx++)
+		{
+			uchar* data = store->lock(tx, y / tile);
+			if(!data)
+				return false;
+			int n = w - tx * tile < tile ? w - tx * tile : tile;
+			memcpy(data + size_t(y % tile) * tile * 4, row + size_t(tx) * tile * 4, size_t(n) * 4);
+			store->unlock(tx, y / tile);
+		}
+		y++;
+		return true;
+	}
+
+	bool finish()
+	{
+		if(y != store->height() || !store->flush())
+			return false;
+		delete store;
+		store = 0;
+		return true;
+	}
+
+private:
+	TileStore* store;
+	int y;
+};
+
+RowWriter* create_tile_rows(const char* filename, int w, int h, string& error)
+{
+	TileStore* store = TileStore::create(filename, w, h, TILES_RGB32, error);
+	return store ? new TileRowWriter(store) : 0;
+}
+
+
+// The operations
+
+struct TileJob
+{
+	const TileOp* op;
+	TileStore* input;
+	TileStore* output;
+	int ty;			// the row of tiles
+	volatile bool failed;
+};
+
+static int wrap(int v, int n)
+{
+	if(v < 0)
+		v += n;
+	if(v >= n)
+		v -= n;
+	return v;
+}
+
+// n pixels of row y from column x, which wrap around the sides of the image
+static bool read_wrapped(TileStore* store, int x, int y, int n, uchar* out)
+{
+	int w = store->width();
+	for(int k = 0; k < n; )
+	{
+		int from = wrap(x + k, w);
+		int m = w - from < n - k ? w - from : n - k;
+		if(!store->read_pixels(from, y, m, out + size_t(k) * 4))
+			return false;
+		k += m;
+	}
+	return true;
+}
+
+static bool run_tile(const TileJob& job, int tx)
+{
+	TileStore* in = job.input;
+	int tile = in->tile_size(), w = in->width(), h = in->height();
+	int x0 = tx * tile, y0 = job.ty * tile;
+	int tw = w - x0 < tile ? w - x0 : tile, th = h - y0 < tile ? h - y0 : tile;
+	size_t stride = size_t(tile) * 4;
+	uchar* dst = job.output->lock(tx, job.ty);
+	if(!dst)
+		return false;
+	bool ok = true;
+	if(!job.op->filter)
+	{
+		const uchar* src = in->lock(tx, job.ty);
+		ok = src != 0;
+		for(int y = 0; ok && y < th; y++)
+			job.op->row_op(src + y * stride, x0, tw, y0 + y, dst + y * stride);
+		if(src)
+			in->unlock(tx, job.ty);
+	}
+	else
+	{
+		// The rows of the tile with a pixel more all around, wrapped around
+		// the image as filter() has it
+		int ew = tw + 2;
+		vector<uchar> rows(size_t(th + 2) * ew * 4), res(size_t(ew) * 4);
+		for(int j = 0; ok && j < th + 2; j++)
+			ok = read_wrapped(in, x0 - 1, wrap(y0 + j - 1, h), ew, &rows[size_t(j) * ew * 4]);
+		for(int y = 0; ok && y < th; y++)
+		{
+			const uchar* around[3];
+			for(int j = 0; j < 3; j++)
+				around[j] = &rows[size_t(y + j) * ew * 4];
+			filter_row(job.op->kernel, 3, 3, around, ew, &res[0]);
+			if(job.op->row_op)
+				job.op->row_op(&res[4], x0, tw, y0 + y, dst + y * stride);
+			else
+				memcpy(dst + y * stride, &res[4], size_t(tw) * 4);
+		}
+	}
+	job.output->unlock(tx, job.ty);
+	return ok;
+}
+
+static void run_tile_range(int lo, int hi, void* arg)
+{
+	TileJob* job = (TileJob*)arg;
+	for(int tx = lo; tx < hi; tx++)
+		if(!run_tile(*job, tx))
+			job->failed = true;
+}
+
+TileStore* run_tiles(const char* spec, TileStore* input, const char* output, string& error,
+	const Progress* progress)
+{
+	TileOp op;
+	if(!tile_operation(spec, op, error))
+		return 0;
+	if(input->type() != TILES_RGB32)
+	{
+		error = string(input->filename()) + ": the operations need an RGB32 store";
+		return 0;
+	}
+	if(strcmp(input->filename(), output) == 0)
+	{
+		error = string(output) + ": the result can't overwrite the input";
+		return 0;
+	}
+	TileStore* res = TileStore::create(output, input->width(), input->height(), TILES_RGB32, error,
+		input->tile_size());
+	if(!res)
+		return 0;
+
+	TileJob job = { &op, input, res, 0, false };
+	for(job.ty = 0; job.ty < input->tiles_y() && !job.failed; job.ty++)
+	{
+		if(progress && progress->report)
+			progress->report(100.0 * job.ty / input->tiles_y(), progress->arg);
+		parallel_for(0, input->tiles_x(), 1, run_tile_range, &job);
+	}
+	if(job.failed || !res->flush())
+	{
+		error = string(output) + ": can't map the tiles";
+		delete res;
+		remove(output);
+		return 0;
+	}
+	return res;
+}
+
+static void add_stats(TileStats& total, TileStore* store)
+{
+	TileStats s = store->stats();
+	total.hits += s.hits;
+	total.misses += s.misses;
+	total.evictions += s.evictions;
+	total.resident += s.resident;
+	if(s.peak > total.peak)
+		total.peak = s.peak;
+}
+
+bool run_tile_operations(const char* input, const char* output, const vector<const char*>& ops, string& error,
+	TileStats* stats)
+{
+	TileStats total;
+	memset(&total, 0, sizeof(total));
+	TileStore* cur = TileStore::open(input, false, error);
+	bool ok = cur != 0;
+	if(ok && ops.empty())
+	{
+		error = "no operations to run";
+		ok = false;
+	}
+	for(size_t k = 0; ok && k < ops.size(); k++)
+	{
+		char part[32];
+		sprintf(part, ".part%d", int(k));
+		string name = k + 1 == ops.size() ? string(output) : string(output) + part;
+		TileStore* next = run_tiles(ops[k], cur, name.c_str(), error);
+		string done = cur->filename();
+		add_stats(total, cur);
+		delete cur;
+		if(k > 0)
+			remove(done.c_str());
+		cur = next;
+		ok = cur != 0;
+	}
+	if(cur)
+	{
+		add_stats(total, cur);
+		delete cur;
+	}
+	if(stats)
+		*stats = total;
+	return ok;
+}
@@ -0,0 +1,126 @@
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <fltk/FL_API.h>
+
+#include "binio.h"
+#include "tile_op.h"
+
+namespace fltk { class Mutex; }
+class RowReader;
+class RowWriter;
+
+// An image kept on disk in square tiles, for images too large for memory:
+// the tiles are mapped in as they are asked for, and the least recently used
+// are let go when the mapped ones pass a budget. Opening a store reads its
+// header only, and only the tiles touched are ever read from the disk.
+//
+// A store file (.tiles) is a header of TILE_HEADER_BYTES and the tiles one
+// after another, row by row of tiles. A tile is tile_size() rows of
+// tile_size() pixels, 4 bytes each: RGB32 words or floats, in the byte order
+// of the machine. The tiles on the right and bottom edges are whole, with
+// pixels past the image left as they are.
+
+const size_t TILE_HEADER_BYTES = 65536;	// the granularity of the mappings on Windows
+
+enum TileType
+{
+	TILES_RGB32 = 0,
+	TILES_FLOAT = 1		// one float per pixel: distance fields and such
+};
+
+struct TileStats
+{
+	unsigned long hits, misses, evictions;	// of lock()
+	size_t resident, peak;			// bytes mapped, now and at most
+};
+
+class TileStore
+{
+public:
+	// A new store of w x h pixels, all 0; 0, with the reason in 'error', if
+	// it can't be created. tile is a power of 2, 128 to 4096.
+	static TileStore* create(const char* filename, int w, int h, int type, std::string& error,
+		int tile = 256);
+	// An existing store; 0, with the reason in 'error', if it's not one
+	static TileStore* open(const char* filename, bool writable, std::string& error);
+	// Unmaps the tiles, written ones going to the file
+	~TileStore();
+
+	const char* filename() const	{ return name.c_str(); }
+	int width() const		{ return w; }
+	int height() const		{ return h; }
+	int type() const		{ return pixel_type; }
+	int tile_size() const		{ return tile; }
+	int tiles_x() const		{ return (w + tile - 1) / tile; }
+	int tiles_y() const		{ return (h + tile - 1) / tile; }
+	size_t tile_bytes() const	{ return size_t(tile) * tile * 4; }
+
+	// Tile (tx, ty), mapped in if it wasn't, kept until unlock(); 0 if it
+	// can't be mapped. Safe to call from several threads.
+	uchar* lock(int tx, int ty);
+	void unlock(int tx, int ty);
+	// n pixels of row y from column x, across the tiles, into 'out'
+	bool read_pixels(int x, int y, int n, uchar* out);
+	// The same as RGB32, floats made gray, clamped to 0 ... 255
+	bool read_rgb32(int x, int y, int n, uchar* out);
+
+	// The bytes of tiles kept mapped when they are not locked (256 MB by
+	// default); more are mapped while locked
+	void set_budget(size_t bytes);
+	TileStats stats();
+	// Writes the tiles changed so far to the file
+	bool flush();
+
+private:
+	TileStore(const char* filename, bool writable);
+	bool open_file(bool create, unsigned long long length, std::string& error);
+	uchar* map_view(unsigned long long offset, size_t bytes)	{ return (uchar*)file.map(offset, bytes); }
+	static void unmap_view(uchar* p, size_t bytes)	{ FILE_MAPPING::unmap((char*)p, bytes); }
+	void unmap(int k);
+
+	struct Tile
+	{
+		Tile() : data(0), locks(0), lru() {}
+		uchar* data;
+		int locks;
+		std::list<int>::iterator lru;	// in 'recent', while mapped
+	};
+
+	std::string name;
+	bool writable;
+	int w, h, pixel_type, tile;
+	std::vector<Tile> tiles;
+	std::list<int> recent;		// the mapped tiles, the last used first
+	size_t budget;
+	TileStats counts;
+	fltk::Mutex* mutex;
+	FILE_MAPPING file;
+
+	TileStore(const TileStore&);
+	TileStore& operator=(const TileStore&);
+};
+
+// Reading and writing a store by rows, for open_row_reader() and
+// open_row_writer(). The rows of a float store are read as gray, the floats
+// clamped to 0 ... 255; the stores written are RGB32.
+RowReader* open_tile_rows(const char* filename, std::string& error);
+RowWriter* create_tile_rows(const char* filename, int w, int h, std::string& error);
+
+// Runs the operation on the tiles of 'input' into a new store, 'output', a
+// row of tiles after another with the tiles of a row in parallel; 0, with the
+// reason in 'error', if it fails or can't be run by tiles (see
+// tile_operation())
+TileStore* run_tiles(const char* spec, TileStore* input, const char* output, std::string& error,
+	const Progress* progress = 0);
+// The operations one after the other from store to store; the stores in
+// between are written next to 'output' and removed
+bool run_tile_operations(const char* input, const char* output, const std::vector<const char*>& ops,
+	std::string& error, TileStats* stats = 0);
+
+#endif